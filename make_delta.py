@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+# Builds a delta update between two firmware builds, for /ota/upload?target=delta. The device
+# rebuilds the new image from the one it's running, so the patch only applies to that exact
+# old firmware.bin. The format is described in src/DeltaPatch.h.
+#
+#   python make_delta.py old/firmware.bin new/firmware.bin firmware.delta --verify
+#
+# --verify applies the patch again and reports transfer size and apply time.
+import argparse
+import gzip
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"SFSD"
+VERSION = 1
+HEADER_SIZE = 48
+
+OP_END = 0
+OP_COPY = 1
+OP_DIFF = 2
+OP_INSERT = 3
+
+# Matches are found through windows of the old image, indexed every INDEX_STEP bytes
+WINDOW = 16
+INDEX_STEP = 4
+# Shorter matches cost more in op headers than they save
+MIN_MATCH = 24
+
+
+def index_old(old):
+    index = {}
+    for offset in range(0, len(old) - WINDOW + 1, INDEX_STEP):
+        index.setdefault(old[offset:offset + WINDOW], offset)
+    return index
+
+
+def encode_gap(ops, old, new, start, end, old_pos):
+    """Bytes of the new image without a match. Code that only moved differs from the old bytes
+    after the previous match in a few addresses, so a mostly zero DIFF against those compresses
+    far better than inserting them."""
+    length = end - start
+    if length == 0:
+        return
+    if old_pos + length <= len(old):
+        diff = bytes((new[start + i] - old[old_pos + i]) & 0xFF for i in range(length))
+        if diff.count(0) * 2 >= length:
+            ops.append(struct.pack("<BII", OP_DIFF, old_pos, length) + diff)
+            return
+    ops.append(struct.pack("<BI", OP_INSERT, length) + new[start:end])
+
+
+def diff_images(old, new):
+    index = index_old(old)
+    ops = []
+    pos = 0  # Start of the new bytes not covered yet
+    old_pos = 0  # Where the old image continues after the last match
+    i = 0
+    while i <= len(new) - WINDOW:
+        candidate = index.get(new[i:i + WINDOW])
+        if candidate is None:
+            i += 1
+            continue
+
+        start, old_start = i, candidate
+        end, old_end = i + WINDOW, candidate + WINDOW
+        while end < len(new) and old_end < len(old) and new[end] == old[old_end]:
+            end += 1
+            old_end += 1
+        while start > pos and old_start > 0 and new[start - 1] == old[old_start - 1]:
+            start -= 1
+            old_start -= 1
+        if end - start < MIN_MATCH:
+            i += 1
+            continue
+
+        encode_gap(ops, old, new, pos, start, old_pos)
+        ops.append(struct.pack("<BII", OP_COPY, old_start, end - start))
+        pos = i = end
+        old_pos = old_end
+
+    encode_gap(ops, old, new, pos, len(new), old_pos)
+    ops.append(struct.pack("<B", OP_END))
+    return b"".join(ops)
+
+
+def make_patch(old, new):
+    header = MAGIC + struct.pack("<BxxxII", VERSION, len(old), len(new))
+    header += hashlib.md5(old).hexdigest().encode("ascii")
+    assert len(header) == HEADER_SIZE
+
+    # Raw deflate, the device inflates it with the ROM decompressor
+    compressor = zlib.compressobj(9, zlib.DEFLATED, -15)
+    return header + compressor.compress(diff_images(old, new)) + compressor.flush()
+
+
+def apply_patch(old, patch):
+    """Reference implementation of what the device does"""
+    if patch[:4] != MAGIC or patch[4] != VERSION:
+        raise ValueError("not a delta patch")
+    old_size, new_size = struct.unpack_from("<II", patch, 8)
+    if old_size != len(old) or patch[16:48].decode("ascii") != hashlib.md5(old).hexdigest():
+        raise ValueError("patch is for a different firmware")
+
+    ops = zlib.decompress(patch[HEADER_SIZE:], -15)
+    new = bytearray()
+    at = 0
+    while True:
+        op = ops[at]
+        at += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            offset, length = struct.unpack_from("<II", ops, at)
+            at += 8
+            new += old[offset:offset + length]
+        elif op == OP_DIFF:
+            offset, length = struct.unpack_from("<II", ops, at)
+            at += 8
+            new += bytes((old[offset + i] + ops[at + i]) & 0xFF for i in range(length))
+            at += length
+        elif op == OP_INSERT:
+            (length,) = struct.unpack_from("<I", ops, at)
+            at += 4
+            new += ops[at:at + length]
+            at += length
+        else:
+            raise ValueError("unknown patch operation %d" % op)
+    if len(new) != new_size:
+        raise ValueError("patch produced the wrong image size")
+    return bytes(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a delta firmware update")
+    parser.add_argument("old", help="firmware.bin running on the device")
+    parser.add_argument("new", help="firmware.bin to update to")
+    parser.add_argument("patch", help="patch file to write")
+    parser.add_argument("--verify", action="store_true", help="apply the patch and compare")
+    args = parser.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+
+    started = time.time()
+    patch = make_patch(old, new)
+    elapsed = time.time() - started
+    with open(args.patch, "wb") as f:
+        f.write(patch)
+
+    full = len(gzip.compress(new, 9))
+    print(f"Patch: {len(patch)} bytes, {100.0 * len(patch) / len(new):.1f}% of the "
+          f"{len(new)} byte image, {100.0 * len(patch) / full:.1f}% of it gzipped ({full} bytes)")
+    print(f"Built in {elapsed:.2f}s")
+    print(f"Upload with /ota/upload?target=delta&md5={hashlib.md5(new).hexdigest()}")
+
+    if args.verify:
+        started = time.time()
+        rebuilt = apply_patch(old, patch)
+        elapsed = time.time() - started
+        if rebuilt != new:
+            print("Verify FAILED: the patch doesn't rebuild the new image")
+            return 1
+        print(f"Verified, applied in {elapsed:.2f}s")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,79 @@
+# Packs the built web UI (the .gz files `npm run build` leaves in data/) into the firmware as a
+# generated header, see src/WebAssets.h. Runs before every build and only rewrites the header
+# when the UI changed. Without a built UI the table is empty and everything comes from LittleFS.
+Import("env")
+import hashlib
+import os
+
+DATA_DIR = os.path.join(env.subst("$PROJECT_DIR"), "data")
+OUTPUT_DIR = os.path.join(env.subst("$BUILD_DIR"), "generated")
+OUTPUT = os.path.join(OUTPUT_DIR, "web_assets_data.h")
+
+CONTENT_TYPES = {
+    ".htm": "text/html",
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".ico": "image/x-icon",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".json": "application/json",
+    ".woff2": "font/woff2",
+}
+
+
+def collect_assets():
+    assets = []
+    for root, _, files in os.walk(DATA_DIR):
+        for name in files:
+            if not name.endswith(".gz"):
+                continue
+            full = os.path.join(root, name)
+            path = "/" + os.path.relpath(full, DATA_DIR)[:-3].replace(os.sep, "/")
+            with open(full, "rb") as f:
+                data = f.read()
+            assets.append((path, data))
+    # The device looks paths up with a binary search over strcmp order
+    assets.sort(key=lambda asset: asset[0].encode("utf-8"))
+    return assets
+
+
+def render(assets):
+    lines = ["// Generated by pack_webui.py from data/, do not edit", ""]
+    for i, (path, data) in enumerate(assets):
+        lines.append(f"// {path}")
+        lines.append(f"static const uint8_t webAsset{i}[] = {{")
+        for start in range(0, len(data), 24):
+            lines.append("    " + ", ".join(str(b) for b in data[start:start + 24]) + ",")
+        lines.append("};")
+    lines.append("")
+    lines.append(f"#define WEB_ASSET_COUNT {len(assets)}")
+    lines.append("static const web_asset_t webAssets[] = {")
+    for i, (path, data) in enumerate(assets):
+        content_type = CONTENT_TYPES.get(os.path.splitext(path)[1], "application/octet-stream")
+        etag = '"\\"' + hashlib.sha256(data).hexdigest()[:16] + '\\""'
+        # Vite puts a content hash in everything under assets/, those never change
+        immutable = "true" if path.startswith("/assets/") else "false"
+        lines.append(f'    {{"{path}", "{content_type}", {etag}, webAsset{i}, {len(data)}, '
+                     f"{immutable}}},")
+    lines.append("    {NULL, NULL, NULL, NULL, 0, false},")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def pack():
+    assets = collect_assets()
+    content = render(assets)
+    os.makedirs(OUTPUT_DIR, exist_ok=True)
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, "r") as f:
+            if f.read() == content:
+                return
+    with open(OUTPUT, "w") as f:
+        f.write(content)
+    total = sum(len(data) for _, data in assets)
+    print(f"Packed {len(assets)} web UI files ({total} bytes) into the firmware")
+
+
+pack()
+env.Append(CPPPATH=[OUTPUT_DIR])
@@ -0,0 +1,67 @@
+#include "BootTiming.h"
+
+#include <ArduinoJson.h>
+
+#include "Logger.h"
+
+static const char *const phaseNames[BOOT_PHASE_COUNT] = {
+    "settings_loaded",   "wifi_started", "webserver_started", "wifi_connected",
+    "printer_connected", "first_status", "fs_mounted",        "time_synced",
+};
+
+// External reference to firmware version from main.cpp
+extern const char *firmwareVersion;
+
+BootTiming &BootTiming::getInstance()
+{
+    static BootTiming instance;
+    return instance;
+}
+
+BootTiming::BootTiming()
+{
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        reachedAt[i] = 0;
+    }
+}
+
+void BootTiming::mark(boot_phase_t phase)
+{
+    if (reachedAt[phase] != 0)
+    {
+        return;
+    }
+    reachedAt[phase] = micros();
+    logger.logf("Boot phase %s reached after %lums", phaseNames[phase],
+                (unsigned long) (reachedAt[phase] / 1000));
+}
+
+uint32_t BootTiming::getReachedAt(boot_phase_t phase)
+{
+    return reachedAt[phase];
+}
+
+String BootTiming::toJson()
+{
+    StaticJsonDocument<512> doc;
+    doc["firmware_version"] = firmwareVersion;
+
+    // Milliseconds since reset for every phase reached so far, null for the rest
+    JsonObject phases = doc.createNestedObject("phases");
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        if (reachedAt[i] != 0)
+        {
+            phases[phaseNames[i]] = reachedAt[i] / 1000.0;
+        }
+        else
+        {
+            phases[phaseNames[i]] = nullptr;
+        }
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
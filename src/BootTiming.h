@@ -0,0 +1,44 @@
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include <Arduino.h>
+
+// Milestones on the way from reset to monitoring the printer, in the order we expect them
+typedef enum
+{
+    BOOT_PHASE_SETTINGS_LOADED,
+    BOOT_PHASE_WIFI_STARTED,
+    BOOT_PHASE_WEBSERVER_STARTED,
+    BOOT_PHASE_WIFI_CONNECTED,
+    BOOT_PHASE_PRINTER_CONNECTED,
+    BOOT_PHASE_FIRST_STATUS,
+    BOOT_PHASE_FS_MOUNTED,  // Off the boot path, see WebServer::mountFilesystem()
+    BOOT_PHASE_TIME_SYNCED,
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+// Records how long after reset each boot phase was first reached
+class BootTiming
+{
+   private:
+    // Microseconds since reset, 0 while the phase hasn't been reached
+    uint32_t reachedAt[BOOT_PHASE_COUNT];
+
+    BootTiming();
+
+    BootTiming(const BootTiming &)            = delete;
+    BootTiming &operator=(const BootTiming &) = delete;
+
+   public:
+    static BootTiming &getInstance();
+
+    // Only the first call per phase is recorded, later ones (e.g. reconnects) are ignored
+    void     mark(boot_phase_t phase);
+    uint32_t getReachedAt(boot_phase_t phase);
+
+    String toJson();
+};
+
+#define bootTiming BootTiming::getInstance()
+
+#endif  // BOOT_TIMING_H
@@ -0,0 +1,389 @@
+#include "DeltaPatch.h"
+
+#include <sdkconfig.h>
+#include <string.h>
+
+// The inflater in ROM, no need to link a second copy. Which ROM is a target setting, so this has
+// to come after sdkconfig.h.
+#if CONFIG_IDF_TARGET_ESP32S3
+#include <esp32s3/rom/miniz.h>
+#else
+#include <esp32/rom/miniz.h>
+#endif
+
+#ifdef ARDUINO
+#include "MemoryPolicy.h"
+#define DELTA_ALLOCATE(size) memoryPolicy.allocate(size, MEMORY_BULK)
+#define DELTA_RELEASE(pointer) memoryPolicy.release(pointer)
+#else
+// Host build for the tests in test/
+#include <stdlib.h>
+#define DELTA_ALLOCATE(size) malloc(size)
+#define DELTA_RELEASE(pointer) free(pointer)
+#endif
+
+static uint32_t readLE32(const uint8_t *bytes)
+{
+    return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8) | ((uint32_t) bytes[2] << 16) |
+           ((uint32_t) bytes[3] << 24);
+}
+
+DeltaPatch::DeltaPatch()
+{
+    inflator      = NULL;
+    window        = NULL;
+    windowPos     = 0;
+    streamEnded   = false;
+    stage         = STAGE_FAILED;
+    headerLength  = 0;
+    op            = DELTA_OP_END;
+    argsLength    = 0;
+    argsNeeded    = 0;
+    oldOffset     = 0;
+    remaining     = 0;
+    written       = 0;
+    error         = "";
+    runningSize   = 0;
+    runningMd5[0] = '\0';
+    memset(&header, 0, sizeof(header));
+}
+
+DeltaPatch::~DeltaPatch()
+{
+    end();
+}
+
+bool DeltaPatch::begin(uint32_t oldSize, const char *oldMd5, OldReader reader, NewWriter writer)
+{
+    end();
+
+    readOld     = reader;
+    writeNew    = writer;
+    runningSize = oldSize;
+    strncpy(runningMd5, oldMd5, sizeof(runningMd5) - 1);
+    runningMd5[sizeof(runningMd5) - 1] = '\0';
+
+    stage        = STAGE_HEADER;
+    headerLength = 0;
+    windowPos    = 0;
+    streamEnded  = false;
+    written      = 0;
+    error        = "";
+    memset(&header, 0, sizeof(header));
+
+    inflator = DELTA_ALLOCATE(sizeof(tinfl_decompressor));
+    window   = (uint8_t *) DELTA_ALLOCATE(TINFL_LZ_DICT_SIZE);
+    if (inflator == NULL || window == NULL)
+    {
+        end();
+        return fail("out of memory");
+    }
+    tinfl_init((tinfl_decompressor *) inflator);
+    return true;
+}
+
+void DeltaPatch::end()
+{
+    DELTA_RELEASE(inflator);
+    DELTA_RELEASE(window);
+    inflator = NULL;
+    window   = NULL;
+}
+
+bool DeltaPatch::fail(const char *reason)
+{
+    error = reason;
+    stage = STAGE_FAILED;
+    return false;
+}
+
+bool DeltaPatch::write(const uint8_t *data, size_t length)
+{
+    if (stage == STAGE_FAILED || inflator == NULL)
+    {
+        return false;
+    }
+
+    if (stage == STAGE_HEADER)
+    {
+        size_t take = DELTA_HEADER_SIZE - headerLength;
+        if (take > length)
+        {
+            take = length;
+        }
+        memcpy(headerBytes + headerLength, data, take);
+        headerLength += take;
+        data += take;
+        length -= take;
+        if (headerLength < DELTA_HEADER_SIZE)
+        {
+            return true;
+        }
+        if (!parseHeader())
+        {
+            return false;
+        }
+        stage = STAGE_OP;
+    }
+
+    return length == 0 || inflate(data, length);
+}
+
+bool DeltaPatch::parseHeader()
+{
+    if (memcmp(headerBytes, DELTA_MAGIC, 4) != 0)
+    {
+        return fail("not a delta patch");
+    }
+    if (headerBytes[4] != DELTA_VERSION)
+    {
+        return fail("unsupported delta patch version");
+    }
+
+    header.oldSize = readLE32(headerBytes + 8);
+    header.newSize = readLE32(headerBytes + 12);
+    memcpy(header.oldMd5, headerBytes + 16, 32);
+    header.oldMd5[32] = '\0';
+
+    if (header.oldSize != runningSize || strcasecmp(header.oldMd5, runningMd5) != 0)
+    {
+        return fail("patch is for a different firmware than the one running");
+    }
+    return true;
+}
+
+bool DeltaPatch::inflate(const uint8_t *data, size_t length)
+{
+    // Raw deflate into the 32KB window, which doubles as the back reference history. Whatever
+    // comes out is handed to the op parser right away, the window wraps around after that.
+    tinfl_decompressor *decompressor = (tinfl_decompressor *) inflator;
+    while (true)
+    {
+        if (streamEnded)
+        {
+            return fail("data after the end of the patch");
+        }
+
+        size_t       inBytes  = length;
+        size_t       outBytes = TINFL_LZ_DICT_SIZE - windowPos;
+        tinfl_status status   = tinfl_decompress(decompressor, data, &inBytes, window,
+                                                 window + windowPos, &outBytes,
+                                                 TINFL_FLAG_HAS_MORE_INPUT);
+        data += inBytes;
+        length -= inBytes;
+
+        if (outBytes > 0 && !parseOps(window + windowPos, outBytes))
+        {
+            return false;
+        }
+        windowPos = (windowPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (status < TINFL_STATUS_DONE)
+        {
+            return fail("corrupt patch");
+        }
+        if (status == TINFL_STATUS_DONE)
+        {
+            if (stage != STAGE_DONE)
+            {
+                return fail("patch stream ended early");
+            }
+            streamEnded = true;
+            return length == 0 || fail("data after the end of the patch");
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0)
+        {
+            return true;
+        }
+    }
+}
+
+bool DeltaPatch::parseOps(uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        switch (stage)
+        {
+            case STAGE_OP:
+                op         = *data++;
+                argsLength = 0;
+                length--;
+                if (op == DELTA_OP_END)
+                {
+                    stage = STAGE_DONE;
+                }
+                else if (op == DELTA_OP_COPY || op == DELTA_OP_DIFF)
+                {
+                    argsNeeded = 8;
+                    stage      = STAGE_ARGS;
+                }
+                else if (op == DELTA_OP_INSERT)
+                {
+                    argsNeeded = 4;
+                    stage      = STAGE_ARGS;
+                }
+                else
+                {
+                    return fail("unknown patch operation");
+                }
+                break;
+
+            case STAGE_ARGS:
+                while (length > 0 && argsLength < argsNeeded)
+                {
+                    args[argsLength++] = *data++;
+                    length--;
+                }
+                if (argsLength == argsNeeded && !startOp())
+                {
+                    return false;
+                }
+                break;
+
+            case STAGE_DATA:
+            {
+                size_t take = remaining < length ? remaining : length;
+                if (!applyData(data, take))
+                {
+                    return false;
+                }
+                data += take;
+                length -= take;
+                remaining -= take;
+                if (remaining == 0)
+                {
+                    stage = STAGE_OP;
+                }
+                break;
+            }
+
+            case STAGE_DONE:
+                return fail("data after the end of the patch");
+
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatch::startOp()
+{
+    uint32_t offset = op == DELTA_OP_INSERT ? 0 : readLE32(args);
+    uint32_t length = readLE32(args + argsNeeded - 4);
+
+    if ((uint64_t) written + length > header.newSize)
+    {
+        return fail("patch writes past the end of the new image");
+    }
+    if (op != DELTA_OP_INSERT && (uint64_t) offset + length > header.oldSize)
+    {
+        return fail("patch reads past the end of the old image");
+    }
+
+    if (op == DELTA_OP_COPY)
+    {
+        stage = STAGE_OP;
+        return copyOld(offset, length);
+    }
+
+    oldOffset = offset;
+    remaining = length;
+    stage     = remaining > 0 ? STAGE_DATA : STAGE_OP;
+    return true;
+}
+
+bool DeltaPatch::copyOld(uint32_t offset, uint32_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = length < DELTA_READ_CHUNK ? length : DELTA_READ_CHUNK;
+        if (!readOld(offset, readBuffer, chunk))
+        {
+            return fail("reading the running firmware failed");
+        }
+        if (!emit(readBuffer, chunk))
+        {
+            return false;
+        }
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool DeltaPatch::applyData(uint8_t *data, size_t length)
+{
+    if (op == DELTA_OP_INSERT)
+    {
+        return emit(data, length);
+    }
+
+    while (length > 0)
+    {
+        size_t chunk = length < DELTA_READ_CHUNK ? length : DELTA_READ_CHUNK;
+        if (!readOld(oldOffset, readBuffer, chunk))
+        {
+            return fail("reading the running firmware failed");
+        }
+        for (size_t i = 0; i < chunk; i++)
+        {
+            readBuffer[i] += data[i];
+        }
+        if (!emit(readBuffer, chunk))
+        {
+            return false;
+        }
+        oldOffset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool DeltaPatch::emit(uint8_t *data, size_t length)
+{
+    if (!writeNew(data, length))
+    {
+        return fail("writing the new image failed");
+    }
+    written += length;
+    return true;
+}
+
+bool DeltaPatch::finish()
+{
+    if (stage == STAGE_FAILED)
+    {
+        return false;
+    }
+    if (stage != STAGE_DONE || !streamEnded)
+    {
+        return fail("patch is incomplete");
+    }
+    if (written != header.newSize)
+    {
+        return fail("patch produced the wrong image size");
+    }
+    return true;
+}
+
+bool DeltaPatch::hasHeader()
+{
+    return headerLength == DELTA_HEADER_SIZE;
+}
+
+const delta_header_t &DeltaPatch::getHeader()
+{
+    return header;
+}
+
+uint32_t DeltaPatch::getWritten()
+{
+    return written;
+}
+
+const char *DeltaPatch::getError()
+{
+    return error;
+}
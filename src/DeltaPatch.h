@@ -0,0 +1,115 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+// Patch format written by make_delta.py. A fixed header, then a raw deflate stream of operations
+// that rebuild the new image from the running one:
+//
+//   COPY   old offset, length          copy bytes of the old image
+//   DIFF   old offset, length, bytes   old bytes plus the given bytes (mod 256), the common case
+//                                      for code that only moved, since most of the bytes are zero
+//   INSERT length, bytes               new bytes
+//   END
+//
+// All numbers are little endian uint32.
+#define DELTA_MAGIC "SFSD"
+#define DELTA_VERSION 1
+#define DELTA_HEADER_SIZE 48
+
+#define DELTA_OP_END 0
+#define DELTA_OP_COPY 1
+#define DELTA_OP_DIFF 2
+#define DELTA_OP_INSERT 3
+
+// Old image bytes read per step when copying or diffing
+#define DELTA_READ_CHUNK 512
+
+struct delta_header_t
+{
+    uint32_t oldSize;
+    uint32_t newSize;
+    char     oldMd5[33];  // Hex MD5 of the image the patch applies to
+};
+
+// Streaming patch decoder. RAM use is fixed: the inflate state and its 32KB window, allocated
+// in begin() and released in end(), plus a small read buffer.
+class DeltaPatch
+{
+   public:
+    // Reads length bytes of the old image at offset
+    typedef std::function<bool(uint32_t offset, uint8_t *buffer, size_t length)> OldReader;
+    // Receives the new image in order
+    typedef std::function<bool(uint8_t *data, size_t length)> NewWriter;
+
+    DeltaPatch();
+    ~DeltaPatch();
+
+    // oldSize and oldMd5 describe the running image, a patch made against another one is refused
+    bool begin(uint32_t oldSize, const char *oldMd5, OldReader reader, NewWriter writer);
+    // Feed the patch file as it arrives, any chunk size
+    bool write(const uint8_t *data, size_t length);
+    // True when the patch was complete and produced exactly the announced number of bytes
+    bool finish();
+    // Releases the buffers, also after a failure
+    void end();
+
+    // Available once the header has been received
+    bool                  hasHeader();
+    const delta_header_t &getHeader();
+
+    uint32_t    getWritten();
+    const char *getError();
+
+   private:
+    typedef enum
+    {
+        STAGE_HEADER,
+        STAGE_OP,
+        STAGE_ARGS,
+        STAGE_DATA,
+        STAGE_DONE,
+        STAGE_FAILED,
+    } stage_t;
+
+    OldReader readOld;
+    NewWriter writeNew;
+
+    void    *inflator;  // tinfl_decompressor, kept opaque so the ROM header stays out of here
+    uint8_t *window;
+    size_t   windowPos;
+    bool     streamEnded;  // The deflate stream is complete
+    uint8_t  readBuffer[DELTA_READ_CHUNK];
+
+    stage_t        stage;
+    delta_header_t header;
+    uint8_t        headerBytes[DELTA_HEADER_SIZE];
+    size_t         headerLength;
+
+    uint8_t  op;
+    uint8_t  args[8];
+    size_t   argsLength;
+    size_t   argsNeeded;
+    uint32_t oldOffset;
+    uint32_t remaining;  // Bytes left in the current DIFF or INSERT
+    uint32_t written;
+
+    const char *error;
+
+    uint32_t    runningSize;
+    char        runningMd5[33];
+
+    bool fail(const char *reason);
+    bool parseHeader();
+    bool inflate(const uint8_t *data, size_t length);
+    bool parseOps(uint8_t *data, size_t length);
+    bool startOp();
+    bool copyOld(uint32_t offset, uint32_t length);
+    bool applyData(uint8_t *data, size_t length);
+    bool emit(uint8_t *data, size_t length);
+};
+
+#endif  // DELTA_PATCH_H
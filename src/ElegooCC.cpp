@@ -2,13 +2,29 @@
 
 #include <ArduinoJson.h>
 
+#include "BootTiming.h"
 #include "Logger.h"
+#include "LoopProfiler.h"
+#include "MemoryPolicy.h"
+#include "PowerManager.h"
+#include "Scheduler.h"
+#include "SdcpProxy.h"
 #include "SettingsManager.h"
-
-#define ACK_TIMEOUT_MS 5000
-
-// External function to get current time (from main.cpp)
-extern unsigned long getTime();
+#include "WallClock.h"
+
+// Bounds for the adaptive ack timeout, the upper one is also used until we have RTT samples
+#define ACK_TIMEOUT_MIN_MS 1000
+#define ACK_TIMEOUT_MAX_MS 5000
+// Pause retries: wait this long for the printer to report it's pausing, doubling per attempt
+#define PAUSE_RETRY_INITIAL_MS 3000
+#define PAUSE_RETRY_MAX_MS 12000
+#define PAUSE_MAX_ATTEMPTS 4
+
+// Bounds for how long the printer may stay quiet before we ask it for a status
+#define LIVENESS_MIN_MS 3000
+#define LIVENESS_MAX_MS 10000
+// Keepalive, the printer drops the connection when it doesn't hear from us
+#define PING_INTERVAL_MS 29900
 
 ElegooCC &ElegooCC::getInstance()
 {
@@ -20,11 +36,15 @@ ElegooCC::ElegooCC()
 {
     lastMovementValue = -1;
     lastChangeTime    = 0;
+    movementPulses    = 0;
 
     mainboardID       = "";
     printStatus       = SDCP_PRINT_STATUS_IDLE;
     machineStatusMask = 0;  // No statuses active initially
     currentLayer      = 0;
+    currentX          = 0;
+    currentY          = 0;
+    currentZ          = 0;
     totalLayer        = 0;
     progress          = 0;
     currentTicks      = 0;
@@ -32,30 +52,112 @@ ElegooCC::ElegooCC()
     PrintSpeedPct     = 0;
     filamentStopped   = false;
     filamentRunout    = false;
-    lastPing          = 0;
+    startedAt         = 0;
+    lastStatusEvent   = SESSION_EVENT_STOPPED;
+    graceJob          = -1;
+    resumePending     = false;
+    memset(taskId, 0, sizeof(taskId));
+    pingJob           = -1;
+    ackTimeoutJob     = -1;
+    livenessJob       = -1;
+
+    rttRequestId         = "";
+    rttSentAt            = 0;
+    lastMessageTime      = 0;
+    livenessProbePending = false;
+    ackTimeouts          = 0;
+    livenessReconnects   = 0;
+
+    messageBuffer   = NULL;
+    messageLength   = 0;
+    messageIsText   = false;
+    messageOverflow = false;
 
     waitingForAck       = false;
     pendingAckCommand   = -1;
     pendingAckRequestId = "";
     ackWaitStartTime    = 0;
 
+    movementTimeout     = 0;
+    firstLayerTimeout   = 0;
+    startPrintTimeout   = 0;
+    pauseEnabled        = false;
+    pauseOnRunout       = false;
+    stopFeedingFallback = false;
+
+    pauseRetryJob     = -1;
+    pauseActive       = false;
+    pauseUsedFallback = false;
+    pauseAttempts     = 0;
+    pauseStartedAt    = 0;
+    pausesConfirmed   = 0;
+    pausesRetried     = 0;
+    pausesFallback    = 0;
+    pausesFailed      = 0;
+    lastPauseMs       = 0;
+    maxPauseMs        = 0;
+
     // TODO: send a UDP broadcast, M99999 on Port 30000, maybe using AsyncUDP.h and listen for the
     // result. this will give us the printer IP address.
 
     // event handler - use lambda to capture 'this' pointer
     webSocket.onEvent([this](WStype_t type, uint8_t *payload, size_t length)
                       { this->webSocketEvent(type, payload, length); });
+    session.onTransition = [this](session_state_t from, session_state_t to, session_event_t event)
+    { this->onSessionTransition(from, to, event); };
 }
 
 void ElegooCC::setup()
 {
-    bool shouldConect = !settingsManager.isAPMode();
+    pingJob       = scheduler.addJob("elegoo_ping", JOB_PRIORITY_LOW,
+                                     [this](unsigned long now) { this->sendPing(); });
+    ackTimeoutJob = scheduler.addJob("elegoo_ack_timeout", JOB_PRIORITY_NORMAL,
+                                     [this](unsigned long now) { this->onAckTimeout(); });
+    livenessJob   = scheduler.addJob("elegoo_liveness", JOB_PRIORITY_NORMAL,
+                                     [this](unsigned long now) { this->checkLiveness(); });
+    pauseRetryJob = scheduler.addJob("elegoo_pause_retry", JOB_PRIORITY_HIGH,
+                                     [this](unsigned long now) { this->retryPause(); });
+    graceJob      = scheduler.addJob("elegoo_grace", JOB_PRIORITY_NORMAL, [this](unsigned long now)
+                                     { this->session.dispatch(SESSION_EVENT_GRACE_EXPIRED, now); });
+
+    // Pick up where we left off if we were reset in the middle of a print
+    resumePending = sessionCheckpoint.getRestored(resumeCheckpoint);
+
+    refreshSettings();
+    settingsManager.addObserver(SETTING_ELEGOOIP | SETTING_TIMEOUT | SETTING_FIRST_LAYER_TIMEOUT |
+                                    SETTING_START_PRINT_TIMEOUT | SETTING_ENABLED |
+                                    SETTING_PAUSE_ON_RUNOUT | SETTING_STOP_FEEDING_FALLBACK,
+                                [this](uint32_t changedFields)
+                                { this->onSettingsChanged(changedFields); });
+
+    bool shouldConect = !settingsManager.getAPMode();
     if (shouldConect)
     {
         connect();
     }
 }
 
+void ElegooCC::refreshSettings()
+{
+    movementTimeout     = settingsManager.getTimeout();
+    firstLayerTimeout   = settingsManager.getFirstLayerTimeout();
+    startPrintTimeout   = settingsManager.getStartPrintTimeout();
+    pauseEnabled        = settingsManager.getEnabled();
+    pauseOnRunout       = settingsManager.getPauseOnRunout();
+    stopFeedingFallback = settingsManager.getStopFeedingFallback();
+}
+
+void ElegooCC::onSettingsChanged(uint32_t changedFields)
+{
+    refreshSettings();
+
+    // websocket IP changed, reconnect
+    if (changedFields & SETTING_ELEGOOIP)
+    {
+        connect();  // this will reconnnect if already connected
+    }
+}
+
 void ElegooCC::webSocketEvent(WStype_t type, uint8_t *payload, size_t length)
 {
     switch (type)
@@ -63,39 +165,25 @@ void ElegooCC::webSocketEvent(WStype_t type, uint8_t *payload, size_t length)
         case WStype_DISCONNECTED:
             logger.log("Disconnected from Carbon Centauri");
             // Reset acknowledgment state on disconnect
-            waitingForAck       = false;
-            pendingAckCommand   = -1;
-            pendingAckRequestId = "";
-            ackWaitStartTime    = 0;
+            clearPendingAck();
+            scheduler.cancel(pingJob);
+            scheduler.cancel(livenessJob);
+            rttRequestId    = "";
+            lastMessageTime = 0;
             break;
         case WStype_CONNECTED:
             logger.log("Connected to Carbon Centauri");
+            bootTiming.mark(BOOT_PHASE_PRINTER_CONNECTED);
+            scheduler.schedule(pingJob, PING_INTERVAL_MS, PING_INTERVAL_MS);
+            livenessProbePending = false;
+            scheduler.schedule(livenessJob, LIVENESS_MAX_MS);
             sendCommand(SDCP_COMMAND_STATUS);
 
             break;
         case WStype_TEXT:
-        {
-            StaticJsonDocument<2048> doc;
-            DeserializationError     error = deserializeJson(doc, payload);
-
-            if (error)
-            {
-                logger.logf("JSON parsing failed: %s", error.c_str());
-                return;
-            }
-
-            // Check if this is a command acknowledgment response
-            if (doc.containsKey("Id") && doc.containsKey("Data"))
-            {
-                handleCommandResponse(doc);
-            }
-            // Check if this is a status response
-            else if (doc.containsKey("Status"))
-            {
-                handleStatus(doc);
-            }
-        }
-        break;
+            onMessageReceived();
+            handleMessage(payload, length);
+            break;
         case WStype_BIN:
             logger.log("Received unspported binary data");
             break;
@@ -104,53 +192,173 @@ void ElegooCC::webSocketEvent(WStype_t type, uint8_t *payload, size_t length)
             break;
         case WStype_FRAGMENT_TEXT_START:
         case WStype_FRAGMENT_BIN_START:
+            messageLength   = 0;
+            messageOverflow = false;
+            messageIsText   = type == WStype_FRAGMENT_TEXT_START;
+            appendFragment(payload, length);
+            break;
         case WStype_FRAGMENT:
+            appendFragment(payload, length);
+            break;
         case WStype_FRAGMENT_FIN:
-            logger.log("Received unspported fragment data");
+            onMessageReceived();
+            appendFragment(payload, length);
+            if (!messageIsText)
+            {
+                logger.log("Received unspported binary data");
+            }
+            else if (messageOverflow)
+            {
+                logger.logf("Dropped message larger than %d bytes", SDCP_MAX_MESSAGE_SIZE);
+                sdcpProxy.onUpstreamDropped();
+            }
+            else
+            {
+                handleMessage(messageBuffer, messageLength);
+            }
+            messageLength = 0;
             break;
     }
 }
 
+void ElegooCC::appendFragment(uint8_t *payload, size_t length)
+{
+    if (!messageIsText || messageOverflow)
+    {
+        return;
+    }
+
+    if (messageBuffer == NULL)
+    {
+        messageBuffer = (uint8_t *) memoryPolicy.allocate(SDCP_MAX_MESSAGE_SIZE, MEMORY_BULK);
+    }
+    if (messageBuffer == NULL || messageLength + length > SDCP_MAX_MESSAGE_SIZE)
+    {
+        messageOverflow = true;
+        return;
+    }
+
+    memcpy(messageBuffer + messageLength, payload, length);
+    messageLength += length;
+}
+
+// Only the fields we actually look at, everything else is skipped while parsing. This keeps big
+// messages (attributes, status with lots of extra info) within SDCP_DOCUMENT_SIZE.
+static JsonDocument &messageFilter()
+{
+    static StaticJsonDocument<512> filter;
+    if (filter.isNull())
+    {
+        filter["Id"]                      = true;
+        filter["MainboardID"]             = true;
+        filter["TimeStamp"]               = true;
+        filter["Data"]["Cmd"]             = true;
+        filter["Data"]["RequestID"]       = true;
+        filter["Data"]["MainboardID"]     = true;
+        filter["Data"]["Data"]["Ack"]     = true;
+        filter["Status"]["CurrentStatus"] = true;
+        filter["Status"]["CurrenCoord"]   = true;
+
+        JsonObject printInfo       = filter["Status"].createNestedObject("PrintInfo");
+        printInfo["Status"]        = true;
+        printInfo["TaskId"]        = true;
+        printInfo["CurrentLayer"]  = true;
+        printInfo["TotalLayer"]    = true;
+        printInfo["Progress"]      = true;
+        printInfo["CurrentTicks"]  = true;
+        printInfo["TotalTicks"]    = true;
+        printInfo["PrintSpeedPct"] = true;
+    }
+    return filter;
+}
+
+void ElegooCC::handleMessage(uint8_t *payload, size_t length)
+{
+    // Proxy clients get the frame as it came, whether or not our own parse below can use it
+    sdcpProxy.onUpstreamMessage(payload, length);
+
+    // The proxy is done with the payload, so it can be parsed in place
+    StaticJsonDocument<SDCP_DOCUMENT_SIZE> doc;
+    DeserializationError                   error =
+        deserializeJson(doc, payload, length, DeserializationOption::Filter(messageFilter()));
+
+    if (error)
+    {
+        logger.logf("JSON parsing failed: %s", error.c_str());
+        return;
+    }
+
+    // Check if this is a command acknowledgment response
+    if (doc.containsKey("Id") && doc.containsKey("Data"))
+    {
+        handleCommandResponse(doc);
+    }
+    // Check if this is a status response
+    else if (doc.containsKey("Status"))
+    {
+        handleStatus(doc);
+    }
+}
+
 void ElegooCC::handleCommandResponse(JsonDocument &doc)
 {
-    String     id   = doc["Id"];
     JsonObject data = doc["Data"];
 
     if (data.containsKey("Cmd") && data.containsKey("RequestID"))
     {
-        int    cmd         = data["Cmd"];
-        int    ack         = data["Data"]["Ack"];
-        String requestId   = data["RequestID"];
-        String mainboardId = data["MainboardID"];
+        // Strings point into doc, nothing is copied
+        int         cmd         = data["Cmd"];
+        int         ack         = data["Data"]["Ack"];
+        const char *requestId   = data["RequestID"] | "";
+        const char *mainboardId = data["MainboardID"] | "";
 
-        logger.logf("Command %d acknowledged (Ack: %d) for request %s", cmd, ack,
-                    requestId.c_str());
+        logger.logf("Command %d acknowledged (Ack: %d) for request %s", cmd, ack, requestId);
+
+        if (rttRequestId == requestId)
+        {
+            ackRtt.addSample(millis() - rttSentAt);
+            rttRequestId = "";
+        }
+
+        // Stopping the feed doesn't show up in the print status, the ack is all we get
+        if (pauseActive && pauseUsedFallback && cmd == SDCP_COMMAND_STOP_FEEDING_MATERIAL &&
+            ack == 0)
+        {
+            finishPause(true);
+        }
 
         // Check if this is the acknowledgment we're waiting for
-        if (waitingForAck && cmd == pendingAckCommand && requestId == pendingAckRequestId)
+        if (waitingForAck && cmd == pendingAckCommand && pendingAckRequestId == requestId)
         {
-            logger.logf("Received expected acknowledgment for command %d", cmd);
-            waitingForAck       = false;
-            pendingAckCommand   = -1;
-            pendingAckRequestId = "";
-            ackWaitStartTime    = 0;
+            logger.logf("Received expected acknowledgment for command %d after %lums", cmd,
+                        millis() - ackWaitStartTime);
+            clearPendingAck();
         }
 
         // Store mainboard ID if we don't have it yet
-        if (mainboardID.isEmpty() && !mainboardId.isEmpty())
+        if (mainboardID.isEmpty() && mainboardId[0] != '\0')
         {
             mainboardID = mainboardId;
             logger.logf("Stored MainboardID: %s", mainboardID.c_str());
         }
+
+        if (onCommandAck)
+        {
+            onCommandAck(requestId, cmd, ack);
+        }
     }
 }
 
 void ElegooCC::handleStatus(JsonDocument &doc)
 {
-    JsonObject status      = doc["Status"];
-    String     mainboardId = doc["MainboardID"];
+    JsonObject  status      = doc["Status"];
+    const char *mainboardId = doc["MainboardID"] | "";
 
     logger.log("Received status update:");
+    bootTiming.mark(BOOT_PHASE_FIRST_STATUS);
+
+    // Gives us the time of day without internet access, NTP takes over once it works
+    wallClock.setFromPrinter(doc["TimeStamp"].as<unsigned long>());
 
     // Parse current status (which contains machine status array)
     if (status.containsKey("CurrentStatus"))
@@ -169,17 +377,13 @@ void ElegooCC::handleStatus(JsonDocument &doc)
         setMachineStatuses(statuses, count);
     }
 
-    // Parse CurrentCoords to extract Z coordinate
-    if (status.containsKey("CurrenCoord"))
+    // "x,y,z", parsed where it sits in the document. Z picks the first layer timeout.
+    sdcp_coord_t coord;
+    if (sdcpParseCoord(status["CurrenCoord"].as<const char *>(), coord))
     {
-        String coordsStr   = status["CurrenCoord"].as<String>();
-        int    firstComma  = coordsStr.indexOf(',');
-        int    secondComma = coordsStr.indexOf(',', firstComma + 1);
-        if (firstComma != -1 && secondComma != -1)
-        {
-            String zStr = coordsStr.substring(secondComma + 1);
-            currentZ    = zStr.toFloat();
-        }
+        currentX = coord.x;
+        currentY = coord.y;
+        currentZ = coord.z;
     }
 
     // Parse print info
@@ -187,10 +391,24 @@ void ElegooCC::handleStatus(JsonDocument &doc)
     {
         JsonObject          printInfo = status["PrintInfo"];
         sdcp_print_status_t newStatus = printInfo["Status"].as<sdcp_print_status_t>();
-        if (newStatus != printStatus && newStatus == SDCP_PRINT_STATUS_PRINTING)
+        if (newStatus != printStatus)
         {
-            logger.log("Print status changed to printing");
-            startedAt = millis();
+            if (pauseActive)
+            {
+                if (newStatus == SDCP_PRINT_STATUS_PAUSING ||
+                    newStatus == SDCP_PRINT_STATUS_PAUSED)
+                {
+                    finishPause(true);
+                }
+                else if (newStatus != SDCP_PRINT_STATUS_PRINTING)
+                {
+                    // Stopped or finished some other way, nothing left to pause
+                    logger.logf("Print status changed to %d, abandoning pause", newStatus);
+                    pauseActive = false;
+                    scheduler.cancel(pauseRetryJob);
+                    session.dispatch(SESSION_EVENT_PAUSE_ENDED, millis());
+                }
+            }
         }
         printStatus   = newStatus;
         currentLayer  = printInfo["CurrentLayer"];
@@ -199,19 +417,238 @@ void ElegooCC::handleStatus(JsonDocument &doc)
         currentTicks  = printInfo["CurrentTicks"];
         totalTicks    = printInfo["TotalTicks"];
         PrintSpeedPct = printInfo["PrintSpeedPct"];
+
+        const char *newTaskId = printInfo["TaskId"] | "";
+        strncpy(taskId, newTaskId, sizeof(taskId) - 1);
+        taskId[sizeof(taskId) - 1] = '\0';
     }
 
     // Store mainboard ID if we don't have it yet (I'm unsure if we actually need this)
-    if (mainboardID.isEmpty() && !mainboardId.isEmpty())
+    if (mainboardID.isEmpty() && mainboardId[0] != '\0')
     {
         mainboardID = mainboardId;
         logger.logf("Stored MainboardID: %s", mainboardID.c_str());
     }
+
+    updateSession();
+}
+
+void ElegooCC::updateSession()
+{
+    unsigned long now = millis();
+
+    // Turn the print status into an event, only when it changed. Every status maps to one, so
+    // coming back to a status we left is always seen as a change.
+    session_event_t event = SESSION_EVENT_OTHER;
+    switch (printStatus)
+    {
+        case SDCP_PRINT_STATUS_IDLE:
+        case SDCP_PRINT_STATUS_STOPPING:
+        case SDCP_PRINT_STATUS_STOPED:
+        case SDCP_PRINT_STATUS_COMPLETE:
+            event = SESSION_EVENT_STOPPED;
+            break;
+        case SDCP_PRINT_STATUS_HEATING:
+            event = SESSION_EVENT_HEATING;
+            break;
+        case SDCP_PRINT_STATUS_BED_LEVELING:
+            event = SESSION_EVENT_LEVELING;
+            break;
+        case SDCP_PRINT_STATUS_PRINTING:
+            if (isPrinting())
+            {
+                event = SESSION_EVENT_PRINTING;
+            }
+            break;
+        case SDCP_PRINT_STATUS_PAUSING:
+        case SDCP_PRINT_STATUS_PAUSED:
+            event = SESSION_EVENT_PAUSED;
+            break;
+        default:
+            // File checking, homing and the codes we don't know
+            break;
+    }
+    if (event != lastStatusEvent)
+    {
+        lastStatusEvent = event;
+
+        // Still printing the job we were watching before the reset, skip the grace period
+        session_state_t saved = (session_state_t) resumeCheckpoint.state;
+        if (resumePending && event == SESSION_EVENT_PRINTING && taskId[0] != '\0' &&
+            strcmp(taskId, resumeCheckpoint.taskId) == 0 &&
+            (saved == SESSION_PRINTING_ARMED || saved == SESSION_FINISHING))
+        {
+            logger.logf("Resuming monitoring of task %s after reset", taskId);
+            movementPulses = resumeCheckpoint.movementPulses;
+            event          = SESSION_EVENT_RESUMED;
+        }
+        session.dispatch(event, now);
+    }
+    // Only the first status frame after the reset counts
+    if (resumePending)
+    {
+        resumePending = false;
+        sessionCheckpoint.discardRestored();
+    }
+
+    // With less than 100 ticks left the print is probably done. Only matters while printing,
+    // the other states ignore both events.
+    session_state_t state = session.getState();
+    if (state == SESSION_PRINTING_ARMED || state == SESSION_FINISHING)
+    {
+        bool nearEnd = (totalTicks - currentTicks) < 100;
+        session.dispatch(nearEnd ? SESSION_EVENT_NEAR_END : SESSION_EVENT_TICKS_LEFT, now);
+    }
+
+    saveCheckpoint();
+}
+
+void ElegooCC::saveCheckpoint()
+{
+    session_checkpoint_t checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.state = session.getState();
+    memcpy(checkpoint.taskId, taskId, sizeof(checkpoint.taskId));
+    checkpoint.currentTicks   = currentTicks;
+    checkpoint.totalTicks     = totalTicks;
+    checkpoint.currentZ       = currentZ;
+    checkpoint.movementPulses = movementPulses;
+    sessionCheckpoint.save(checkpoint);
+}
+
+void ElegooCC::onSessionTransition(session_state_t from, session_state_t to,
+                                   session_event_t event)
+{
+    if (from == to)
+    {
+        return;
+    }
+    logger.logf("Print session: %s -> %s (%s)", PrintSession::stateName(from),
+                PrintSession::stateName(to), PrintSession::eventName(event));
+
+    if (from == SESSION_PRINTING_GRACE)
+    {
+        scheduler.cancel(graceJob);
+    }
+
+    if (to == SESSION_PRINTING_GRACE)
+    {
+        // Don't pause in the first X milliseconds (configurable in settings)
+        startedAt = millis();
+        scheduler.schedule(graceJob, startPrintTimeout);
+        // Loop statistics are per print job
+        loopProfiler.reset();
+        // Coming back from a pause it's still the same job
+        if (from != SESSION_PAUSED && from != SESSION_PAUSING)
+        {
+            movementPulses = 0;
+        }
+    }
+    else if (event == SESSION_EVENT_RESUMED)
+    {
+        startedAt = millis();
+    }
+    else if (to == SESSION_PRINTING_ARMED && from == SESSION_PRINTING_GRACE)
+    {
+        // The totals may have arrived while we weren't listening for them
+        updateSession();
+        return;
+    }
+
+    saveCheckpoint();
 }
 
 void ElegooCC::pausePrint()
 {
-    sendCommand(SDCP_COMMAND_PAUSE_PRINT, true);
+    if (pauseActive)
+    {
+        return;
+    }
+
+    pauseActive       = true;
+    pauseUsedFallback = false;
+    pauseAttempts     = 0;
+    pauseStartedAt    = millis();
+    session.dispatch(SESSION_EVENT_PAUSE_SENT, pauseStartedAt);
+    sendPauseAttempt(SDCP_COMMAND_PAUSE_PRINT);
+}
+
+void ElegooCC::sendPauseAttempt(int command)
+{
+    pauseAttempts++;
+    logger.logf("Pause attempt %d (command %d) after %lums", pauseAttempts, command,
+                millis() - pauseStartedAt);
+
+    // A lost ack must not hold up the next attempt
+    if (waitingForAck)
+    {
+        clearPendingAck();
+    }
+    sendCommand(command, true);
+
+    unsigned long delay = PAUSE_RETRY_INITIAL_MS << (pauseAttempts - 1);
+    scheduler.schedule(pauseRetryJob, min(delay, (unsigned long) PAUSE_RETRY_MAX_MS));
+}
+
+void ElegooCC::retryPause()
+{
+    if (!pauseActive)
+    {
+        return;
+    }
+
+    if (pauseAttempts < PAUSE_MAX_ATTEMPTS)
+    {
+        logger.log("Printer didn't report pausing, retrying");
+        sendPauseAttempt(SDCP_COMMAND_PAUSE_PRINT);
+    }
+    else if (stopFeedingFallback && !pauseUsedFallback)
+    {
+        logger.log("Pause not confirmed, falling back to stopping the filament feed");
+        pauseUsedFallback = true;
+        sendPauseAttempt(SDCP_COMMAND_STOP_FEEDING_MATERIAL);
+    }
+    else
+    {
+        finishPause(false);
+    }
+}
+
+void ElegooCC::finishPause(bool confirmed)
+{
+    uint32_t elapsed = millis() - pauseStartedAt;
+    pauseActive      = false;
+    scheduler.cancel(pauseRetryJob);
+
+    if (!confirmed)
+    {
+        logger.logf("Pause failed after %d attempts and %lums", pauseAttempts,
+                    (unsigned long) elapsed);
+        pausesFailed++;
+        // Stay in the pausing state, no new attempts until the print status changes
+        session.dispatch(SESSION_EVENT_PAUSE_FAILED, millis());
+        return;
+    }
+
+    logger.logf("Pause confirmed after %d attempts and %lums", pauseAttempts,
+                (unsigned long) elapsed);
+    pausesConfirmed++;
+    if (pauseUsedFallback)
+    {
+        pausesFallback++;
+        // The printer keeps reporting printing with the feed stopped, so no status change will
+        // move the session on. Start over with a grace period instead of waiting forever.
+        session.dispatch(SESSION_EVENT_PAUSE_ENDED, millis());
+    }
+    else if (pauseAttempts > 1)
+    {
+        pausesRetried++;
+    }
+    lastPauseMs = elapsed;
+    if (elapsed > maxPauseMs)
+    {
+        maxPauseMs = elapsed;
+    }
 }
 
 void ElegooCC::continuePrint()
@@ -219,12 +656,20 @@ void ElegooCC::continuePrint()
     sendCommand(SDCP_COMMAND_CONTINUE_PRINT, true);
 }
 
-void ElegooCC::sendCommand(int command, bool waitForAck)
+sdcp_request_id_t ElegooCC::sendControlCommand(sdcp_command_t command)
+{
+    // Not tracked with waitingForAck, that would hold up our own pauses
+    return sendCommand(command);
+}
+
+sdcp_request_id_t ElegooCC::sendCommand(int command, bool waitForAck)
 {
+    sdcp_request_id_t requestId;
+
     if (!webSocket.isConnected())
     {
         logger.logf("Can't send command, websocket not connected: %d", command);
-        return;
+        return requestId;
     }
 
     // If this command requires an ack and we're already waiting for one, skip it
@@ -232,40 +677,62 @@ void ElegooCC::sendCommand(int command, bool waitForAck)
     {
         logger.logf("Skipping command %d - already waiting for ack from command %d", command,
                     pendingAckCommand);
-        return;
+        return requestId;
     }
 
     uuid.generate();
-    String uuidStr = String(uuid.toCharArray());
-    uuidStr.replace("-", "");  // RequestID doesn't want dashes
-
-    // Get current timestamp
-    unsigned long timestamp   = getTime();
-    String        jsonPayload = "{";
-    jsonPayload += "\"Id\":\"" + uuidStr + "\",";
-    jsonPayload += "\"Data\":{";
-    jsonPayload += "\"Cmd\":" + String(command) + ",";
-    jsonPayload += "\"Data\":{},";
-    jsonPayload += "\"RequestID\":\"" + uuidStr + "\",";
-    jsonPayload += "\"MainboardID\":\"" + mainboardID + "\",";
-    jsonPayload += "\"TimeStamp\":" + String(timestamp) + ",";
-    jsonPayload += "\"From\":2";  // I don't know if this is used, but octoeverywhere sets theirs to
-                                  // 0, and the web client sets it to 1, so we'll choose 2?
-    jsonPayload += "}";
-    jsonPayload += "}";
+    for (const char *c = uuid.toCharArray(); *c != '\0'; c++)
+    {
+        // RequestID doesn't want dashes
+        if (*c != '-')
+        {
+            requestId.append(*c);
+        }
+    }
+
+    // "From" is 2: I don't know if this is used, but octoeverywhere sets theirs to 0, and the
+    // web client sets it to 1, so we'll choose 2?
+    char payload[SDCP_COMMAND_PAYLOAD_SIZE];
+    int  payloadLength =
+        snprintf(payload, sizeof(payload),
+                 "{\"Id\":\"%s\",\"Data\":{\"Cmd\":%d,\"Data\":{},\"RequestID\":\"%s\","
+                 "\"MainboardID\":\"%s\",\"TimeStamp\":%lu,\"From\":2}}",
+                 requestId.c_str(), command, requestId.c_str(), mainboardID.c_str(),
+                 wallClock.now());
+
+    // Every command is acked, but only one is timed at a time so the next send doesn't take its
+    // sample away (Karn's rule). One whose ack never came is given up on after the longest ack
+    // timeout.
+    if (rttRequestId.isEmpty() || millis() - rttSentAt > ACK_TIMEOUT_MAX_MS)
+    {
+        rttRequestId = requestId;
+        rttSentAt    = millis();
+    }
 
     // If this command requires an ack, set the tracking state
     if (waitForAck)
     {
         waitingForAck       = true;
         pendingAckCommand   = command;
-        pendingAckRequestId = uuidStr;
+        pendingAckRequestId = requestId;
         ackWaitStartTime    = millis();
+        scheduler.schedule(ackTimeoutJob,
+                           ackRtt.getTimeout(ACK_TIMEOUT_MIN_MS, ACK_TIMEOUT_MAX_MS));
         logger.logf("Waiting for acknowledgment for command %d with request ID %s", command,
-                    uuidStr.c_str());
+                    requestId.c_str());
     }
 
-    webSocket.sendTXT(jsonPayload);
+    webSocket.sendTXT(payload, payloadLength);
+    return requestId;
+}
+
+bool ElegooCC::sendRaw(uint8_t *payload, size_t length)
+{
+    if (!webSocket.isConnected())
+    {
+        return false;
+    }
+    return webSocket.sendTXT(payload, length);
 }
 
 void ElegooCC::connect()
@@ -275,44 +742,81 @@ void ElegooCC::connect()
         webSocket.disconnect();
     }
     webSocket.setReconnectInterval(3000);
-    ipAddress = settingsManager.getElegooIP();
+    ipAddress = settingsManager.getElegooIP().c_str();
     logger.logf("Attempting connection to Elegoo CC @ %s", ipAddress.c_str());
-    webSocket.begin(ipAddress, CARBON_CENTAURI_PORT, "/websocket");
+    webSocket.begin(ipAddress.c_str(), CARBON_CENTAURI_PORT, "/websocket");
 }
 
-void ElegooCC::loop()
+void ElegooCC::clearPendingAck()
 {
-    unsigned long currentTime = millis();
+    waitingForAck       = false;
+    pendingAckCommand   = -1;
+    pendingAckRequestId = "";
+    ackWaitStartTime    = 0;
+    scheduler.cancel(ackTimeoutJob);
+}
 
-    // websocket IP changed, reconnect
-    if (ipAddress != settingsManager.getElegooIP())
+void ElegooCC::onAckTimeout()
+{
+    logger.logf("Acknowledgment timeout for command %d, resetting ack state", pendingAckCommand);
+    ackTimeouts++;
+    clearPendingAck();
+
+    // Could be a dead connection, check right away rather than waiting for the liveness timer
+    if (!livenessProbePending)
     {
-        connect();  // this will reconnnect if already connected
+        scheduler.schedule(livenessJob, 0);
     }
+}
 
-    if (webSocket.isConnected())
+void ElegooCC::onMessageReceived()
+{
+    unsigned long now = millis();
+    if (lastMessageTime != 0)
     {
-        // Check for acknowledgment timeout (5 seconds)
-        // TODO: need to check the actual requestId
-        if (waitingForAck && (currentTime - ackWaitStartTime) >= ACK_TIMEOUT_MS)
-        {
-            logger.logf("Acknowledgment timeout for command %d, resetting ack state",
-                        pendingAckCommand);
-            waitingForAck       = false;
-            pendingAckCommand   = -1;
-            pendingAckRequestId = "";
-            ackWaitStartTime    = 0;
-        }
-        else if (currentTime - lastPing > 29900)
-        {
-            logger.log("Sending Ping");
-            // For all who venture to this line of code wondering why I didn't use sendPing(), it's
-            // because for some reason that doesn't work. but this does!
-            this->webSocket.sendTXT("ping");
-            lastPing = currentTime;
-        }
+        messageInterval.addSample(now - lastMessageTime);
     }
+    lastMessageTime      = now;
+    livenessProbePending = false;
+    scheduler.schedule(livenessJob, messageInterval.getTimeout(LIVENESS_MIN_MS, LIVENESS_MAX_MS));
+}
+
+void ElegooCC::checkLiveness()
+{
+    if (!webSocket.isConnected())
+    {
+        return;
+    }
+
+    // Quiet for longer than usual, ask for a status. Any message coming back re-arms the check.
+    if (!livenessProbePending)
+    {
+        livenessProbePending = true;
+        sendCommand(SDCP_COMMAND_STATUS);
+        scheduler.schedule(livenessJob,
+                           ackRtt.getTimeout(ACK_TIMEOUT_MIN_MS, ACK_TIMEOUT_MAX_MS));
+        return;
+    }
+
+    // TCP can take minutes to notice a dead peer, don't wait for it
+    logger.log("Printer stopped responding, reconnecting");
+    livenessReconnects++;
+    connect();
+}
+
+void ElegooCC::sendPing()
+{
+    logger.log("Sending Ping");
+    // For all who venture to this line of code wondering why I didn't use sendPing(), it's
+    // because for some reason that doesn't work. but this does!
+    webSocket.sendTXT("ping");
+}
+
+void ElegooCC::loop()
+{
+    unsigned long currentTime = millis();
 
+    loopProfiler.enter(LOOP_SECTION_SENSORS);
     // Before determining if we should pause, check if the filament is moving or it ran out
     checkFilamentMovement(currentTime);
     checkFilamentRunout(currentTime);
@@ -324,6 +828,7 @@ void ElegooCC::loop()
         pausePrint();
     }
 
+    loopProfiler.enter(LOOP_SECTION_WEBSOCKET);
     webSocket.loop();
 }
 
@@ -333,6 +838,7 @@ void ElegooCC::checkFilamentRunout(unsigned long currentTime)
     bool newFilamentRunout = digitalRead(FILAMENT_RUNOUT_PIN) == LOW;
     if (newFilamentRunout != filamentRunout)
     {
+        powerManager.recordSensorChange();
         logger.log(filamentRunout ? "Filament has run out" : "Filament has been detected");
     }
     filamentRunout = newFilamentRunout;
@@ -344,13 +850,14 @@ void ElegooCC::checkFilamentMovement(unsigned long currentTime)
 
     // CurrentLayer is unreliable when using Orcaslicer 2.3.0, because it is missing some g-code,so
     // we use Z instead. , assuming first layer is at Z offset <  0.1
-    int movementTimeout =
-        currentZ < 0.1 ? settingsManager.getFirstLayerTimeout() : settingsManager.getTimeout();
+    int timeout = currentZ < 0.1 ? firstLayerTimeout : movementTimeout;
 
     // Check if movement sensor value has changed, if the filament is moving, it should change every
     // so often when it changes, reset the timeout
     if (currentMovementValue != lastMovementValue)
     {
+        powerManager.recordSensorChange();
+        movementPulses++;
         if (filamentStopped)
         {
             logger.log("Filament movement started");
@@ -363,7 +870,7 @@ void ElegooCC::checkFilamentMovement(unsigned long currentTime)
     else
     {
         // Value hasn't changed, check if timeout has elapsed
-        if ((currentTime - lastChangeTime) >= movementTimeout && !filamentStopped)
+        if ((currentTime - lastChangeTime) >= timeout && !filamentStopped)
         {
             logger.logf("Filament movement stopped, last movement detected %dms ago",
                         currentTime - lastChangeTime);
@@ -372,40 +879,62 @@ void ElegooCC::checkFilamentMovement(unsigned long currentTime)
     }
 }
 
+unsigned long ElegooCC::timeUntilNextCheck(unsigned long now)
+{
+    // Sensor edges wake the loop on their own, what's left is the movement timeout and polling
+    // the websocket
+    unsigned long wait = WEBSOCKET_POLL_INTERVAL_MS;
+    if (!filamentStopped)
+    {
+        int  timeout   = currentZ < 0.1 ? firstLayerTimeout : movementTimeout;
+        long remaining = (long) (lastChangeTime + timeout - now);
+        if (remaining < (long) wait)
+        {
+            wait = remaining > 0 ? remaining : 0;
+        }
+    }
+    return wait;
+}
+
 bool ElegooCC::shouldPausePrint(unsigned long currentTime)
 {
+    // The grace period, print status, a pause in flight (or one that failed) and the end of the
+    // print are all covered by the session, only an armed session can pause
+    if (session.getState() != SESSION_PRINTING_ARMED || !(filamentRunout || filamentStopped))
+    {
+        return false;
+    }
+
+    // The session only follows status changes, check the printer is really printing right now
+    if (!isPrinting())
+    {
+        return false;
+    }
+
     // If pause function is completely disabled, always return false
-    if (!settingsManager.getEnabled())
+    if (!pauseEnabled)
     {
         return false;
     }
 
-    if (filamentRunout && !settingsManager.getPauseOnRunout())
+    if (filamentRunout && !pauseOnRunout)
     {
         // if pause on runout is disabled, and filament ran out, skip checking everything else
         // this should let the carbon take care of itself
         return false;
     }
 
-    // Only puase if getPauseOnRunout is enabled and filement runsout or filamentStopped.
-    bool pauseCondition = filamentRunout || filamentStopped;
-
-    // Don't pause in the first X milliseconds (configurable in settings)
     // Don't pause if the websocket is not connected (we can't pause anyway if we're not connected)
     // Don't pause if we're waiting for an ack
-    // Don't pause if we have less than 100t tickets left, the print is probably done
     // TODO: also add a buffer after pause because sometimes an ack comes before the update
-    if (currentTime - startedAt < settingsManager.getStartPrintTimeout() ||
-        !webSocket.isConnected() || waitingForAck || !isPrinting() ||
-        (totalTicks - currentTicks) < 100 || !pauseCondition)
+    if (!webSocket.isConnected() || waitingForAck)
     {
         return false;
     }
 
     // log why we paused...
-    logger.logf("Pause condition: %d", pauseCondition);
     logger.logf("Filament runout: %d", filamentRunout);
-    logger.logf("Filament runout pause enabled: %d", settingsManager.getPauseOnRunout());
+    logger.logf("Filament runout pause enabled: %d", pauseOnRunout);
     logger.logf("Filament stopped: %d", filamentStopped);
     logger.logf("Time since print start %d", currentTime - startedAt);
     logger.logf("Is Machine status printing?: %d", hasMachineStatus(SDCP_MACHINE_STATUS_PRINTING));
@@ -420,6 +949,11 @@ bool ElegooCC::isPrinting()
            hasMachineStatus(SDCP_MACHINE_STATUS_PRINTING);
 }
 
+session_state_t ElegooCC::getSessionState()
+{
+    return session.getState();
+}
+
 // Helper methods for machine status bitmask
 bool ElegooCC::hasMachineStatus(sdcp_machine_status_t status)
 {
@@ -448,6 +982,7 @@ printer_info_t ElegooCC::getCurrentInformation()
     info.mainboardID          = mainboardID;
     info.printStatus          = printStatus;
     info.isPrinting           = isPrinting();
+    info.sessionState         = session.getState();
     info.currentLayer         = currentLayer;
     info.totalLayer           = totalLayer;
     info.progress             = progress;
@@ -455,8 +990,33 @@ printer_info_t ElegooCC::getCurrentInformation()
     info.totalTicks           = totalTicks;
     info.PrintSpeedPct        = PrintSpeedPct;
     info.isWebsocketConnected = webSocket.isConnected();
+    info.currentX             = currentX;
+    info.currentY             = currentY;
     info.currentZ             = currentZ;
     info.waitingForAck        = waitingForAck;
 
+    info.rttSmoothedMs      = ackRtt.getSmoothed();
+    info.rttVarianceMs      = ackRtt.getVariance();
+    info.rttMinMs           = ackRtt.getMin();
+    info.rttMaxMs           = ackRtt.getMax();
+    info.rttSamples         = ackRtt.getSampleCount();
+    info.ackTimeoutMs       = ackRtt.getTimeout(ACK_TIMEOUT_MIN_MS, ACK_TIMEOUT_MAX_MS);
+    info.ackTimeouts        = ackTimeouts;
+    info.messageIntervalMs  = messageInterval.getSmoothed();
+    info.livenessReconnects = livenessReconnects;
+
+    info.pauseInProgress = pauseActive;
+    info.pausesConfirmed = pausesConfirmed;
+    info.pausesRetried   = pausesRetried;
+    info.pausesFallback  = pausesFallback;
+    info.pausesFailed    = pausesFailed;
+    info.lastPauseMs     = lastPauseMs;
+    info.maxPauseMs      = maxPauseMs;
+
     return info;
+}
+
+String ElegooCC::sessionToJson()
+{
+    return session.toJson(millis());
 }
\ No newline at end of file
@@ -5,10 +5,39 @@
 #include <ArduinoJson.h>
 #include <WebSocketsClient.h>
 
+#include <functional>
+
+#include "FixedString.h"
+#include "PrintSession.h"
+#include "SdcpFields.h"
+#include "RttEstimator.h"
+#include "SessionCheckpoint.h"
 #include "UUID.h"
 
 #define CARBON_CENTAURI_PORT 3030
 
+// The websocket client has to be polled, this bounds how long the main loop may sleep while it's
+// in use
+#define WEBSOCKET_POLL_INTERVAL_MS 10
+
+// Longest message we reassemble from websocket fragments, anything bigger is dropped
+#define SDCP_MAX_MESSAGE_SIZE 8192
+// Parsed documents only keep the fields we use (see the filter in ElegooCC.cpp), so this doesn't
+// have to grow with the size of the messages
+#define SDCP_DOCUMENT_SIZE 2048
+
+// Ours are UUIDs without dashes, 32 characters. Longer ones from other clients get cut off,
+// which only matters for comparing with ours.
+#define SDCP_REQUEST_ID_SIZE 40
+#define SDCP_MAINBOARD_ID_SIZE 40
+// Same as the elegooip setting
+#define SDCP_HOST_SIZE 64
+// Longest command we send, see sendCommand()
+#define SDCP_COMMAND_PAYLOAD_SIZE 256
+
+typedef FixedString<SDCP_REQUEST_ID_SIZE>   sdcp_request_id_t;
+typedef FixedString<SDCP_MAINBOARD_ID_SIZE> sdcp_mainboard_id_t;
+
 // Pin definitions - can be overridden via build flags
 #ifndef FILAMENT_RUNOUT_PIN
 #define FILAMENT_RUNOUT_PIN 12
@@ -75,7 +104,7 @@ typedef enum
 // Struct to hold current printer information
 typedef struct
 {
-    String              mainboardID;
+    sdcp_mainboard_id_t mainboardID;
     sdcp_print_status_t printStatus;
     bool                filamentStopped;
     bool                filamentRunout;
@@ -87,8 +116,31 @@ typedef struct
     int                 PrintSpeedPct;
     bool                isWebsocketConnected;
     bool                isPrinting;
+    session_state_t     sessionState;
+    float               currentX;
+    float               currentY;
     float               currentZ;
     bool                waitingForAck;
+
+    // Connection health
+    uint32_t rttSmoothedMs;
+    uint32_t rttVarianceMs;
+    uint32_t rttMinMs;
+    uint32_t rttMaxMs;
+    uint32_t rttSamples;
+    uint32_t ackTimeoutMs;
+    uint32_t ackTimeouts;
+    uint32_t messageIntervalMs;
+    uint32_t livenessReconnects;
+
+    // Pause transactions
+    bool     pauseInProgress;
+    uint32_t pausesConfirmed;
+    uint32_t pausesRetried;
+    uint32_t pausesFallback;
+    uint32_t pausesFailed;
+    uint32_t lastPauseMs;
+    uint32_t maxPauseMs;
 } printer_info_t;
 
 class ElegooCC
@@ -97,18 +149,25 @@ class ElegooCC
     WebSocketsClient webSocket;
     UUID             uuid;
 
-    String ipAddress;
+    FixedString<SDCP_HOST_SIZE> ipAddress;
+
+    // Scheduler jobs for the keepalive ping, the ack timeout and the liveness check
+    int pingJob;
+    int ackTimeoutJob;
+    int livenessJob;
 
-    unsigned long lastPing;
     // Variables to track movement sensor state
     int           lastMovementValue;  // Initialize to invalid value
     unsigned long lastChangeTime;
+    uint32_t      movementPulses;  // Movement sensor edges since the print started
 
     // machine/status info
-    String              mainboardID;
+    sdcp_mainboard_id_t mainboardID;
     sdcp_print_status_t printStatus;
     uint8_t             machineStatusMask;  // Bitmask for active statuses
     int                 currentLayer;
+    float               currentX;
+    float               currentY;
     float               currentZ;
     int                 totalLayer;
     int                 progress;
@@ -120,11 +179,60 @@ class ElegooCC
 
     unsigned long startedAt;
 
+    // Print job lifecycle, decides when a filament problem may pause the print. The grace job
+    // arms it start_print_timeout after printing starts.
+    PrintSession    session;
+    session_event_t lastStatusEvent;  // Last event derived from the print status
+    int             graceJob;
+    char            taskId[SESSION_TASK_ID_SIZE];
+
+    // Session from before a reset, the first status frame decides whether it's still going
+    bool                 resumePending;
+    session_checkpoint_t resumeCheckpoint;
+
+    // Cached settings, refreshed by the settings observer so the hot path never calls getters
+    int  movementTimeout;
+    int  firstLayerTimeout;
+    int  startPrintTimeout;
+    bool pauseEnabled;
+    bool pauseOnRunout;
+    bool stopFeedingFallback;
+
+    // Pause transaction: a pause is re-sent with backoff until the printer reports it's pausing
+    int           pauseRetryJob;
+    bool          pauseActive;
+    bool          pauseUsedFallback;
+    int           pauseAttempts;
+    unsigned long pauseStartedAt;
+    uint32_t      pausesConfirmed;
+    uint32_t      pausesRetried;  // Confirmed, but only after more than one attempt
+    uint32_t      pausesFallback;
+    uint32_t      pausesFailed;
+    uint32_t      lastPauseMs;
+    uint32_t      maxPauseMs;
+
+    // Reassembly of fragmented messages. The buffer is allocated on the first fragment and reused.
+    uint8_t *messageBuffer;
+    size_t   messageLength;
+    bool     messageIsText;
+    bool     messageOverflow;  // Didn't fit, the remaining fragments are dropped
+
+    // Connection health. Ack round trips give the ack timeout, the time between messages from
+    // the printer tells us when it's been quiet for too long.
+    RttEstimator      ackRtt;
+    RttEstimator      messageInterval;
+    sdcp_request_id_t rttRequestId;  // Command being timed, its ack gives an RTT sample
+    unsigned long     rttSentAt;
+    unsigned long     lastMessageTime;
+    bool              livenessProbePending;
+    uint32_t          ackTimeouts;
+    uint32_t          livenessReconnects;
+
     // Acknowledgment tracking
-    bool          waitingForAck;
-    int           pendingAckCommand;
-    String        pendingAckRequestId;
-    unsigned long ackWaitStartTime;
+    bool              waitingForAck;
+    int               pendingAckCommand;
+    sdcp_request_id_t pendingAckRequestId;
+    unsigned long     ackWaitStartTime;
 
     ElegooCC();
 
@@ -133,17 +241,31 @@ class ElegooCC
     ElegooCC &operator=(const ElegooCC &) = delete;
 
     void webSocketEvent(WStype_t type, uint8_t *payload, size_t length);
+    void appendFragment(uint8_t *payload, size_t length);
+    void handleMessage(uint8_t *payload, size_t length);
     void connect();
+    void refreshSettings();
+    void onSettingsChanged(uint32_t changedFields);
     void handleCommandResponse(JsonDocument &doc);
     void handleStatus(JsonDocument &doc);
-    void sendCommand(int command, bool waitForAck = false);
+    sdcp_request_id_t sendCommand(int command, bool waitForAck = false);
+    void clearPendingAck();
+    void onAckTimeout();
+    void onMessageReceived();
+    void checkLiveness();
+    void sendPing();
     void pausePrint();
+    void sendPauseAttempt(int command);
+    void retryPause();
+    void finishPause(bool confirmed);
     void continuePrint();
+    void updateSession();
+    void saveCheckpoint();
+    void onSessionTransition(session_state_t from, session_state_t to, session_event_t event);
 
     // Helper methods for machine status bitmask
     bool hasMachineStatus(sdcp_machine_status_t status);
     void setMachineStatuses(const int *statusArray, int arraySize);
-    bool isPrinting();
     bool shouldPausePrint(unsigned long currentTime);
     void checkFilamentMovement(unsigned long currentTime);
     void checkFilamentRunout(unsigned long currentTime);
@@ -155,8 +277,24 @@ class ElegooCC
     void setup();
     void loop();
 
+    bool            isPrinting();
+    session_state_t getSessionState();
+    // Sends a command on behalf of someone else (see WebServer), returns its RequestID or an
+    // empty string when we're not connected. The ack comes back through onCommandAck.
+    sdcp_request_id_t sendControlCommand(sdcp_command_t command);
+    // Called from the main loop for every acknowledgment the printer sends
+    std::function<void(const char *requestId, int command, int ack)> onCommandAck;
+
+    // Passes a text frame from someone else (see SdcpProxy) to the printer as is, false when
+    // we're not connected
+    bool sendRaw(uint8_t *payload, size_t length);
+    // How long the main loop can sleep before loop() has work to do
+    unsigned long timeUntilNextCheck(unsigned long now);
+
     // Get current printer information
     printer_info_t getCurrentInformation();
+    // Session state and the recent transitions
+    String sessionToJson();
 };
 
 // Convenience macro for easier access
@@ -0,0 +1,110 @@
+#ifndef FIXED_STRING_H
+#define FIXED_STRING_H
+
+#include <stddef.h>
+#include <string.h>
+
+// String with its storage inline, for values that change with every message and have a known
+// maximum length. Unlike String it never touches the heap. Anything longer than N - 1
+// characters is cut off.
+template <size_t N>
+class FixedString
+{
+   private:
+    char   buffer[N];
+    size_t used;
+
+   public:
+    FixedString()
+    {
+        clear();
+    }
+
+    FixedString(const char *value)
+    {
+        assign(value);
+    }
+
+    FixedString &operator=(const char *value)
+    {
+        assign(value);
+        return *this;
+    }
+
+    // NULL counts as empty, so a missing JSON field can be assigned directly
+    void assign(const char *value)
+    {
+        used = 0;
+        if (value != NULL)
+        {
+            while (used < N - 1 && value[used] != '\0')
+            {
+                buffer[used] = value[used];
+                used++;
+            }
+        }
+        buffer[used] = '\0';
+    }
+
+    // Returns false once full, the character is dropped then
+    bool append(char c)
+    {
+        if (used >= N - 1)
+        {
+            return false;
+        }
+        buffer[used++] = c;
+        buffer[used]   = '\0';
+        return true;
+    }
+
+    void clear()
+    {
+        used      = 0;
+        buffer[0] = '\0';
+    }
+
+    const char *c_str() const
+    {
+        return buffer;
+    }
+
+    size_t length() const
+    {
+        return used;
+    }
+
+    bool isEmpty() const
+    {
+        return used == 0;
+    }
+
+    static size_t capacity()
+    {
+        return N - 1;
+    }
+
+    bool operator==(const char *other) const
+    {
+        return strcmp(buffer, other != NULL ? other : "") == 0;
+    }
+
+    bool operator!=(const char *other) const
+    {
+        return !(*this == other);
+    }
+
+    template <size_t M>
+    bool operator==(const FixedString<M> &other) const
+    {
+        return used == other.length() && memcmp(buffer, other.c_str(), used) == 0;
+    }
+
+    template <size_t M>
+    bool operator!=(const FixedString<M> &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+#endif  // FIXED_STRING_H
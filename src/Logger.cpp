@@ -1,8 +1,7 @@
 #include "Logger.h"
-#include "time.h"
-
-// External function to get current time (from main.cpp)
-extern unsigned long getTime();
+#include "LoopProfiler.h"
+#include "MemoryPolicy.h"
+#include "WallClock.h"
 
 Logger &Logger::getInstance()
 {
@@ -14,25 +13,41 @@ Logger::Logger()
 {
   currentIndex = 0;
   totalEntries = 0;
+  logBuffer = (LogEntry *)memoryPolicy.allocate(sizeof(LogEntry) * MAX_LOG_ENTRIES, MEMORY_BULK);
   uuidGenerator.generate();
 }
 
 void Logger::log(const String &message)
 {
+  log(message.c_str());
+}
+
+// Copies straight into the entry, a log line doesn't allocate
+void Logger::log(const char *message)
+{
+  // Serial output can be slow, so the loop profile accounts for logging on its own
+  loop_section_t previousSection = loopProfiler.enter(LOOP_SECTION_LOGGER);
+
   // Print to serial first
   Serial.println(message);
 
+  // Without a buffer there's only serial
+  if (logBuffer == NULL)
+  {
+    loopProfiler.enter(previousSection);
+    return;
+  }
+
   // Generate UUID for this log entry
   uuidGenerator.generate();
-  String uuid = String(uuidGenerator.toCharArray());
-
-  // Get current timestamp
-  unsigned long timestamp = getTime();
 
   // Store in circular buffer
-  logBuffer[currentIndex].uuid = uuid;
-  logBuffer[currentIndex].timestamp = timestamp;
-  logBuffer[currentIndex].message = message;
+  LogEntry &entry = logBuffer[currentIndex];
+  strncpy(entry.uuid, uuidGenerator.toCharArray(), LOG_UUID_SIZE - 1);
+  entry.uuid[LOG_UUID_SIZE - 1] = '\0';
+  entry.timestamp = wallClock.now();
+  strncpy(entry.message, message, LOG_MESSAGE_SIZE - 1);
+  entry.message[LOG_MESSAGE_SIZE - 1] = '\0';
 
   // Update indices
   currentIndex = (currentIndex + 1) % MAX_LOG_ENTRIES;
@@ -40,11 +55,8 @@ void Logger::log(const String &message)
   {
     totalEntries++;
   }
-}
 
-void Logger::log(const char *message)
-{
-  log(String(message));
+  loopProfiler.enter(previousSection);
 }
 
 void Logger::logf(const char *format, ...)
@@ -54,27 +66,28 @@ void Logger::logf(const char *format, ...)
   va_start(args, format);
   vsnprintf(buffer, sizeof(buffer), format, args);
   va_end(args);
-  log(String(buffer));
+  log(buffer);
 }
 
 String Logger::getLogsAsJson()
 {
-  DynamicJsonDocument jsonDoc(8192); // Allocate enough space for logs
+  BulkJsonDocument jsonDoc(8192); // Allocate enough space for logs
   JsonArray logsArray = jsonDoc.createNestedArray("logs");
 
   // If we have less than MAX_LOG_ENTRIES, start from 0
   // Otherwise, start from currentIndex (oldest entry)
   int startIndex = (totalEntries < MAX_LOG_ENTRIES) ? 0 : currentIndex;
-  int count = totalEntries;
+  int count = logBuffer == NULL ? 0 : totalEntries;
 
   for (int i = 0; i < count; i++)
   {
     int bufferIndex = (startIndex + i) % MAX_LOG_ENTRIES;
 
+    // Stored as pointers, the entries outlive the document
     JsonObject logEntry = logsArray.createNestedObject();
-    logEntry["uuid"] = logBuffer[bufferIndex].uuid;
+    logEntry["uuid"] = (const char *)logBuffer[bufferIndex].uuid;
     logEntry["timestamp"] = logBuffer[bufferIndex].timestamp;
-    logEntry["message"] = logBuffer[bufferIndex].message;
+    logEntry["message"] = (const char *)logBuffer[bufferIndex].message;
   }
 
   String jsonResponse;
@@ -87,11 +100,9 @@ void Logger::clearLogs()
   currentIndex = 0;
   totalEntries = 0;
   // Clear the buffer
-  for (int i = 0; i < MAX_LOG_ENTRIES; i++)
+  if (logBuffer != NULL)
   {
-    logBuffer[i].uuid = "";
-    logBuffer[i].timestamp = 0;
-    logBuffer[i].message = "";
+    memset(logBuffer, 0, sizeof(LogEntry) * MAX_LOG_ENTRIES);
   }
 }
 
@@ -5,18 +5,23 @@
 #include <ArduinoJson.h>
 #include <UUID.h>
 
+// Longer messages are cut off in the log buffer, serial gets them whole
+#define LOG_MESSAGE_SIZE 160
+#define LOG_UUID_SIZE 37
+
 struct LogEntry
 {
-  String uuid;
+  char uuid[LOG_UUID_SIZE];
   unsigned long timestamp;
-  String message;
+  char message[LOG_MESSAGE_SIZE];
 };
 
 class Logger
 {
 private:
   static const int MAX_LOG_ENTRIES = 50;
-  LogEntry logBuffer[MAX_LOG_ENTRIES];
+  // One allocation for all entries, in PSRAM when there is some
+  LogEntry *logBuffer;
   int currentIndex;
   int totalEntries;
   UUID uuidGenerator;
@@ -0,0 +1,207 @@
+#include "LoopProfiler.h"
+
+#include <ArduinoJson.h>
+
+#include "Logger.h"
+#include "MemoryPolicy.h"
+#include "SettingsManager.h"
+
+static const char *const sectionNames[LOOP_SECTION_COUNT] = {
+    "improv",    "settings",  "wifi",      "scheduler",
+    "sensors",   "websocket", "webserver", "logger",
+};
+
+LoopProfiler &LoopProfiler::getInstance()
+{
+    static LoopProfiler instance;
+    return instance;
+}
+
+LoopProfiler::LoopProfiler()
+{
+    mainTask       = NULL;
+    cyclesPerMicro = 1;
+    inIteration    = false;
+    currentSection = LOOP_SECTION_IMPROV;
+    sectionStart   = 0;
+    iterationStart = 0;
+    alarmMicros    = 0;
+    resetRequested = false;
+    clear();
+}
+
+void LoopProfiler::clear()
+{
+    iterations         = 0;
+    totalMicros        = 0;
+    maxIterationMicros = 0;
+    maxStallMicros     = 0;
+    maxStallSection    = LOOP_SECTION_IMPROV;
+    alarms             = 0;
+    lastAlarmLog       = 0;
+    for (int i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+    {
+        histogram[i] = 0;
+    }
+    for (int i = 0; i < LOOP_SECTION_COUNT; i++)
+    {
+        sectionTotalMicros[i] = 0;
+        sectionMaxMicros[i]   = 0;
+    }
+}
+
+void LoopProfiler::begin()
+{
+    mainTask       = xTaskGetCurrentTaskHandle();
+    cyclesPerMicro = ESP.getCpuFreqMHz();
+
+    setAlarmThreshold(settingsManager.getLoopAlarm());
+    settingsManager.addObserver(SETTING_LOOP_ALARM, [this](uint32_t changedFields)
+                                { this->setAlarmThreshold(settingsManager.getLoopAlarm()); });
+}
+
+void LoopProfiler::beginIteration()
+{
+    if (resetRequested)
+    {
+        resetRequested = false;
+        clear();
+    }
+
+    for (int i = 0; i < LOOP_SECTION_COUNT; i++)
+    {
+        iterationCycles[i] = 0;
+    }
+    iterationStart = ESP.getCycleCount();
+    sectionStart   = iterationStart;
+    currentSection = LOOP_SECTION_IMPROV;
+    inIteration    = true;
+}
+
+loop_section_t LoopProfiler::enter(loop_section_t section)
+{
+    loop_section_t previous = currentSection;
+    if (!inIteration || xTaskGetCurrentTaskHandle() != mainTask)
+    {
+        return previous;
+    }
+
+    uint32_t now = ESP.getCycleCount();
+    iterationCycles[currentSection] += now - sectionStart;
+    sectionStart   = now;
+    currentSection = section;
+    return previous;
+}
+
+void LoopProfiler::endIteration()
+{
+    if (!inIteration)
+    {
+        return;
+    }
+    enter(currentSection);
+    inIteration = false;
+
+    uint32_t elapsed = (sectionStart - iterationStart) / cyclesPerMicro;
+    iterations++;
+    totalMicros += elapsed;
+    if (elapsed > maxIterationMicros)
+    {
+        maxIterationMicros = elapsed;
+    }
+
+    int bucket = 0;
+    for (uint32_t value = elapsed >> LOOP_HISTOGRAM_FIRST_SHIFT;
+         value > 0 && bucket < LOOP_HISTOGRAM_BUCKETS - 1; value >>= 1)
+    {
+        bucket++;
+    }
+    histogram[bucket]++;
+
+    loop_section_t slowest       = LOOP_SECTION_IMPROV;
+    uint32_t       slowestMicros = 0;
+    for (int i = 0; i < LOOP_SECTION_COUNT; i++)
+    {
+        uint32_t sectionMicros = iterationCycles[i] / cyclesPerMicro;
+        sectionTotalMicros[i] += sectionMicros;
+        if (sectionMicros > sectionMaxMicros[i])
+        {
+            sectionMaxMicros[i] = sectionMicros;
+        }
+        if (sectionMicros > slowestMicros)
+        {
+            slowest       = (loop_section_t) i;
+            slowestMicros = sectionMicros;
+        }
+    }
+    if (slowestMicros > maxStallMicros)
+    {
+        maxStallMicros  = slowestMicros;
+        maxStallSection = slowest;
+    }
+
+    if (alarmMicros > 0 && elapsed > alarmMicros)
+    {
+        alarms++;
+        unsigned long now = millis();
+        if (now - lastAlarmLog >= LOOP_ALARM_LOG_INTERVAL_MS)
+        {
+            lastAlarmLog = now;
+            logger.logf("Loop stall: %lums, %s took %lums", (unsigned long) (elapsed / 1000),
+                        sectionNames[slowest], (unsigned long) (slowestMicros / 1000));
+        }
+    }
+}
+
+void LoopProfiler::setAlarmThreshold(uint32_t milliseconds)
+{
+    alarmMicros = milliseconds * 1000;
+}
+
+String LoopProfiler::toJson()
+{
+    BulkJsonDocument doc(1536);
+
+    doc["iterations"]         = iterations;
+    doc["average_us"]         = iterations > 0 ? (uint32_t) (totalMicros / iterations) : 0;
+    doc["max_us"]             = maxIterationMicros;
+    doc["alarm_threshold_ms"] = alarmMicros / 1000;
+    doc["alarms"]             = alarms;
+
+    JsonObject stall = doc.createNestedObject("max_stall");
+    stall["section"] = sectionNames[maxStallSection];
+    stall["us"]      = maxStallMicros;
+
+    // Upper bound of every bucket, the last one is open-ended
+    JsonArray histogramJson = doc.createNestedArray("histogram");
+    for (int i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+    {
+        JsonObject bucket = histogramJson.createNestedObject();
+        if (i < LOOP_HISTOGRAM_BUCKETS - 1)
+        {
+            bucket["below_us"] = 1UL << (LOOP_HISTOGRAM_FIRST_SHIFT + i);
+        }
+        else
+        {
+            bucket["below_us"] = nullptr;
+        }
+        bucket["count"] = histogram[i];
+    }
+
+    JsonObject sections = doc.createNestedObject("sections");
+    for (int i = 0; i < LOOP_SECTION_COUNT; i++)
+    {
+        JsonObject section  = sections.createNestedObject(sectionNames[i]);
+        section["total_ms"] = (uint32_t) (sectionTotalMicros[i] / 1000);
+        section["max_us"]   = sectionMaxMicros[i];
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
+
+void LoopProfiler::reset()
+{
+    resetRequested = true;
+}
@@ -0,0 +1,93 @@
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include <Arduino.h>
+
+// Histogram buckets are powers of two, the first one holds everything below 64us and the last
+// one everything from ~1s up
+#define LOOP_HISTOGRAM_BUCKETS 16
+#define LOOP_HISTOGRAM_FIRST_SHIFT 6
+
+// Minimum time between two jitter alarm log lines
+#define LOOP_ALARM_LOG_INTERVAL_MS 1000
+
+// The parts of the main loop that time gets attributed to
+typedef enum
+{
+    LOOP_SECTION_IMPROV,
+    LOOP_SECTION_SETTINGS,
+    LOOP_SECTION_WIFI,
+    LOOP_SECTION_SCHEDULER,
+    LOOP_SECTION_SENSORS,
+    LOOP_SECTION_WEBSOCKET,
+    LOOP_SECTION_WEBSERVER,
+    LOOP_SECTION_LOGGER,
+    LOOP_SECTION_COUNT,
+} loop_section_t;
+
+// Always-on main loop instrumentation. Each iteration is split into sections with enter(), which
+// only reads the cycle counter, the bookkeeping happens once per iteration in endIteration().
+// Time spent blocked in PowerManager::idle() is not part of any iteration.
+class LoopProfiler
+{
+   private:
+    TaskHandle_t   mainTask;
+    uint32_t       cyclesPerMicro;
+    bool           inIteration;
+    loop_section_t currentSection;
+    uint32_t       sectionStart;
+    uint32_t       iterationStart;
+
+    // Cycles per section in the current iteration
+    uint32_t iterationCycles[LOOP_SECTION_COUNT];
+
+    // Accumulated statistics, in microseconds
+    uint32_t iterations;
+    uint32_t histogram[LOOP_HISTOGRAM_BUCKETS];
+    uint64_t totalMicros;
+    uint32_t maxIterationMicros;
+    uint64_t sectionTotalMicros[LOOP_SECTION_COUNT];
+    uint32_t sectionMaxMicros[LOOP_SECTION_COUNT];
+    // Worst single section in any iteration, i.e. who caused the longest stall
+    uint32_t       maxStallMicros;
+    loop_section_t maxStallSection;
+
+    // Jitter alarm, 0 disables it
+    uint32_t      alarmMicros;
+    uint32_t      alarms;
+    unsigned long lastAlarmLog;
+
+    // Set by reset(), applied on the main loop
+    volatile bool resetRequested;
+
+    LoopProfiler();
+
+    LoopProfiler(const LoopProfiler &)            = delete;
+    LoopProfiler &operator=(const LoopProfiler &) = delete;
+
+    void clear();
+
+   public:
+    static LoopProfiler &getInstance();
+
+    // Call from setup(), on the task that runs loop()
+    void begin();
+
+    void beginIteration();
+    // Attributes the time since the last call to the previous section and starts timing section.
+    // Returns the previous section so nested code can switch back. Calls from other tasks are
+    // ignored.
+    loop_section_t enter(loop_section_t section);
+    void           endIteration();
+
+    // Log iterations that take longer than this, 0 turns the alarm off
+    void setAlarmThreshold(uint32_t milliseconds);
+
+    String toJson();
+    // Safe to call from any task, e.g. the web server or at the start of a print
+    void reset();
+};
+
+#define loopProfiler LoopProfiler::getInstance()
+
+#endif  // LOOP_PROFILER_H
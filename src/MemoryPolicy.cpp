@@ -0,0 +1,163 @@
+#include "MemoryPolicy.h"
+
+#include <esp_heap_caps.h>
+
+#include "Scheduler.h"
+
+#define CAPS_INTERNAL (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#define CAPS_PSRAM (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+
+MemoryPolicy &MemoryPolicy::getInstance()
+{
+    static MemoryPolicy instance;
+    return instance;
+}
+
+MemoryPolicy::MemoryPolicy()
+{
+    bulkInPsram     = 0;
+    bulkInInternal  = 0;
+    hotAllocations  = 0;
+    failures        = 0;
+    baselineFree    = 0;
+    baselineLargest = 0;
+    baselineAt      = 0;
+
+    history            = NULL;
+    historyCount       = 0;
+    lowestLargestBlock = 0;
+    sampleJob          = -1;
+}
+
+void *MemoryPolicy::allocate(size_t size, memory_class_t memoryClass)
+{
+    void *pointer = NULL;
+    if (memoryClass == MEMORY_BULK && psramFound())
+    {
+        pointer = heap_caps_malloc(size, CAPS_PSRAM);
+        if (pointer != NULL)
+        {
+            bulkInPsram++;
+            return pointer;
+        }
+    }
+
+    // PSRAM full or not there, bulk buffers still work from internal RAM
+    pointer = heap_caps_malloc(size, CAPS_INTERNAL);
+    if (pointer == NULL)
+    {
+        failures++;
+    }
+    else if (memoryClass == MEMORY_BULK)
+    {
+        bulkInInternal++;
+    }
+    else
+    {
+        hotAllocations++;
+    }
+    return pointer;
+}
+
+void *MemoryPolicy::reallocate(void *pointer, size_t size, memory_class_t memoryClass)
+{
+    if (pointer == NULL)
+    {
+        return allocate(size, memoryClass);
+    }
+    // Any 8 bit capable heap qualifies, so the block stays where it is. ArduinoJson only uses
+    // this to shrink.
+    void *resized = heap_caps_realloc(pointer, size, MALLOC_CAP_8BIT);
+    if (resized == NULL)
+    {
+        failures++;
+    }
+    return resized;
+}
+
+void MemoryPolicy::release(void *pointer)
+{
+    heap_caps_free(pointer);
+}
+
+void MemoryPolicy::begin()
+{
+    baselineFree       = heap_caps_get_free_size(CAPS_INTERNAL);
+    baselineLargest    = heap_caps_get_largest_free_block(CAPS_INTERNAL);
+    baselineAt         = millis();
+    lowestLargestBlock = baselineLargest;
+
+    history   = (heap_sample_t *) allocate(sizeof(heap_sample_t) * HEAP_HISTORY_SIZE, MEMORY_BULK);
+    sampleJob = scheduler.addJob("heap_sample", JOB_PRIORITY_LOW,
+                                 [this](unsigned long now) { sample(now); });
+    scheduler.schedule(sampleJob, 0, HEAP_SAMPLE_INTERVAL_MS);
+}
+
+void MemoryPolicy::sample(unsigned long now)
+{
+    uint32_t largest = heap_caps_get_largest_free_block(CAPS_INTERNAL);
+    if (largest < lowestLargestBlock)
+    {
+        lowestLargestBlock = largest;
+    }
+    if (history == NULL)
+    {
+        return;
+    }
+
+    heap_sample_t &entry = history[historyCount % HEAP_HISTORY_SIZE];
+    entry.uptimeSeconds  = now / 1000;
+    entry.freeBytes      = heap_caps_get_free_size(CAPS_INTERNAL);
+    entry.largestBlock   = largest;
+    historyCount++;
+}
+
+String MemoryPolicy::toJson()
+{
+    BulkJsonDocument doc(1024 + HEAP_HISTORY_SIZE * 80);
+
+    JsonObject internal              = doc.createNestedObject("internal");
+    internal["free"]                 = (uint32_t) heap_caps_get_free_size(CAPS_INTERNAL);
+    internal["min_free"]             = (uint32_t) heap_caps_get_minimum_free_size(CAPS_INTERNAL);
+    internal["largest_block"]        = (uint32_t) heap_caps_get_largest_free_block(CAPS_INTERNAL);
+    internal["lowest_largest_block"] = lowestLargestBlock;
+    internal["total"]                = (uint32_t) heap_caps_get_total_size(CAPS_INTERNAL);
+
+    // Headroom right after boot against now, a soak shows whether it keeps shrinking
+    JsonObject baseline       = doc.createNestedObject("baseline");
+    baseline["free"]          = baselineFree;
+    baseline["largest_block"] = baselineLargest;
+    baseline["age_s"]         = (millis() - baselineAt) / 1000;
+
+    JsonObject psram = doc.createNestedObject("psram");
+    psram["present"] = psramFound();
+    if (psramFound())
+    {
+        psram["free"]          = (uint32_t) heap_caps_get_free_size(CAPS_PSRAM);
+        psram["min_free"]      = (uint32_t) heap_caps_get_minimum_free_size(CAPS_PSRAM);
+        psram["largest_block"] = (uint32_t) heap_caps_get_largest_free_block(CAPS_PSRAM);
+        psram["total"]         = (uint32_t) heap_caps_get_total_size(CAPS_PSRAM);
+    }
+
+    JsonObject allocations       = doc.createNestedObject("allocations");
+    allocations["bulk_psram"]    = bulkInPsram;
+    allocations["bulk_internal"] = bulkInInternal;
+    allocations["hot"]           = hotAllocations;
+    allocations["failed"]        = failures;
+
+    // [uptime s, free, largest block], oldest first
+    JsonArray historyJson = doc.createNestedArray("history");
+    uint32_t  first       = historyCount > HEAP_HISTORY_SIZE ? historyCount - HEAP_HISTORY_SIZE : 0;
+    for (uint32_t i = first; history != NULL && i < historyCount; i++)
+    {
+        const heap_sample_t &entry = history[i % HEAP_HISTORY_SIZE];
+        JsonArray            row   = historyJson.createNestedArray();
+        row.add(entry.uptimeSeconds);
+        row.add(entry.freeBytes);
+        row.add(entry.largestBlock);
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
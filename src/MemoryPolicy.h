@@ -0,0 +1,89 @@
+#ifndef MEMORY_POLICY_H
+#define MEMORY_POLICY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Internal heap samples for the fragmentation history, every 10 minutes for the last day
+#define HEAP_SAMPLE_INTERVAL_MS 600000UL
+#define HEAP_HISTORY_SIZE 144
+
+// Where a buffer goes. Internal RAM is what WiFi, lwIP and the task stacks run on, and the only
+// RAM a plain ESP32 has, so buffers that are big and not on the pause path go to PSRAM when the
+// board has it.
+typedef enum
+{
+    MEMORY_HOT,   // Internal RAM, for anything the sensor checks, pause path or interrupts touch
+    MEMORY_BULK,  // PSRAM when present, internal RAM otherwise: logs, traces, JSON responses
+} memory_class_t;
+
+class MemoryPolicy
+{
+   private:
+    // Allocations by where they ended up
+    volatile uint32_t bulkInPsram;
+    volatile uint32_t bulkInInternal;
+    volatile uint32_t hotAllocations;
+    volatile uint32_t failures;
+
+    // Internal heap once setup() is done, what later readings are compared with
+    uint32_t      baselineFree;
+    uint32_t      baselineLargest;
+    unsigned long baselineAt;
+
+    // Free memory that is scattered over small blocks shows up as a largest block that shrinks
+    // while the free total doesn't
+    struct heap_sample_t
+    {
+        uint32_t uptimeSeconds;
+        uint32_t freeBytes;
+        uint32_t largestBlock;
+    };
+    heap_sample_t *history;  // Bulk memory, NULL until begin()
+    uint32_t       historyCount;
+    uint32_t       lowestLargestBlock;
+    int            sampleJob;
+
+    void sample(unsigned long now);
+
+    MemoryPolicy();
+
+    MemoryPolicy(const MemoryPolicy &)            = delete;
+    MemoryPolicy &operator=(const MemoryPolicy &) = delete;
+
+   public:
+    static MemoryPolicy &getInstance();
+
+    // Thread safe, usable before setup()
+    void *allocate(size_t size, memory_class_t memoryClass);
+    void *reallocate(void *pointer, size_t size, memory_class_t memoryClass);
+    void  release(void *pointer);
+
+    // Call at the end of setup(), records the baseline and starts the heap history
+    void begin();
+
+    String toJson();
+};
+
+#define memoryPolicy MemoryPolicy::getInstance()
+
+// ArduinoJson allocator for documents that only build a response
+struct BulkJsonAllocator
+{
+    void *allocate(size_t size)
+    {
+        return memoryPolicy.allocate(size, MEMORY_BULK);
+    }
+    void deallocate(void *pointer)
+    {
+        memoryPolicy.release(pointer);
+    }
+    void *reallocate(void *pointer, size_t size)
+    {
+        return memoryPolicy.reallocate(pointer, size, MEMORY_BULK);
+    }
+};
+
+typedef BasicJsonDocument<BulkJsonAllocator> BulkJsonDocument;
+
+#endif  // MEMORY_POLICY_H
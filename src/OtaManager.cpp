@@ -0,0 +1,341 @@
+#include "OtaManager.h"
+
+#include <ArduinoJson.h>
+#include <AsyncTCP.h>
+#include <LittleFS.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+
+#include "ElegooCC.h"
+#include "Logger.h"
+#include "PowerManager.h"
+
+// Above the task running the async web server, so sensor checks and pauses preempt the upload
+#define OTA_LOOP_PRIORITY (CONFIG_ASYNC_TCP_PRIORITY + 1)
+
+static const char *stateName(ota_state_t state)
+{
+    switch (state)
+    {
+        case OTA_STATE_IDLE:
+            return "idle";
+        case OTA_STATE_RECEIVING:
+            return "receiving";
+        case OTA_STATE_STAGED:
+            return "staged";
+        case OTA_STATE_FAILED:
+            return "failed";
+    }
+    return "unknown";
+}
+
+static const char *targetName(ota_target_t target)
+{
+    switch (target)
+    {
+        case OTA_TARGET_FIRMWARE:
+            return "firmware";
+        case OTA_TARGET_FILESYSTEM:
+            return "filesystem";
+        case OTA_TARGET_DELTA:
+            return "delta";
+    }
+    return "unknown";
+}
+
+OtaManager &OtaManager::getInstance()
+{
+    static OtaManager instance;
+    return instance;
+}
+
+OtaManager::OtaManager()
+{
+    state              = OTA_STATE_IDLE;
+    owner              = NULL;
+    target             = OTA_TARGET_FIRMWARE;
+    error[0]           = '\0';
+    filesystemReleased = false;
+    received           = 0;
+    imaged             = 0;
+    expected           = 0;
+    startedAt          = 0;
+    finishedAt         = 0;
+    sectorWrites       = 0;
+    writeMicrosTotal   = 0;
+    writeMicrosMax     = 0;
+    mainTask           = NULL;
+    mainPriority       = 0;
+}
+
+void OtaManager::setup()
+{
+    mainTask     = xTaskGetCurrentTaskHandle();
+    mainPriority = uxTaskPriorityGet(mainTask);
+}
+
+bool OtaManager::begin(const void *uploadOwner, size_t expectedSize, ota_target_t updateTarget,
+                       const char *md5)
+{
+    if (state == OTA_STATE_RECEIVING)
+    {
+        return false;
+    }
+
+    owner            = uploadOwner;
+    target           = updateTarget;
+    expected         = expectedSize;
+    received         = 0;
+    imaged           = 0;
+    sectorWrites     = 0;
+    writeMicrosTotal = 0;
+    writeMicrosMax   = 0;
+    error[0]         = '\0';
+    startedAt        = millis();
+    finishedAt       = 0;
+
+    // The firmware goes to the inactive OTA slot, nothing changes for the running one until
+    // we reboot. The filesystem has only one partition and is written in place, so it's
+    // unmounted first. Writing under a mounted LittleFS that is serving files corrupts both.
+    if (target == OTA_TARGET_FILESYSTEM && !filesystemReleased)
+    {
+        filesystemReleased = true;
+        LittleFS.end();
+        logger.log("Filesystem unmounted for the update");
+    }
+    if (!Update.begin(UPDATE_SIZE_UNKNOWN, target == OTA_TARGET_FILESYSTEM ? U_SPIFFS : U_FLASH))
+    {
+        fail(Update.errorString());
+        return false;
+    }
+    if (md5 != NULL && md5[0] != '\0' && !Update.setMD5(md5))
+    {
+        Update.abort();
+        fail("invalid MD5");
+        return false;
+    }
+    if (target == OTA_TARGET_DELTA && !beginDelta())
+    {
+        Update.abort();
+        fail(delta.getError());
+        return false;
+    }
+
+    if (mainTask != NULL)
+    {
+        vTaskPrioritySet(mainTask, OTA_LOOP_PRIORITY);
+    }
+    state = OTA_STATE_RECEIVING;
+    logger.logf("Update of %s started", targetName(target));
+    return true;
+}
+
+bool OtaManager::beginDelta()
+{
+    // The patch is applied against the image in the running slot, read straight from flash
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (running == NULL)
+    {
+        return false;
+    }
+    return delta.begin(
+        ESP.getSketchSize(), ESP.getSketchMD5().c_str(),
+        [running](uint32_t offset, uint8_t *buffer, size_t length)
+        { return esp_partition_read(running, offset, buffer, length) == ESP_OK; },
+        [this](uint8_t *data, size_t length) { return writeImage(data, length); });
+}
+
+bool OtaManager::write(const void *uploadOwner, uint8_t *data, size_t length)
+{
+    if (state != OTA_STATE_RECEIVING || uploadOwner != owner)
+    {
+        return false;
+    }
+
+    received += length;
+    if (target != OTA_TARGET_DELTA)
+    {
+        return writeImage(data, length);
+    }
+    if (!delta.write(data, length))
+    {
+        // A failed image write already failed the update
+        if (state == OTA_STATE_RECEIVING)
+        {
+            Update.abort();
+            fail(delta.getError());
+        }
+        delta.end();
+        return false;
+    }
+    return true;
+}
+
+bool OtaManager::writeImage(uint8_t *data, size_t length)
+{
+    // The library buffers a sector and only then erases and writes it, that's the expensive part
+    size_t  flushedBefore = Update.progress();
+    int64_t start         = esp_timer_get_time();
+    size_t  written       = Update.write(data, length);
+    if (written != length)
+    {
+        Update.abort();
+        fail(Update.errorString());
+        return false;
+    }
+    imaged += length;
+
+    if (Update.progress() != flushedBefore)
+    {
+        uint32_t elapsed = (uint32_t) (esp_timer_get_time() - start);
+        sectorWrites++;
+        writeMicrosTotal += elapsed;
+        if (elapsed > writeMicrosMax)
+        {
+            writeMicrosMax = elapsed;
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTA_WRITE_GAP_MS));
+    }
+    return true;
+}
+
+bool OtaManager::end(const void *uploadOwner)
+{
+    if (state != OTA_STATE_RECEIVING || uploadOwner != owner)
+    {
+        return false;
+    }
+
+    if (target == OTA_TARGET_DELTA)
+    {
+        bool complete = delta.finish();
+        delta.end();
+        if (!complete)
+        {
+            Update.abort();
+            fail(delta.getError());
+            return false;
+        }
+    }
+
+    // Checks the MD5 if we got one and, for firmware, the image itself before marking it bootable
+    if (!Update.end(true))
+    {
+        fail(Update.errorString());
+        return false;
+    }
+
+    restorePriority();
+    finishedAt = millis();
+    owner      = NULL;
+    state      = OTA_STATE_STAGED;
+    logger.logf("Update of %u bytes (%u uploaded) verified after %lums, rebooting once the "
+                "printer is idle",
+                (unsigned) imaged, (unsigned) received, finishedAt - startedAt);
+    powerManager.notify();
+    return true;
+}
+
+void OtaManager::abortIfIncomplete(const void *uploadOwner)
+{
+    if (state == OTA_STATE_RECEIVING && uploadOwner == owner)
+    {
+        Update.abort();
+        delta.end();
+        fail("upload interrupted");
+    }
+}
+
+void OtaManager::fail(const char *reason)
+{
+    strncpy(error, reason, sizeof(error) - 1);
+    error[sizeof(error) - 1] = '\0';
+    finishedAt               = millis();
+    owner                    = NULL;
+    state                    = OTA_STATE_FAILED;
+    restorePriority();
+    logger.logf("Update failed: %s", error);
+
+    if (filesystemReleased)
+    {
+        // A partly written image may not mount, the UI built into the firmware still works then
+        filesystemReleased = !LittleFS.begin();
+        if (filesystemReleased)
+        {
+            logger.log("Filesystem can't be mounted after the failed update, upload it again");
+        }
+    }
+}
+
+void OtaManager::restorePriority()
+{
+    if (mainTask != NULL)
+    {
+        vTaskPrioritySet(mainTask, mainPriority);
+    }
+}
+
+void OtaManager::loop()
+{
+    if (state != OTA_STATE_STAGED || millis() - finishedAt < OTA_REBOOT_DELAY_MS)
+    {
+        return;
+    }
+
+    // Anything but idle means a print is going on (or paused), it can't go unmonitored
+    if (elegooCC.getSessionState() != SESSION_IDLE)
+    {
+        return;
+    }
+
+    logger.log("Printer is idle, rebooting into the update");
+    delay(100);  // let the log line go out
+    ESP.restart();
+}
+
+ota_state_t OtaManager::getState()
+{
+    return state;
+}
+
+const char *OtaManager::getError()
+{
+    return error;
+}
+
+bool OtaManager::isFilesystemAvailable()
+{
+    return !filesystemReleased;
+}
+
+String OtaManager::toJson()
+{
+    DynamicJsonDocument doc(512);
+
+    doc["state"]      = stateName(state);
+    doc["target"]     = targetName(target);
+    doc["received"]   = (uint32_t) received;
+    doc["written"]    = (uint32_t) imaged;
+    doc["expected"]   = (uint32_t) expected;
+    doc["progress"]   = expected > 0 ? (int) ((uint64_t) received * 100 / expected) : -1;
+    doc["elapsed_ms"] = state == OTA_STATE_RECEIVING ? millis() - startedAt
+                                                     : finishedAt - startedAt;
+    if (error[0] != '\0')
+    {
+        doc["error"] = (const char *) error;
+    }
+    doc["reboot_pending"] = state == OTA_STATE_STAGED;
+
+    JsonObject writes    = doc.createNestedObject("flash_writes");
+    writes["sectors"]    = sectorWrites;
+    writes["average_us"] = sectorWrites > 0 ? (uint32_t) (writeMicrosTotal / sectorWrites) : 0;
+    writes["max_us"]     = writeMicrosMax;
+    writes["total_ms"]   = (uint32_t) (writeMicrosTotal / 1000);
+    writes["gap_ms"]     = OTA_WRITE_GAP_MS;
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
@@ -0,0 +1,97 @@
+#ifndef OTA_MANAGER_H
+#define OTA_MANAGER_H
+
+#include <Arduino.h>
+
+#include "DeltaPatch.h"
+
+// Pause on the upload task after every flash sector written, so a fast upload can't keep the
+// flash (and with it both cores) busy back to back
+#define OTA_WRITE_GAP_MS 5
+// Time for the upload response to go out before a reboot
+#define OTA_REBOOT_DELAY_MS 1000
+
+typedef enum
+{
+    OTA_STATE_IDLE,       // No update since boot
+    OTA_STATE_RECEIVING,  // Upload in progress, writing to the inactive slot
+    OTA_STATE_STAGED,     // Verified and ready, reboots once the printer is idle
+    OTA_STATE_FAILED,     // Upload or verification failed, the running firmware stays
+} ota_state_t;
+
+typedef enum
+{
+    OTA_TARGET_FIRMWARE,    // Full firmware image
+    OTA_TARGET_FILESYSTEM,  // LittleFS image with the web UI
+    OTA_TARGET_DELTA,       // Firmware patch against the running image, see DeltaPatch.h
+} ota_target_t;
+
+// Firmware and filesystem updates that don't get in the way of monitoring a print. While an
+// upload runs the main loop gets a higher priority than the network task doing the writes, the
+// writes are paced, and the new image is only booted once the printer is idle.
+class OtaManager
+{
+   private:
+    volatile ota_state_t state;
+    const void          *owner;  // The upload that started the update
+    ota_target_t         target;
+    char                 error[64];
+
+    // LittleFS was unmounted for a filesystem update, see isFilesystemAvailable()
+    volatile bool filesystemReleased;
+
+    volatile size_t received;  // Bytes uploaded, the patch size for a delta update
+    volatile size_t imaged;    // Bytes written to the new image
+    size_t          expected;  // 0 when unknown
+    unsigned long   startedAt;
+    unsigned long   finishedAt;
+
+    // Flash write timing, one sample per sector the update library flushed
+    uint32_t sectorWrites;
+    uint64_t writeMicrosTotal;
+    uint32_t writeMicrosMax;
+
+    TaskHandle_t mainTask;
+    UBaseType_t  mainPriority;
+
+    DeltaPatch delta;
+
+    OtaManager();
+
+    OtaManager(const OtaManager &)            = delete;
+    OtaManager &operator=(const OtaManager &) = delete;
+
+    void fail(const char *reason);
+    void restorePriority();
+    bool beginDelta();
+    bool writeImage(uint8_t *data, size_t length);
+
+   public:
+    static OtaManager &getInstance();
+
+    // Call from setup(), on the task that runs loop()
+    void setup();
+    // Reboots into a staged update once the printer is idle
+    void loop();
+
+    // Upload side, called from the web server. owner identifies the upload, chunks of any other
+    // one are refused. expectedSize may be 0, md5 may be NULL or empty.
+    // For a delta update md5 is the one of the resulting image.
+    bool begin(const void *owner, size_t expectedSize, ota_target_t target, const char *md5);
+    bool write(const void *owner, uint8_t *data, size_t length);
+    bool end(const void *owner);
+    // The upload went away, abandons the update if it didn't finish
+    void abortIfIncomplete(const void *owner);
+
+    ota_state_t getState();
+    const char *getError();
+    // False from the start of a filesystem update until the reboot, nothing may use LittleFS
+    // while its partition is written. A failed update remounts whatever is left.
+    bool isFilesystemAvailable();
+
+    String toJson();
+};
+
+#define otaManager OtaManager::getInstance()
+
+#endif  // OTA_MANAGER_H
@@ -0,0 +1,124 @@
+#include "PowerManager.h"
+
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+
+#include "ElegooCC.h"
+
+// Shared with the sensor interrupt
+static TaskHandle_t      isrMainTask = NULL;
+static volatile uint32_t lastEdgeAt  = 0;  // esp_timer microseconds, truncated so it's atomic
+
+static void IRAM_ATTR onSensorEdge()
+{
+    lastEdgeAt = (uint32_t) esp_timer_get_time();
+
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(isrMainTask, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+PowerManager &PowerManager::getInstance()
+{
+    static PowerManager instance;
+    return instance;
+}
+
+PowerManager::PowerManager()
+{
+    mainTask           = NULL;
+    lastWake           = 0;
+    busyMicros         = 0;
+    idleMicros         = 0;
+    wakeups            = 0;
+    latencySamples     = 0;
+    latencyTotalMicros = 0;
+    latencyMaxMicros   = 0;
+    resetRequested     = false;
+}
+
+void PowerManager::begin()
+{
+    mainTask    = xTaskGetCurrentTaskHandle();
+    isrMainTask = mainTask;
+    lastWake    = micros();
+
+    attachInterrupt(digitalPinToInterrupt(FILAMENT_RUNOUT_PIN), onSensorEdge, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(MOVEMENT_SENSOR_PIN), onSensorEdge, CHANGE);
+}
+
+void PowerManager::notify()
+{
+    if (mainTask != NULL)
+    {
+        xTaskNotifyGive(mainTask);
+    }
+}
+
+void PowerManager::idle(unsigned long maxWait)
+{
+    unsigned long start = micros();
+    busyMicros += start - lastWake;
+
+    if (maxWait > 0)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(maxWait));
+    }
+
+    lastWake = micros();
+    idleMicros += lastWake - start;
+    wakeups++;
+
+    if (resetRequested)
+    {
+        resetRequested     = false;
+        busyMicros         = 0;
+        idleMicros         = 0;
+        wakeups            = 0;
+        latencySamples     = 0;
+        latencyTotalMicros = 0;
+        latencyMaxMicros   = 0;
+    }
+}
+
+void PowerManager::recordSensorChange()
+{
+    uint32_t edgeAt = lastEdgeAt;
+    if (edgeAt == 0)
+    {
+        return;
+    }
+    lastEdgeAt = 0;
+
+    uint32_t latency = (uint32_t) esp_timer_get_time() - edgeAt;
+    latencySamples++;
+    latencyTotalMicros += latency;
+    if (latency > latencyMaxMicros)
+    {
+        latencyMaxMicros = latency;
+    }
+}
+
+String PowerManager::toJson()
+{
+    StaticJsonDocument<384> doc;
+
+    uint64_t total        = busyMicros + idleMicros;
+    doc["duty_cycle_pct"] = total > 0 ? busyMicros * 100.0 / total : 100.0;
+    doc["busy_ms"]        = (uint32_t) (busyMicros / 1000);
+    doc["idle_ms"]        = (uint32_t) (idleMicros / 1000);
+    doc["wakeups"]        = wakeups;
+    doc["sensor_changes"] = latencySamples;
+    doc["latency_avg_us"] =
+        latencySamples > 0 ? (uint32_t) (latencyTotalMicros / latencySamples) : 0;
+    doc["latency_max_us"] = latencyMaxMicros;
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
+
+void PowerManager::resetStats()
+{
+    resetRequested = true;
+}
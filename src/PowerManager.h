@@ -0,0 +1,59 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+
+// Longest the main loop sleeps when nothing asked for an earlier wakeup. Bounds how late polled
+// work (settings flush, improv on USB CDC) gets handled.
+#define IDLE_MAX_WAIT_MS 100
+
+// Lets the main loop block between events instead of spinning. Sensor edges, WiFi events and
+// serial input wake it up early. The printer websocket still has to be polled, so once it's in
+// use the loop wakes every WEBSOCKET_POLL_INTERVAL_MS; the long waits are before a printer is
+// configured and while WiFi is down. No light sleep, the stock SDK has no tickless idle.
+class PowerManager
+{
+   private:
+    TaskHandle_t mainTask;
+
+    // Loop duty cycle
+    unsigned long lastWake;
+    uint64_t      busyMicros;
+    uint64_t      idleMicros;
+    uint32_t      wakeups;
+
+    // Sensor edge to detection latency
+    uint32_t latencySamples;
+    uint64_t latencyTotalMicros;
+    uint32_t latencyMaxMicros;
+
+    // Set by resetStats(), applied on the main loop
+    volatile bool resetRequested;
+
+    PowerManager();
+
+    PowerManager(const PowerManager &)            = delete;
+    PowerManager &operator=(const PowerManager &) = delete;
+
+   public:
+    static PowerManager &getInstance();
+
+    // Call from setup(), on the task that runs loop()
+    void begin();
+
+    // Wake the main loop, safe to call from any task
+    void notify();
+
+    // Block for at most maxWait ms, or until notify() or a sensor edge
+    void idle(unsigned long maxWait);
+
+    // Called when the loop noticed a sensor change, measures how long ago the edge happened
+    void recordSensorChange();
+
+    String toJson();
+    void   resetStats();
+};
+
+#define powerManager PowerManager::getInstance()
+
+#endif  // POWER_MANAGER_H
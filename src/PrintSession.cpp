@@ -0,0 +1,147 @@
+#include "PrintSession.h"
+
+#include <ArduinoJson.h>
+
+#include "MemoryPolicy.h"
+
+// Marks an event that is ignored in a state
+#define NO_TRANSITION SESSION_STATE_COUNT
+
+// Next state for every state and event. Print status events are only sent when the status
+// changes, so these rows stay small.
+static const uint8_t transitions[SESSION_STATE_COUNT][SESSION_EVENT_COUNT] = {
+    // Columns in session_event_t order: stopped, heating, leveling, printing, paused, other,
+    // grace_expired, near_end, ticks_left, pause_sent, pause_failed, pause_ended, resumed
+
+    // SESSION_IDLE
+    {NO_TRANSITION, SESSION_HEATING, SESSION_LEVELING, SESSION_PRINTING_GRACE,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, SESSION_PRINTING_ARMED},
+    // SESSION_HEATING
+    {SESSION_IDLE, NO_TRANSITION, SESSION_LEVELING, SESSION_PRINTING_GRACE,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+    // SESSION_LEVELING
+    {SESSION_IDLE, SESSION_HEATING, NO_TRANSITION, SESSION_PRINTING_GRACE,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+    // SESSION_PRINTING_GRACE
+    {SESSION_IDLE, SESSION_HEATING, SESSION_LEVELING, NO_TRANSITION,
+     SESSION_PAUSED, NO_TRANSITION, SESSION_PRINTING_ARMED, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+    // SESSION_PRINTING_ARMED
+    {SESSION_IDLE, SESSION_HEATING, SESSION_LEVELING, NO_TRANSITION,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, SESSION_FINISHING, NO_TRANSITION,
+     SESSION_PAUSING, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+    // SESSION_PAUSING, printing again after a failed pause starts over with a grace period
+    {SESSION_IDLE, SESSION_HEATING, SESSION_LEVELING, SESSION_PRINTING_GRACE,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, SESSION_PAUSING, SESSION_PRINTING_GRACE, NO_TRANSITION},
+    // SESSION_PAUSED
+    {SESSION_IDLE, SESSION_HEATING, SESSION_LEVELING, SESSION_PRINTING_GRACE,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+    // SESSION_FINISHING
+    {SESSION_IDLE, SESSION_HEATING, SESSION_LEVELING, NO_TRANSITION,
+     SESSION_PAUSED, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, SESSION_PRINTING_ARMED,
+     NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION},
+};
+
+static const char *const stateNames[SESSION_STATE_COUNT] = {
+    "idle",           "heating", "leveling", "printing_grace",
+    "printing_armed", "pausing", "paused",   "finishing",
+};
+
+static const char *const eventNames[SESSION_EVENT_COUNT] = {
+    "stopped",      "heating",       "leveling", "printing",   "paused",
+    "other",        "grace_expired", "near_end", "ticks_left", "pause_sent",
+    "pause_failed", "pause_ended",   "resumed",
+};
+
+PrintSession::PrintSession()
+{
+    state      = SESSION_IDLE;
+    enteredAt  = 0;
+    traceCount = 0;
+    trace      = (session_trace_t *) memoryPolicy.allocate(
+        sizeof(session_trace_t) * SESSION_TRACE_SIZE, MEMORY_BULK);
+}
+
+bool PrintSession::dispatch(session_event_t event, unsigned long now)
+{
+    uint8_t next = transitions[state][event];
+    if (next == NO_TRANSITION)
+    {
+        return false;
+    }
+
+    if (trace != NULL)
+    {
+        session_trace_t &entry = trace[traceCount % SESSION_TRACE_SIZE];
+        entry.time             = now;
+        entry.from             = state;
+        entry.to               = next;
+        entry.event            = event;
+        traceCount++;
+    }
+
+    session_state_t from = state;
+    state                = (session_state_t) next;
+    if (from != state)
+    {
+        enteredAt = now;
+    }
+
+    if (onTransition)
+    {
+        onTransition(from, state, event);
+    }
+    return true;
+}
+
+session_state_t PrintSession::getState()
+{
+    return state;
+}
+
+unsigned long PrintSession::timeInState(unsigned long now)
+{
+    return now - enteredAt;
+}
+
+const char *PrintSession::stateName(session_state_t state)
+{
+    return state < SESSION_STATE_COUNT ? stateNames[state] : "unknown";
+}
+
+const char *PrintSession::eventName(session_event_t event)
+{
+    return event < SESSION_EVENT_COUNT ? eventNames[event] : "unknown";
+}
+
+String PrintSession::toJson(unsigned long now)
+{
+    BulkJsonDocument doc(6144);
+
+    doc["state"]       = stateName(state);
+    doc["in_state_ms"] = timeInState(now);
+    doc["now_ms"]      = now;
+    doc["transitions"] = traceCount;
+
+    // Oldest first
+    JsonArray traceJson = doc.createNestedArray("trace");
+    uint32_t  first     = traceCount > SESSION_TRACE_SIZE ? traceCount - SESSION_TRACE_SIZE : 0;
+    for (uint32_t i = first; i < traceCount; i++)
+    {
+        const session_trace_t &entry = trace[i % SESSION_TRACE_SIZE];
+        JsonArray              row   = traceJson.createNestedArray();
+        row.add(entry.time);
+        row.add(stateNames[entry.from]);
+        row.add(eventNames[entry.event]);
+        row.add(stateNames[entry.to]);
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
@@ -0,0 +1,84 @@
+#ifndef PRINT_SESSION_H
+#define PRINT_SESSION_H
+
+#include <Arduino.h>
+
+#include <functional>
+
+// Transitions kept for /print_session, the oldest are overwritten
+#define SESSION_TRACE_SIZE 64
+
+typedef enum
+{
+    SESSION_IDLE,             // No print, or it stopped or completed
+    SESSION_HEATING,          // Print started, heating up
+    SESSION_LEVELING,         // Print started, leveling the bed
+    SESSION_PRINTING_GRACE,   // Printing, but still within start_print_timeout
+    SESSION_PRINTING_ARMED,   // Printing and monitored, a filament problem pauses the print
+    SESSION_PAUSING,          // We asked for a pause and wait for the printer to report it
+    SESSION_PAUSED,           // The printer is pausing or paused
+    SESSION_FINISHING,        // Almost done, not worth pausing anymore
+    SESSION_STATE_COUNT,
+} session_state_t;
+
+typedef enum
+{
+    SESSION_EVENT_STOPPED,        // Print status went to idle, stopped or complete
+    SESSION_EVENT_HEATING,        // Print status went to heating
+    SESSION_EVENT_LEVELING,       // Print status went to bed leveling
+    SESSION_EVENT_PRINTING,       // Print status went to printing
+    SESSION_EVENT_PAUSED,         // Print status went to pausing or paused
+    SESSION_EVENT_OTHER,          // Print status went to one the pause logic doesn't act on, like
+                                  // file checking, homing or a code we don't know
+    SESSION_EVENT_GRACE_EXPIRED,  // start_print_timeout passed since printing started
+    SESSION_EVENT_NEAR_END,       // Less than 100 ticks left
+    SESSION_EVENT_TICKS_LEFT,     // More than that again, the totals weren't known yet
+    SESSION_EVENT_PAUSE_SENT,     // We started a pause
+    SESSION_EVENT_PAUSE_FAILED,   // The pause was never confirmed, no new one until the status
+                                  // changes
+    SESSION_EVENT_PAUSE_ENDED,    // Our pause is over without the printer reporting a pause: it was
+                                  // abandoned, or only the filament feed was stopped
+    SESSION_EVENT_RESUMED,        // Printing the job we were monitoring before a reset
+    SESSION_EVENT_COUNT,
+} session_event_t;
+
+// Print job lifecycle as seen by the pause logic. Status frames and our own actions are turned
+// into events, and a static table decides what each event does in each state. Everything that
+// used to be re-checked on every loop (grace period, print status, pause in flight, end of print)
+// is now the state.
+class PrintSession
+{
+   private:
+    session_state_t state;
+    unsigned long   enteredAt;
+
+    struct session_trace_t
+    {
+        uint32_t time;  // millis() of the transition
+        uint8_t  from;
+        uint8_t  to;
+        uint8_t  event;
+    };
+    session_trace_t *trace;       // Bulk memory, see MemoryPolicy.h. NULL if that failed.
+    uint32_t         traceCount;  // Total recorded, the buffer holds the last SESSION_TRACE_SIZE
+
+   public:
+    PrintSession();
+
+    // Called after every transition, including ones back into the same state
+    std::function<void(session_state_t from, session_state_t to, session_event_t event)>
+        onTransition;
+
+    // Applies event, returns false when it means nothing in the current state
+    bool dispatch(session_event_t event, unsigned long now);
+
+    session_state_t getState();
+    unsigned long   timeInState(unsigned long now);
+
+    static const char *stateName(session_state_t state);
+    static const char *eventName(session_event_t event);
+
+    String toJson(unsigned long now);
+};
+
+#endif  // PRINT_SESSION_H
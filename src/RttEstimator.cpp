@@ -0,0 +1,83 @@
+#include "RttEstimator.h"
+
+RttEstimator::RttEstimator()
+{
+    reset();
+}
+
+void RttEstimator::reset()
+{
+    smoothed = 0;
+    variance = 0;
+    samples  = 0;
+    minimum  = 0;
+    maximum  = 0;
+}
+
+void RttEstimator::addSample(uint32_t milliseconds)
+{
+    if (samples == 0)
+    {
+        smoothed = milliseconds;
+        variance = milliseconds / 2;
+        minimum  = milliseconds;
+        maximum  = milliseconds;
+    }
+    else
+    {
+        // alpha = 1/8, beta = 1/4
+        uint32_t error =
+            milliseconds > smoothed ? milliseconds - smoothed : smoothed - milliseconds;
+        variance = (3 * variance + error) / 4;
+        smoothed = (7 * smoothed + milliseconds) / 8;
+        if (milliseconds < minimum)
+        {
+            minimum = milliseconds;
+        }
+        if (milliseconds > maximum)
+        {
+            maximum = milliseconds;
+        }
+    }
+    samples++;
+}
+
+uint32_t RttEstimator::getTimeout(uint32_t minTimeout, uint32_t maxTimeout)
+{
+    if (samples == 0)
+    {
+        return maxTimeout;
+    }
+
+    uint32_t timeout = smoothed + 4 * variance;
+    if (timeout < minTimeout)
+    {
+        return minTimeout;
+    }
+    return timeout > maxTimeout ? maxTimeout : timeout;
+}
+
+uint32_t RttEstimator::getSmoothed()
+{
+    return smoothed;
+}
+
+uint32_t RttEstimator::getVariance()
+{
+    return variance;
+}
+
+uint32_t RttEstimator::getSampleCount()
+{
+    return samples;
+}
+
+uint32_t RttEstimator::getMin()
+{
+    return minimum;
+}
+
+uint32_t RttEstimator::getMax()
+{
+    return maximum;
+}
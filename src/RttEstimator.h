@@ -0,0 +1,34 @@
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <stdint.h>
+
+// Smoothed round-trip time and variation as in RFC 6298 (TCP's retransmission timer), in
+// milliseconds. Also used for the interval between messages from the printer.
+class RttEstimator
+{
+   private:
+    uint32_t smoothed;
+    uint32_t variance;
+    uint32_t samples;
+    uint32_t minimum;
+    uint32_t maximum;
+
+   public:
+    RttEstimator();
+
+    void addSample(uint32_t milliseconds);
+    void reset();
+
+    // Smoothed value plus four times the variation, clamped to [minimum, maximum]. Without any
+    // samples yet this is the maximum.
+    uint32_t getTimeout(uint32_t minTimeout, uint32_t maxTimeout);
+
+    uint32_t getSmoothed();
+    uint32_t getVariance();
+    uint32_t getSampleCount();
+    uint32_t getMin();
+    uint32_t getMax();
+};
+
+#endif  // RTT_ESTIMATOR_H
@@ -0,0 +1,279 @@
+#include "Scheduler.h"
+
+#include <ArduinoJson.h>
+
+#include "Logger.h"
+#include "MemoryPolicy.h"
+
+Scheduler &Scheduler::getInstance()
+{
+    static Scheduler instance;
+    return instance;
+}
+
+Scheduler::Scheduler()
+{
+    jobCount       = 0;
+    heapSize       = 0;
+    resetRequested = false;
+}
+
+int Scheduler::addJob(const char *name, job_priority_t priority, SchedulerJob callback)
+{
+    if (jobCount >= MAX_SCHEDULER_JOBS)
+    {
+        logger.logf("Scheduler full, can't add job %s", name);
+        return -1;
+    }
+
+    job_t &job      = jobs[jobCount];
+    job.name        = name;
+    job.callback    = callback;
+    job.priority    = priority;
+    job.state       = JOB_STATE_IDLE;
+    job.deadline    = 0;
+    job.period      = 0;
+    job.heapIndex   = -1;
+    job.runs        = 0;
+    job.totalMicros = 0;
+    job.maxMicros   = 0;
+    return jobCount++;
+}
+
+// Deadlines are compared through the difference so millis() wrapping around doesn't matter
+bool Scheduler::isBefore(int a, int b)
+{
+    long diff = (long) (jobs[a].deadline - jobs[b].deadline);
+    if (diff != 0)
+    {
+        return diff < 0;
+    }
+    return jobs[a].priority < jobs[b].priority;
+}
+
+void Scheduler::swap(int i, int j)
+{
+    int job                 = heap[i];
+    heap[i]                 = heap[j];
+    heap[j]                 = job;
+    jobs[heap[i]].heapIndex = i;
+    jobs[heap[j]].heapIndex = j;
+}
+
+void Scheduler::siftUp(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!isBefore(heap[i], heap[parent]))
+        {
+            break;
+        }
+        swap(i, parent);
+        i = parent;
+    }
+}
+
+void Scheduler::siftDown(int i)
+{
+    while (true)
+    {
+        int first = i;
+        int left  = 2 * i + 1;
+        int right = left + 1;
+        if (left < heapSize && isBefore(heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (right < heapSize && isBefore(heap[right], heap[first]))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            break;
+        }
+        swap(i, first);
+        i = first;
+    }
+}
+
+void Scheduler::push(int job)
+{
+    heap[heapSize]      = job;
+    jobs[job].heapIndex = heapSize;
+    jobs[job].state     = JOB_STATE_ARMED;
+    heapSize++;
+    siftUp(heapSize - 1);
+}
+
+void Scheduler::remove(int job)
+{
+    int i = jobs[job].heapIndex;
+    heapSize--;
+    if (i != heapSize)
+    {
+        swap(i, heapSize);
+        siftDown(i);
+        siftUp(i);
+    }
+    jobs[job].heapIndex = -1;
+}
+
+void Scheduler::schedule(int job, unsigned long delay, unsigned long period)
+{
+    if (job < 0 || job >= jobCount)
+    {
+        return;
+    }
+
+    if (jobs[job].state == JOB_STATE_ARMED)
+    {
+        remove(job);
+    }
+    jobs[job].deadline = millis() + delay;
+    jobs[job].period   = period;
+    push(job);
+}
+
+void Scheduler::cancel(int job)
+{
+    if (job < 0 || job >= jobCount)
+    {
+        return;
+    }
+
+    if (jobs[job].state == JOB_STATE_ARMED)
+    {
+        remove(job);
+    }
+    jobs[job].state = JOB_STATE_IDLE;
+}
+
+bool Scheduler::isScheduled(int job)
+{
+    return job >= 0 && job < jobCount && jobs[job].state != JOB_STATE_IDLE;
+}
+
+void Scheduler::run(unsigned long now)
+{
+    if (resetRequested)
+    {
+        resetRequested = false;
+        for (int i = 0; i < jobCount; i++)
+        {
+            jobs[i].runs        = 0;
+            jobs[i].totalMicros = 0;
+            jobs[i].maxMicros   = 0;
+        }
+    }
+
+    // Take everything that is due off the heap first, so a job re-arming itself with a short
+    // period can't keep this pass going forever
+    int due[MAX_SCHEDULER_JOBS];
+    int dueCount = 0;
+    while (heapSize > 0 && (long) (now - jobs[heap[0]].deadline) >= 0)
+    {
+        int job = heap[0];
+        remove(job);
+        jobs[job].state = JOB_STATE_DUE;
+
+        // Keep the list sorted by priority, the heap already gave us deadline order
+        int i = dueCount++;
+        while (i > 0 && jobs[due[i - 1]].priority > jobs[job].priority)
+        {
+            due[i] = due[i - 1];
+            i--;
+        }
+        due[i] = job;
+    }
+
+    for (int i = 0; i < dueCount; i++)
+    {
+        job_t &job = jobs[due[i]];
+        // An earlier job in this pass may have cancelled or re-armed this one
+        if (job.state != JOB_STATE_DUE)
+        {
+            continue;
+        }
+
+        if (job.period > 0)
+        {
+            // Stay on the original cadence, but don't try to catch up on runs we missed
+            job.deadline += job.period;
+            if ((long) (now - job.deadline) >= 0)
+            {
+                job.deadline = now + job.period;
+            }
+            push(due[i]);
+        }
+        else
+        {
+            job.state = JOB_STATE_IDLE;
+        }
+
+        unsigned long start = micros();
+        job.callback(now);
+        uint32_t elapsed = micros() - start;
+
+        job.runs++;
+        job.totalMicros += elapsed;
+        if (elapsed > job.maxMicros)
+        {
+            job.maxMicros = elapsed;
+        }
+    }
+}
+
+unsigned long Scheduler::timeUntilNextJob(unsigned long now, unsigned long limit)
+{
+    if (heapSize == 0)
+    {
+        return limit;
+    }
+
+    long remaining = (long) (jobs[heap[0]].deadline - now);
+    if (remaining <= 0)
+    {
+        return 0;
+    }
+    return (unsigned long) remaining < limit ? remaining : limit;
+}
+
+String Scheduler::toJson()
+{
+    BulkJsonDocument doc(256 + MAX_SCHEDULER_JOBS * 192);
+    JsonArray           jobsArray = doc.createNestedArray("jobs");
+    unsigned long       now       = millis();
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        const job_t &job      = jobs[i];
+        JsonObject   jobJson  = jobsArray.createNestedObject();
+        jobJson["name"]       = job.name;
+        jobJson["priority"]   = (int) job.priority;
+        jobJson["period_ms"]  = job.period;
+        jobJson["runs"]       = job.runs;
+        jobJson["total_us"]   = job.totalMicros;
+        jobJson["max_us"]     = job.maxMicros;
+        jobJson["average_us"] = job.runs > 0 ? (uint32_t) (job.totalMicros / job.runs) : 0;
+        if (job.state == JOB_STATE_IDLE)
+        {
+            jobJson["next_run_ms"] = nullptr;
+        }
+        else
+        {
+            long remaining         = (long) (job.deadline - now);
+            jobJson["next_run_ms"] = remaining > 0 ? remaining : 0;
+        }
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
+
+void Scheduler::resetStats()
+{
+    resetRequested = true;
+}
@@ -0,0 +1,98 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#include <functional>
+
+// Jobs are registered once at setup and (re)armed as needed, slots are never freed
+#define MAX_SCHEDULER_JOBS 16
+
+// When several jobs are due in the same pass, higher priorities run first
+typedef enum
+{
+    JOB_PRIORITY_HIGH,
+    JOB_PRIORITY_NORMAL,
+    JOB_PRIORITY_LOW,
+} job_priority_t;
+
+// Called from the main loop with the current millis()
+typedef std::function<void(unsigned long now)> SchedulerJob;
+
+// Cooperative deadline scheduler for the main loop. Armed jobs sit in a min-heap keyed on their
+// deadline, so finding the next one to run (or how long we may sleep) is O(1). Not thread-safe,
+// only touch it from the main loop.
+class Scheduler
+{
+   private:
+    typedef enum
+    {
+        JOB_STATE_IDLE,   // Registered but not armed
+        JOB_STATE_ARMED,  // Waiting in the heap for its deadline
+        JOB_STATE_DUE,    // Taken off the heap, runs later in the current pass
+    } job_state_t;
+
+    struct job_t
+    {
+        const char    *name;
+        SchedulerJob   callback;
+        job_priority_t priority;
+        job_state_t    state;
+        unsigned long  deadline;
+        unsigned long  period;  // 0 for one-shot jobs
+        int            heapIndex;
+
+        // Runtime accounting
+        uint32_t runs;
+        uint64_t totalMicros;
+        uint32_t maxMicros;
+    };
+
+    job_t jobs[MAX_SCHEDULER_JOBS];
+    int   jobCount;
+    int   heap[MAX_SCHEDULER_JOBS];
+    int   heapSize;
+
+    // Set by resetStats(), applied by run()
+    volatile bool resetRequested;
+
+    Scheduler();
+
+    Scheduler(const Scheduler &)            = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    bool isBefore(int a, int b);
+    void swap(int i, int j);
+    void siftUp(int i);
+    void siftDown(int i);
+    void push(int job);
+    void remove(int job);
+
+   public:
+    static Scheduler &getInstance();
+
+    // Registers a job and returns its id, or -1 when all slots are taken. The job doesn't run
+    // until it is armed with schedule().
+    int addJob(const char *name, job_priority_t priority, SchedulerJob callback);
+
+    // Arms job to run delay ms from now, and then every period ms if period isn't 0. Re-arming
+    // an armed job moves its deadline.
+    void schedule(int job, unsigned long delay, unsigned long period = 0);
+    void cancel(int job);
+    bool isScheduled(int job);
+
+    // Runs every job whose deadline has passed
+    void run(unsigned long now);
+
+    // Milliseconds until the next deadline, capped at limit. 0 means a job is due.
+    unsigned long timeUntilNextJob(unsigned long now, unsigned long limit);
+
+    // Per-job runtime statistics. Both are safe to call from the web server task, the reset is
+    // applied on the next run().
+    String toJson();
+    void   resetStats();
+};
+
+#define scheduler Scheduler::getInstance()
+
+#endif  // SCHEDULER_H
@@ -0,0 +1,183 @@
+#include "SdcpFields.h"
+
+#include <string.h>
+
+// Digits past this many are too small to matter for a float
+#define MAX_MANTISSA 100000000UL
+#define MAX_SCALE 9
+
+static const float powersOfTen[MAX_SCALE + 1] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f,
+};
+
+static const char *skipSpaces(const char *text)
+{
+    while (*text == ' ')
+    {
+        text++;
+    }
+    return text;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+const char *sdcpParseNumber(const char *text, float &value)
+{
+    if (text == NULL)
+    {
+        return NULL;
+    }
+
+    const char *p        = skipSpaces(text);
+    bool        negative = *p == '-';
+    if (*p == '-' || *p == '+')
+    {
+        p++;
+    }
+
+    // All digits go into one integer, scale remembers where the decimal point was
+    uint32_t mantissa = 0;
+    int      scale    = 0;
+    bool     digits   = false;
+    for (; isDigit(*p); p++)
+    {
+        digits = true;
+        if (mantissa < MAX_MANTISSA)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+        else
+        {
+            scale++;
+        }
+    }
+    if (*p == '.')
+    {
+        for (p++; isDigit(*p); p++)
+        {
+            digits = true;
+            if (mantissa < MAX_MANTISSA)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                scale--;
+            }
+        }
+    }
+    if (!digits)
+    {
+        return NULL;
+    }
+
+    // Leading zeros after the point only move the scale, so it can go past the table. Apply it
+    // in steps then, there's no limit on how many zeros a number can have.
+    float result = (float) mantissa;
+    while (scale < -MAX_SCALE)
+    {
+        result /= powersOfTen[MAX_SCALE];
+        scale += MAX_SCALE;
+    }
+    while (scale > MAX_SCALE)
+    {
+        result *= powersOfTen[MAX_SCALE];
+        scale -= MAX_SCALE;
+    }
+    if (scale < 0)
+    {
+        result /= powersOfTen[-scale];
+    }
+    else if (scale > 0)
+    {
+        result *= powersOfTen[scale];
+    }
+    value = negative ? -result : result;
+    return p;
+}
+
+bool sdcpParseCoord(const char *text, sdcp_coord_t &coord)
+{
+    float       axes[3];
+    const char *p = text;
+    for (int i = 0; i < 3; i++)
+    {
+        p = sdcpParseNumber(p, axes[i]);
+        if (p == NULL)
+        {
+            return false;
+        }
+        p = skipSpaces(p);
+        if (i < 2)
+        {
+            if (*p != ',')
+            {
+                return false;
+            }
+            p++;
+        }
+    }
+
+    coord.x = axes[0];
+    coord.y = axes[1];
+    coord.z = axes[2];
+    return true;
+}
+
+static const uint8_t *skipWhitespace(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+    return p;
+}
+
+bool sdcpFindRequestId(const uint8_t *payload, size_t length, char *requestId, size_t size)
+{
+    static const char key[]     = "\"RequestID\"";
+    const size_t      keyLength = sizeof(key) - 1;
+    if (payload == NULL || size == 0)
+    {
+        return false;
+    }
+
+    const uint8_t *end = payload + length;
+    for (const uint8_t *p = payload; (size_t) (end - p) > keyLength; p++)
+    {
+        if (memcmp(p, key, keyLength) != 0)
+        {
+            continue;
+        }
+
+        // A value that happens to say "RequestID" isn't followed by a colon, keep looking
+        const uint8_t *value = skipWhitespace(p + keyLength, end);
+        if (value == end || *value != ':')
+        {
+            continue;
+        }
+        value = skipWhitespace(value + 1, end);
+        if (value == end || *value != '"')
+        {
+            return false;
+        }
+
+        // RequestIDs are hex, anything escaped isn't one we sent or could have stored
+        size_t copied = 0;
+        for (value++; value < end && *value != '"'; value++)
+        {
+            if (*value == '\\' || copied + 1 >= size)
+            {
+                return false;
+            }
+            requestId[copied++] = *value;
+        }
+        if (value == end)
+        {
+            return false;
+        }
+        requestId[copied] = '\0';
+        return true;
+    }
+    return false;
+}
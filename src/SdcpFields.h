@@ -0,0 +1,30 @@
+#ifndef SDCP_FIELDS_H
+#define SDCP_FIELDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Nozzle position from Status.CurrenCoord, in mm
+typedef struct
+{
+    float x;
+    float y;
+    float z;
+} sdcp_coord_t;
+
+// Parsing for the status fields the printer sends as text. These work on the strings in the
+// parsed document as they are, nothing is copied or allocated.
+
+// Reads a decimal number like "-12.5", "3" or "0.25" at text. Returns a pointer to the first
+// character after it, or NULL when there is no number.
+const char *sdcpParseNumber(const char *text, float &value);
+
+// Parses "x,y,z". coord is only changed when all three axes are there.
+bool sdcpParseCoord(const char *text, sdcp_coord_t &coord);
+
+// Copies the value of the first "RequestID" key in a frame as it came off the socket, without
+// parsing it as JSON. Only responses carry one. False when there is none or it doesn't fit in
+// size bytes with its terminator.
+bool sdcpFindRequestId(const uint8_t *payload, size_t length, char *requestId, size_t size);
+
+#endif  // SDCP_FIELDS_H
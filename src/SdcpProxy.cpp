@@ -0,0 +1,312 @@
+#include "SdcpProxy.h"
+
+#include <ArduinoJson.h>
+
+#include "ElegooCC.h"
+#include "Logger.h"
+#include "SdcpFields.h"
+#include "SettingsManager.h"
+
+SdcpProxy &SdcpProxy::getInstance()
+{
+    static SdcpProxy instance;
+    return instance;
+}
+
+SdcpProxy::SdcpProxy() : server(SDCP_PROXY_PORT), socket(SDCP_PROXY_PATH)
+{
+    running        = false;
+    lastCleanup    = 0;
+    mutex          = xSemaphoreCreateMutex();
+    inboxHead      = 0;
+    inboxCount     = 0;
+    resetRequested = false;
+    clearStats();
+
+    socket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
+                          void *arg, uint8_t *data, size_t length)
+                   { this->socketEvent(client, type, arg, data, length); });
+    server.addHandler(&socket);
+}
+
+void SdcpProxy::clearStats()
+{
+    forwarded = 0;
+    broadcast = 0;
+    routed    = 0;
+    slow      = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    dropped = 0;
+    routes.resetExpired();
+    xSemaphoreGive(mutex);
+}
+
+void SdcpProxy::countDropped()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    dropped++;
+    xSemaphoreGive(mutex);
+}
+
+void SdcpProxy::setup()
+{
+    setEnabled(settingsManager.getProxyEnabled());
+    settingsManager.addObserver(SETTING_PROXY_ENABLED, [this](uint32_t changedFields)
+                                { this->setEnabled(settingsManager.getProxyEnabled()); });
+}
+
+void SdcpProxy::setEnabled(bool enabled)
+{
+    if (enabled == running)
+    {
+        return;
+    }
+
+    running = enabled;
+    if (enabled)
+    {
+        logger.logf("Starting SDCP proxy on port %d", SDCP_PROXY_PORT);
+        server.begin();
+        return;
+    }
+
+    logger.log("Stopping SDCP proxy");
+    socket.closeAll();
+    server.end();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    routes.clear();
+    inboxCount = 0;
+    xSemaphoreGive(mutex);
+}
+
+void SdcpProxy::loop()
+{
+    if (resetRequested)
+    {
+        resetRequested = false;
+        clearStats();
+    }
+
+    if (!running)
+    {
+        return;
+    }
+
+    // Only the network task adds to the inbox and only we take from it, so the entry at the head
+    // stays put while it's forwarded without the lock
+    while (true)
+    {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool empty = inboxCount == 0;
+        xSemaphoreGive(mutex);
+        if (empty)
+        {
+            break;
+        }
+
+        inbox_entry_t &entry = inbox[inboxHead];
+        handleClientMessage(entry.client, entry.payload, entry.length);
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        inboxHead = (inboxHead + 1) % SDCP_PROXY_INBOX_SIZE;
+        inboxCount--;
+        xSemaphoreGive(mutex);
+    }
+
+    unsigned long now = millis();
+    if (now - lastCleanup >= SDCP_PROXY_CLEANUP_INTERVAL_MS)
+    {
+        lastCleanup = now;
+        socket.cleanupClients(SDCP_PROXY_MAX_CLIENTS);
+    }
+}
+
+// Runs on the network task
+void SdcpProxy::socketEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg,
+                            uint8_t *data, size_t length)
+{
+    switch (type)
+    {
+        case WS_EVT_CONNECT:
+            logger.logf("SDCP proxy client %u connected", client->id());
+            break;
+        case WS_EVT_DISCONNECT:
+            logger.logf("SDCP proxy client %u disconnected", client->id());
+            xSemaphoreTake(mutex, portMAX_DELAY);
+            routes.dropClient(client->id());
+            xSemaphoreGive(mutex);
+            break;
+        case WS_EVT_DATA:
+            receiveClientFrame(client, (AwsFrameInfo *) arg, data, length);
+            break;
+        default:
+            break;
+    }
+}
+
+// Runs on the network task
+void SdcpProxy::receiveClientFrame(AsyncWebSocketClient *client, AwsFrameInfo *info,
+                                   uint8_t *data, size_t length)
+{
+    // SDCP commands are small single text frames, nothing legitimate arrives in pieces or binary
+    bool whole = info->final && info->index == 0 && info->len == length;
+
+    // We keep the printer connection alive ourselves, answer keepalives locally
+    if (whole && length == 4 && memcmp(data, "ping", 4) == 0)
+    {
+        client->text("pong");
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!whole || info->opcode != WS_TEXT || length > SDCP_PROXY_MAX_COMMAND_SIZE ||
+        inboxCount == SDCP_PROXY_INBOX_SIZE)
+    {
+        dropped++;
+    }
+    else
+    {
+        inbox_entry_t &entry = inbox[(inboxHead + inboxCount) % SDCP_PROXY_INBOX_SIZE];
+        entry.client         = client->id();
+        entry.length         = length;
+        memcpy(entry.payload, data, length);
+        inboxCount++;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void SdcpProxy::handleClientMessage(uint32_t client, uint8_t *payload, size_t length)
+{
+    // All we need from a command is where its response has to go
+    StaticJsonDocument<64> filter;
+    filter["Data"]["RequestID"] = true;
+
+    StaticJsonDocument<256> doc;
+    DeserializationError    error = deserializeJson(doc, (const char *) payload, length,
+                                                    DeserializationOption::Filter(filter));
+    if (error)
+    {
+        logger.logf("SDCP proxy client %u sent invalid JSON: %s", client, error.c_str());
+        countDropped();
+        return;
+    }
+
+    if (!elegooCC.sendRaw(payload, length))
+    {
+        countDropped();
+        return;
+    }
+    forwarded++;
+
+    const char *requestId = doc["Data"]["RequestID"];
+    if (requestId == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool added = routes.add(client, requestId, millis());
+    xSemaphoreGive(mutex);
+    if (!added)
+    {
+        logger.logf("SDCP proxy can't route RequestID %s, too long", requestId);
+    }
+}
+
+bool SdcpProxy::sendToClient(AsyncWebSocketClient &client, AsyncWebSocketSharedBuffer &frame)
+{
+    if (client.status() != WS_CONNECTED)
+    {
+        return false;
+    }
+
+    // Queuing never waits on the network, but a client that doesn't read would keep every frame
+    if (client.queueLen() >= SDCP_PROXY_MAX_QUEUED)
+    {
+        logger.logf("SDCP proxy client %u isn't keeping up, closing it", client.id());
+        client.close();
+        slow++;
+        return false;
+    }
+    return client.text(frame);
+}
+
+void SdcpProxy::onUpstreamMessage(uint8_t *payload, size_t length)
+{
+    if (!running || socket.count() == 0)
+    {
+        return;
+    }
+
+    // Found in the raw frame, so routing doesn't depend on what fits in our parsed document
+    char     requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+    bool     response = sdcpFindRequestId(payload, length, requestId, sizeof(requestId));
+    uint32_t client   = 0;
+    if (response)
+    {
+        // Responses to our own commands, or ones that took too long, have nobody to go to
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool waiting = routes.take(requestId, millis(), client);
+        xSemaphoreGive(mutex);
+        if (!waiting)
+        {
+            return;
+        }
+    }
+
+    // One copy of the frame, shared by the queues of every client it goes to
+    AsyncWebSocketSharedBuffer frame =
+        std::make_shared<std::vector<uint8_t>>(payload, payload + length);
+    if (!response)
+    {
+        for (AsyncWebSocketClient &each : socket.getClients())
+        {
+            sendToClient(each, frame);
+        }
+        broadcast++;
+        return;
+    }
+
+    AsyncWebSocketClient *target = socket.client(client);
+    if (target != NULL && sendToClient(*target, frame))
+    {
+        routed++;
+    }
+}
+
+void SdcpProxy::onUpstreamDropped()
+{
+    if (running && socket.count() > 0)
+    {
+        countDropped();
+    }
+}
+
+String SdcpProxy::toJson()
+{
+    DynamicJsonDocument doc(384);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int      pending = routes.getPendingCount();
+    uint32_t expired = routes.getExpired();
+    xSemaphoreGive(mutex);
+
+    doc["running"]   = running;
+    doc["port"]      = SDCP_PROXY_PORT;
+    doc["clients"]   = running ? socket.count() : 0;
+    doc["pending"]   = pending;
+    doc["forwarded"] = forwarded;
+    doc["broadcast"] = broadcast;
+    doc["routed"]    = routed;
+    doc["dropped"]   = dropped;
+    doc["slow"]      = slow;
+    doc["expired"]   = expired;
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
+
+void SdcpProxy::resetStats()
+{
+    resetRequested = true;
+}
@@ -0,0 +1,96 @@
+#ifndef SDCP_PROXY_H
+#define SDCP_PROXY_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "SdcpRoutes.h"
+
+// Same port and path as the printer, so tools only need the controller's address instead of the
+// printer's
+#define SDCP_PROXY_PORT 3030
+#define SDCP_PROXY_PATH "/websocket"
+// Clients past this many are closed, oldest first
+#define SDCP_PROXY_MAX_CLIENTS 4
+// Printer frames waiting to go out to one client. A client that lets more pile up isn't reading,
+// it's closed instead of holding on to heap.
+#define SDCP_PROXY_MAX_QUEUED 8
+// Client commands waiting for the main loop, and the biggest one taken
+#define SDCP_PROXY_INBOX_SIZE 4
+#define SDCP_PROXY_MAX_COMMAND_SIZE 1024
+#define SDCP_PROXY_CLEANUP_INTERVAL_MS 1000
+
+// Optional SDCP websocket endpoint that lets other tools (slicer device tab, remote access
+// agents) share our single connection to the printer. Frames from the printer are passed on
+// exactly as received, never re-serialized. Responses go only to the client whose RequestID they
+// carry, everything else (status, attributes, notices) goes to every client.
+//
+// Runs on its own async web server, so sending to clients only queues the frame and never waits
+// on the network in the main loop. Client commands arrive on the network task and are handed to
+// the main loop through the inbox, the printer connection belongs to it.
+class SdcpProxy
+{
+   private:
+    struct inbox_entry_t
+    {
+        uint32_t client;
+        size_t   length;
+        uint8_t  payload[SDCP_PROXY_MAX_COMMAND_SIZE];
+    };
+
+    AsyncWebServer server;
+    AsyncWebSocket socket;
+    bool           running;
+    unsigned long  lastCleanup;
+
+    // Guards the routes, the inbox and dropped, they're used from the network task too
+    SemaphoreHandle_t mutex;
+    SdcpRouteTable    routes;
+    inbox_entry_t     inbox[SDCP_PROXY_INBOX_SIZE];
+    int               inboxHead;
+    int               inboxCount;
+
+    uint32_t forwarded;  // Client commands sent to the printer
+    uint32_t broadcast;  // Printer frames sent to every client
+    uint32_t routed;     // Responses sent to the client that asked
+    uint32_t dropped;    // Messages we couldn't forward, from clients or the printer
+    uint32_t slow;       // Clients closed because they didn't keep up
+
+    // Set by resetStats(), applied on the main loop
+    volatile bool resetRequested;
+
+    SdcpProxy();
+
+    SdcpProxy(const SdcpProxy &)            = delete;
+    SdcpProxy &operator=(const SdcpProxy &) = delete;
+
+    void setEnabled(bool enabled);
+    void clearStats();
+    void countDropped();
+    void socketEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data,
+                     size_t length);
+    void receiveClientFrame(AsyncWebSocketClient *client, AwsFrameInfo *info, uint8_t *data,
+                            size_t length);
+    void handleClientMessage(uint32_t client, uint8_t *payload, size_t length);
+    bool sendToClient(AsyncWebSocketClient &client, AsyncWebSocketSharedBuffer &frame);
+
+   public:
+    static SdcpProxy &getInstance();
+
+    // Starts the endpoint when enabled in the settings, call once the network is up
+    void setup();
+    void loop();
+
+    // Every text frame from the printer, before we parse it ourselves. Whatever our own parse
+    // makes of it, clients get it as it came.
+    void onUpstreamMessage(uint8_t *payload, size_t length);
+    // A frame from the printer that was too big to keep, clients never see it
+    void onUpstreamDropped();
+
+    String toJson();
+    void   resetStats();
+};
+
+#define sdcpProxy SdcpProxy::getInstance()
+
+#endif  // SDCP_PROXY_H
@@ -0,0 +1,104 @@
+#include "SdcpRoutes.h"
+
+#include <string.h>
+
+SdcpRouteTable::SdcpRouteTable()
+{
+    expired = 0;
+    clear();
+}
+
+bool SdcpRouteTable::add(uint32_t client, const char *requestId, unsigned long now)
+{
+    if (strlen(requestId) >= SDCP_PROXY_REQUEST_ID_SIZE)
+    {
+        return false;
+    }
+
+    // Free slot, else the oldest, which is the most overdue one too
+    int slot = -1;
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        if (!pending[i].used)
+        {
+            slot = i;
+            break;
+        }
+        if (slot == -1 || now - pending[i].sentAt > now - pending[slot].sentAt)
+        {
+            slot = i;
+        }
+    }
+    if (pending[slot].used)
+    {
+        expired++;
+    }
+
+    strcpy(pending[slot].requestId, requestId);
+    pending[slot].client = client;
+    pending[slot].sentAt = now;
+    pending[slot].used   = true;
+    return true;
+}
+
+bool SdcpRouteTable::take(const char *requestId, unsigned long now, uint32_t &client)
+{
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        if (!pending[i].used || strcmp(pending[i].requestId, requestId) != 0)
+        {
+            continue;
+        }
+        pending[i].used = false;
+        if (now - pending[i].sentAt > SDCP_PROXY_PENDING_TIMEOUT_MS)
+        {
+            expired++;
+            return false;
+        }
+        client = pending[i].client;
+        return true;
+    }
+    return false;
+}
+
+void SdcpRouteTable::dropClient(uint32_t client)
+{
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        if (pending[i].used && pending[i].client == client)
+        {
+            pending[i].used = false;
+        }
+    }
+}
+
+void SdcpRouteTable::clear()
+{
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        pending[i].used = false;
+    }
+}
+
+int SdcpRouteTable::getPendingCount()
+{
+    int count = 0;
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        if (pending[i].used)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32_t SdcpRouteTable::getExpired()
+{
+    return expired;
+}
+
+void SdcpRouteTable::resetExpired()
+{
+    expired = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef SDCP_ROUTES_H
+#define SDCP_ROUTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Commands from downstream clients waiting for their response
+#define SDCP_PROXY_MAX_PENDING 16
+// A response that hasn't arrived after this long isn't coming, the slot can be reused
+#define SDCP_PROXY_PENDING_TIMEOUT_MS 10000
+// RequestIDs are 32 hex characters, leave room for clients that keep the dashes of the UUID
+#define SDCP_PROXY_REQUEST_ID_SIZE 40
+
+// Which proxy client is waiting for which RequestID. No Arduino dependencies, time is whatever the
+// caller passes in, so the routing can be tested on the host.
+class SdcpRouteTable
+{
+   private:
+    struct pending_request_t
+    {
+        char          requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+        uint32_t      client;
+        unsigned long sentAt;
+        bool          used;
+    };
+    pending_request_t pending[SDCP_PROXY_MAX_PENDING];
+
+    uint32_t expired;  // Requests that never got a response
+
+   public:
+    SdcpRouteTable();
+
+    // Remembers that client waits for requestId. A full table gives up on the oldest request.
+    // False when the RequestID is too long to keep, its response won't reach anyone.
+    bool add(uint32_t client, const char *requestId, unsigned long now);
+
+    // Sets client to the one waiting for requestId, which is forgotten then. False when nobody
+    // is, the command was our own or its response came too late.
+    bool take(const char *requestId, unsigned long now, uint32_t &client);
+
+    // The client went away, nothing it asked for has anywhere to go
+    void dropClient(uint32_t client);
+    void clear();
+
+    int      getPendingCount();
+    uint32_t getExpired();
+    void     resetExpired();
+};
+
+#endif  // SDCP_ROUTES_H
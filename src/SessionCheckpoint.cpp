@@ -0,0 +1,127 @@
+#include "SessionCheckpoint.h"
+
+#include <ArduinoJson.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <stddef.h>
+
+#include "Logger.h"
+#include "PrintSession.h"
+
+// Not touched by the startup code, so it still holds what the previous boot wrote. After power
+// on it's random, the magic and crc catch that.
+RTC_NOINIT_ATTR static session_checkpoint_t rtcCheckpoint;
+
+// Five 32 bit fields, the task id, then state and reserved
+static_assert(offsetof(session_checkpoint_t, crc) ==
+                  5 * sizeof(uint32_t) + SESSION_TASK_ID_SIZE + 4,
+              "session_checkpoint_t has padding the crc would cover");
+
+static uint32_t checkpointCrc(const session_checkpoint_t &checkpoint)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) &checkpoint,
+                            offsetof(session_checkpoint_t, crc));
+}
+
+static const char *resetReasonName(uint32_t reason)
+{
+    switch (reason)
+    {
+        case ESP_RST_POWERON:
+            return "power on";
+        case ESP_RST_EXT:
+            return "external";
+        case ESP_RST_SW:
+            return "software";
+        case ESP_RST_PANIC:
+            return "panic";
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return "watchdog";
+        case ESP_RST_DEEPSLEEP:
+            return "deep sleep";
+        case ESP_RST_BROWNOUT:
+            return "brownout";
+    }
+    return "unknown";
+}
+
+SessionCheckpoint &SessionCheckpoint::getInstance()
+{
+    static SessionCheckpoint instance;
+    return instance;
+}
+
+SessionCheckpoint::SessionCheckpoint()
+{
+    memset(&restored, 0, sizeof(restored));
+    hasRestored = false;
+    resetReason = 0;
+    saves       = 0;
+}
+
+void SessionCheckpoint::begin()
+{
+    // Left alone until the next save, so a reset loop before we reconnect doesn't lose it
+    resetReason = esp_reset_reason();
+    hasRestored = resetReason != ESP_RST_POWERON &&
+                  rtcCheckpoint.magic == SESSION_CHECKPOINT_MAGIC &&
+                  rtcCheckpoint.crc == checkpointCrc(rtcCheckpoint) &&
+                  rtcCheckpoint.state < SESSION_STATE_COUNT;
+    if (!hasRestored)
+    {
+        return;
+    }
+
+    restored                                     = rtcCheckpoint;
+    restored.taskId[sizeof(restored.taskId) - 1] = '\0';
+    logger.logf("Found session checkpoint after %s reset: %s, task %s",
+                resetReasonName(resetReason),
+                PrintSession::stateName((session_state_t) restored.state), restored.taskId);
+}
+
+bool SessionCheckpoint::getRestored(session_checkpoint_t &checkpoint)
+{
+    if (!hasRestored)
+    {
+        return false;
+    }
+    checkpoint = restored;
+    return true;
+}
+
+void SessionCheckpoint::discardRestored()
+{
+    hasRestored = false;
+}
+
+void SessionCheckpoint::save(session_checkpoint_t &checkpoint)
+{
+    checkpoint.magic = SESSION_CHECKPOINT_MAGIC;
+    memset(checkpoint.reserved, 0, sizeof(checkpoint.reserved));
+    checkpoint.crc = checkpointCrc(checkpoint);
+    rtcCheckpoint  = checkpoint;
+    saves++;
+}
+
+String SessionCheckpoint::toJson()
+{
+    DynamicJsonDocument doc(384);
+
+    doc["reset_reason"] = resetReasonName(resetReason);
+    doc["saves"]        = saves;
+    doc["restored"]     = hasRestored;
+    if (hasRestored)
+    {
+        doc["state"]           = PrintSession::stateName((session_state_t) restored.state);
+        doc["task_id"]         = (const char *) restored.taskId;
+        doc["current_ticks"]   = restored.currentTicks;
+        doc["total_ticks"]     = restored.totalTicks;
+        doc["movement_pulses"] = restored.movementPulses;
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
@@ -0,0 +1,61 @@
+#ifndef SESSION_CHECKPOINT_H
+#define SESSION_CHECKPOINT_H
+
+#include <Arduino.h>
+
+// Bump when session_checkpoint_t changes, older checkpoints are ignored
+#define SESSION_CHECKPOINT_MAGIC 0x53464332  // "SFC2"
+// SDCP task ids are UUIDs
+#define SESSION_TASK_ID_SIZE 40
+
+// What we need to pick up monitoring a print after a reset. Ordered so there is no padding, the
+// crc covers every byte before it and a struct copy needn't preserve padding.
+struct session_checkpoint_t
+{
+    uint32_t magic;
+    int32_t  currentTicks;
+    int32_t  totalTicks;
+    float    currentZ;
+    uint32_t movementPulses;
+    char     taskId[SESSION_TASK_ID_SIZE];
+    uint8_t  state;  // session_state_t
+    uint8_t  reserved[3];
+    uint32_t crc;  // Over everything above
+};
+
+// Keeps the print session in RTC slow memory, which survives watchdog, panic and brownout resets
+// (not power loss). Saving is a plain memory copy, cheap enough for every status frame.
+class SessionCheckpoint
+{
+   private:
+    session_checkpoint_t restored;
+    bool                 hasRestored;
+    uint32_t             resetReason;
+    uint32_t             saves;
+
+    SessionCheckpoint();
+
+    SessionCheckpoint(const SessionCheckpoint &)            = delete;
+    SessionCheckpoint &operator=(const SessionCheckpoint &) = delete;
+
+   public:
+    static SessionCheckpoint &getInstance();
+
+    // Picks up the checkpoint left by the previous boot, call early in setup() before anything
+    // saves a new one
+    void begin();
+
+    // The checkpoint from before the reset, false when there was none or it didn't validate
+    bool getRestored(session_checkpoint_t &checkpoint);
+    // Done with it, the print it describes is over or was resumed
+    void discardRestored();
+
+    // Fills in magic and crc
+    void save(session_checkpoint_t &checkpoint);
+
+    String toJson();
+};
+
+#define sessionCheckpoint SessionCheckpoint::getInstance()
+
+#endif  // SESSION_CHECKPOINT_H
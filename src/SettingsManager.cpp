@@ -3,10 +3,111 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <LittleFS.h>
+#include <Preferences.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "Logger.h"
 
+// Settings file used by older firmware, only read once to migrate into NVS. It's renamed after
+// that, a later problem with the NVS record must not bring back what it held.
+#define SETTINGS_FILE "/user_settings.json"
+#define SETTINGS_FILE_MIGRATED "/user_settings.json.migrated"
+
+// Settings live in NVS as a single binary record. The header lets us reject corrupt data and
+// tell records of a different format apart.
+#define SETTINGS_NVS_NAMESPACE "cc_sfs"
+#define SETTINGS_NVS_KEY "settings"
+#define SETTINGS_RECORD_MAGIC 0x5346  // "SF"
+#define SETTINGS_RECORD_VERSION 1
+// Upper bound for records written by newer firmware with more fields than we know about
+#define SETTINGS_RECORD_MAX_SIZE 512
+
+#define SETTING_DESCRIBE_BOOL(id, member, accessor, def, flags)                                  \
+    {#member, SETTING_TYPE_BOOL, flags, offsetof(user_settings, member), sizeof(bool), def, 0, 1, \
+     NULL},
+#define SETTING_DESCRIBE_INT(id, member, accessor, def, min, max, flags)                          \
+    {#member, SETTING_TYPE_INT, flags, offsetof(user_settings, member), sizeof(int32_t), def, min, \
+     max, NULL},
+#define SETTING_DESCRIBE_STRING(id, member, accessor, capacity, def, flags)                   \
+    {#member, SETTING_TYPE_STRING, flags, offsetof(user_settings, member), capacity, 0, 0, \
+     capacity - 1, def},
+
+const setting_descriptor_t SettingsManager::fields[SETTINGS_FIELD_COUNT] = {
+    SETTINGS_FIELDS(SETTING_DESCRIBE_BOOL, SETTING_DESCRIBE_INT, SETTING_DESCRIBE_STRING)};
+
+#define SETTING_SIZE_BOOL(...) +sizeof(bool)
+#define SETTING_SIZE_INT(...) +sizeof(int32_t)
+#define SETTING_SIZE_STRING(id, member, accessor, capacity, ...) +(capacity)
+
+// Every field packed back to back in schema order
+static const size_t SETTINGS_RECORD_BODY_SIZE =
+    0 SETTINGS_FIELDS(SETTING_SIZE_BOOL, SETTING_SIZE_INT, SETTING_SIZE_STRING);
+
+struct settings_record_header_t
+{
+    uint16_t magic;
+    uint16_t version;
+    uint16_t length;  // Size of the whole record, including this header
+    uint16_t reserved;
+    uint32_t crc;  // CRC32 of everything after the header
+};
+
+// Scoped hold on the settings mutex. It's recursive so setters can be wrapped in
+// beginUpdate()/endUpdate() by the web server task.
+class SettingsLock
+{
+   private:
+    SemaphoreHandle_t mutex;
+
+   public:
+    explicit SettingsLock(SemaphoreHandle_t m) : mutex(m)
+    {
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    }
+    ~SettingsLock()
+    {
+        xSemaphoreGiveRecursive(mutex);
+    }
+};
+
+static uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void *fieldPtr(user_settings &target, const setting_descriptor_t &field)
+{
+    return reinterpret_cast<uint8_t *>(&target) + field.offset;
+}
+
+static const void *fieldPtr(const user_settings &target, const setting_descriptor_t &field)
+{
+    return reinterpret_cast<const uint8_t *>(&target) + field.offset;
+}
+
+// strncpy zero fills the rest of the buffer, which keeps the memcmp in commit() and the CRC
+// stable
+static void copyString(char *dest, size_t size, const char *src)
+{
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+}
+
+static int32_t clampInt(const setting_descriptor_t &field, int32_t value)
+{
+    return value < field.min ? field.min : (value > field.max ? field.max : value);
+}
+
 SettingsManager &SettingsManager::getInstance()
 {
     static SettingsManager instance;
@@ -15,28 +116,185 @@ SettingsManager &SettingsManager::getInstance()
 
 SettingsManager::SettingsManager()
 {
-    isLoaded                     = false;
-    requestWifiReconnect         = false;
-    wifiChanged                  = false;
-    settings.ap_mode             = false;
-    settings.ssid                = "";
-    settings.passwd              = "";
-    settings.elegooip            = "";
-    settings.timeout             = 4000;
-    settings.first_layer_timeout = 8000;
-    settings.pause_on_runout     = true;
-    settings.start_print_timeout = 10000;
-    settings.enabled             = true;
-    settings.has_connected       = false;
+    isLoaded             = false;
+    requestWifiReconnect = false;
+    wifiChanged          = false;
+    mutex                = xSemaphoreCreateRecursiveMutex();
+    saveRequested        = false;
+    lastChangeTime       = 0;
+    pendingChanges       = 0;
+    generation           = 0;
+    observerCount        = 0;
+    setDefaults(settings);
 }
 
-bool SettingsManager::load()
+void SettingsManager::setDefaults(user_settings &target)
+{
+    memset(&target, 0, sizeof(target));
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        const setting_descriptor_t &field = fields[i];
+        void                       *ptr   = fieldPtr(target, field);
+        switch (field.type)
+        {
+            case SETTING_TYPE_BOOL:
+                *static_cast<bool *>(ptr) = field.defaultValue != 0;
+                break;
+            case SETTING_TYPE_INT:
+                *static_cast<int32_t *>(ptr) = field.defaultValue;
+                break;
+            case SETTING_TYPE_STRING:
+                copyString(static_cast<char *>(ptr), field.size, field.defaultString);
+                break;
+        }
+    }
+}
+
+// Replaces the live settings with updated, recording which fields actually changed. Callers
+// hold the lock.
+void SettingsManager::commit(const user_settings &updated)
+{
+    uint32_t changed = 0;
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        const setting_descriptor_t &field = fields[i];
+        if (memcmp(fieldPtr(settings, field), fieldPtr(updated, field), field.size) != 0)
+        {
+            changed |= 1 << i;
+            if (field.flags & SETTING_FLAG_WIFI)
+            {
+                wifiChanged = true;
+            }
+        }
+    }
+
+    if (changed)
+    {
+        settings = updated;
+        pendingChanges |= changed;
+    }
+}
+
+size_t SettingsManager::encodeRecord(uint8_t *record)
+{
+    settings_record_header_t header;
+    uint8_t                 *body = record + sizeof(header);
+    size_t                   pos  = 0;
+
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        memcpy(body + pos, fieldPtr(settings, fields[i]), fields[i].size);
+        pos += fields[i].size;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic   = SETTINGS_RECORD_MAGIC;
+    header.version = SETTINGS_RECORD_VERSION;
+    header.length  = sizeof(header) + pos;
+    header.crc     = crc32(body, pos);
+    memcpy(record, &header, sizeof(header));
+    return header.length;
+}
+
+settings_record_status_t SettingsManager::readRecord()
 {
-    File file = LittleFS.open("/user_settings.json", "r");
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NVS_NAMESPACE, true))
+    {
+        // Namespace doesn't exist until the first write
+        return SETTINGS_RECORD_MISSING;
+    }
+
+    uint8_t                  record[SETTINGS_RECORD_MAX_SIZE];
+    settings_record_header_t header;
+    size_t                   length = prefs.getBytesLength(SETTINGS_NVS_KEY);
+    if (length == 0)
+    {
+        prefs.end();
+        return SETTINGS_RECORD_MISSING;
+    }
+    if (length < sizeof(header) || length > sizeof(record))
+    {
+        prefs.end();
+        logger.log("Stored settings record has an invalid size");
+        return SETTINGS_RECORD_CORRUPT;
+    }
+
+    prefs.getBytes(SETTINGS_NVS_KEY, record, length);
+    prefs.end();
+
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *body       = record + sizeof(header);
+    size_t         bodyLength = length - sizeof(header);
+    if (header.magic != SETTINGS_RECORD_MAGIC || header.length != length ||
+        header.crc != crc32(body, bodyLength))
+    {
+        logger.log("Stored settings record is corrupt");
+        return SETTINGS_RECORD_CORRUPT;
+    }
+
+    if (header.version != SETTINGS_RECORD_VERSION)
+    {
+        logger.logf("Unsupported settings record version %d", header.version);
+        return SETTINGS_RECORD_CORRUPT;
+    }
+
+    user_settings loaded;
+    setDefaults(loaded);
+
+    // Fields are only ever appended, so a shorter record from older firmware simply leaves the
+    // newer fields at their defaults and a longer one has a tail we don't know about
+    size_t pos = 0;
+    for (int i = 0; i < SETTINGS_FIELD_COUNT && pos + fields[i].size <= bodyLength; i++)
+    {
+        memcpy(fieldPtr(loaded, fields[i]), body + pos, fields[i].size);
+        pos += fields[i].size;
+    }
+
+    // Never trust what came out of flash, terminate strings and clamp ranges
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        const setting_descriptor_t &field = fields[i];
+        void                       *ptr   = fieldPtr(loaded, field);
+        if (field.type == SETTING_TYPE_STRING)
+        {
+            static_cast<char *>(ptr)[field.size - 1] = '\0';
+        }
+        else if (field.type == SETTING_TYPE_INT)
+        {
+            *static_cast<int32_t *>(ptr) = clampInt(field, *static_cast<int32_t *>(ptr));
+        }
+    }
+
+    settings = loaded;
+    return SETTINGS_RECORD_LOADED;
+}
+
+bool SettingsManager::writeRecord(const uint8_t *record, size_t length)
+{
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NVS_NAMESPACE, false))
+    {
+        logger.log("Failed to open settings storage for writing");
+        return false;
+    }
+
+    size_t written = prefs.putBytes(SETTINGS_NVS_KEY, record, length);
+    prefs.end();
+
+    if (written != length)
+    {
+        logger.log("Failed to write settings to storage");
+        return false;
+    }
+    return true;
+}
+
+bool SettingsManager::readLegacyJson()
+{
+    File file = LittleFS.open(SETTINGS_FILE, "r");
     if (!file)
     {
-        logger.log("Settings file not found, using defaults");
-        isLoaded = true;
         return false;
     }
 
@@ -46,214 +304,348 @@ bool SettingsManager::load()
 
     if (error)
     {
-        logger.log("Settings JSON parsing error, using defaults");
-        isLoaded = true;
+        logger.log("Settings JSON parsing error");
         return false;
     }
 
-    settings.ap_mode             = doc["ap_mode"] | false;
-    settings.ssid                = doc["ssid"] | "";
-    settings.passwd              = doc["passwd"] | "";
-    settings.elegooip            = doc["elegooip"] | "";
-    settings.timeout             = doc["timeout"] | 4000;
-    settings.first_layer_timeout = doc["first_layer_timeout"] | 8000;
-    settings.pause_on_runout     = doc["pause_on_runout"] | true;
-    settings.enabled             = doc["enabled"] | true;
-    settings.start_print_timeout = doc["start_print_timeout"] | 10000;
-    settings.has_connected       = doc["has_connected"] | false;
+    user_settings loaded;
+    setDefaults(loaded);
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        const setting_descriptor_t &field = fields[i];
+        JsonVariant                 value = doc[field.key];
+        void                       *ptr   = fieldPtr(loaded, field);
+        switch (field.type)
+        {
+            case SETTING_TYPE_BOOL:
+                *static_cast<bool *>(ptr) = value | (field.defaultValue != 0);
+                break;
+            case SETTING_TYPE_INT:
+                *static_cast<int32_t *>(ptr) = clampInt(field, value | field.defaultValue);
+                break;
+            case SETTING_TYPE_STRING:
+                copyString(static_cast<char *>(ptr), field.size, value | field.defaultString);
+                break;
+        }
+    }
 
-    isLoaded = true;
+    settings = loaded;
     return true;
 }
 
-bool SettingsManager::save(bool skipWifiCheck)
+void SettingsManager::retireLegacyJson()
+{
+    if (!LittleFS.exists(SETTINGS_FILE))
+    {
+        return;
+    }
+    LittleFS.remove(SETTINGS_FILE_MIGRATED);
+    if (!LittleFS.rename(SETTINGS_FILE, SETTINGS_FILE_MIGRATED))
+    {
+        logger.log("Failed to rename the migrated settings file, removing it");
+        LittleFS.remove(SETTINGS_FILE);
+    }
+}
+
+bool SettingsManager::load()
 {
-    String output = toJson(true);
+    SettingsLock lock(mutex);
+    isLoaded = true;
 
-    File file = LittleFS.open("/user_settings.json", "w");
-    if (!file)
+    settings_record_status_t status = readRecord();
+    if (status == SETTINGS_RECORD_LOADED)
+    {
+        return true;
+    }
+    if (status == SETTINGS_RECORD_CORRUPT)
     {
-        logger.log("Failed to open settings file for writing");
+        // settings still holds the defaults from the constructor
+        logger.log("Using default settings");
         return false;
     }
 
-    if (file.print(output) == 0)
+    // Nothing in NVS, this is either the first boot after upgrading from a JSON based firmware or
+    // a fresh flash. Import the JSON file once so the next boot is a plain NVS read. That's the
+    // only time the boot path needs LittleFS, otherwise the web server mounts it later.
+    LittleFS.begin();
+    if (!readLegacyJson())
     {
-        logger.log("Failed to write settings to file");
-        file.close();
+        logger.log("No stored settings found, using defaults");
         return false;
     }
 
-    file.close();
-    logger.log("Settings saved successfully");
-    if (!skipWifiCheck && wifiChanged)
+    uint8_t record[sizeof(settings_record_header_t) + SETTINGS_RECORD_BODY_SIZE];
+    if (writeRecord(record, encodeRecord(record)))
     {
-        logger.log("WiFi changed, requesting reconnection");
-        requestWifiReconnect = true;
-        wifiChanged          = false;
+        logger.log("Migrated settings from JSON file to NVS");
+        retireLegacyJson();
     }
     return true;
 }
 
-const user_settings &SettingsManager::getSettings()
+bool SettingsManager::save(bool skipWifiCheck)
 {
-    if (!isLoaded)
+    uint8_t record[sizeof(settings_record_header_t) + SETTINGS_RECORD_BODY_SIZE];
+    size_t  length;
+    bool    shouldReconnect = false;
     {
-        load();
+        SettingsLock lock(mutex);
+        // Clear before copying, anything changed while we write will schedule another save
+        saveRequested = false;
+        length        = encodeRecord(record);
+        // When skipping the check the caller applies the WiFi change itself
+        if (wifiChanged)
+        {
+            shouldReconnect = !skipWifiCheck;
+            wifiChanged     = false;
+        }
     }
-    return settings;
-}
 
-String SettingsManager::getSSID()
-{
-    return getSettings().ssid;
-}
+    if (!writeRecord(record, length))
+    {
+        return false;
+    }
 
-String SettingsManager::getPassword()
-{
-    return getSettings().passwd;
+    logger.log("Settings saved successfully");
+    if (shouldReconnect)
+    {
+        logger.log("WiFi changed, requesting reconnection");
+        requestWifiReconnect = true;
+    }
+    return true;
 }
 
-bool SettingsManager::isAPMode()
+void SettingsManager::requestSave()
 {
-    return getSettings().ap_mode;
+    SettingsLock lock(mutex);
+    lastChangeTime = millis();
+    saveRequested  = true;
+    // WiFi changes take effect right away, only the flash write is deferred
+    if (wifiChanged)
+    {
+        logger.log("WiFi changed, requesting reconnection");
+        requestWifiReconnect = true;
+        wifiChanged          = false;
+    }
 }
 
-String SettingsManager::getElegooIP()
+void SettingsManager::loop()
 {
-    return getSettings().elegooip;
-}
+    notifyObservers();
 
-int SettingsManager::getTimeout()
-{
-    return getSettings().timeout;
+    if (saveRequested && millis() - lastChangeTime >= SETTINGS_SAVE_DELAY_MS)
+    {
+        if (!save(true))
+        {
+            // Try again after another quiet period rather than hammering flash
+            lastChangeTime = millis();
+            saveRequested  = true;
+        }
+    }
 }
 
-int SettingsManager::getFirstLayerTimeout()
+void SettingsManager::notifyObservers()
 {
-    return getSettings().first_layer_timeout;
-}
+    // Cheap unlocked check first, this runs on every loop iteration
+    if (pendingChanges == 0)
+    {
+        return;
+    }
 
-bool SettingsManager::getPauseOnRunout()
-{
-    return getSettings().pause_on_runout;
-}
+    uint32_t changed;
+    {
+        // Waits out any update in progress on another task so observers see all of it
+        SettingsLock lock(mutex);
+        changed        = pendingChanges;
+        pendingChanges = 0;
+        generation++;
+    }
 
-int SettingsManager::getStartPrintTimeout()
-{
-    return getSettings().start_print_timeout;
+    for (int i = 0; i < observerCount; i++)
+    {
+        if (observers[i].fields & changed)
+        {
+            observers[i].callback(changed);
+        }
+    }
 }
 
-bool SettingsManager::getEnabled()
+bool SettingsManager::addObserver(uint32_t fields, SettingsObserver callback)
 {
-    return getSettings().enabled;
+    if (observerCount >= MAX_SETTINGS_OBSERVERS)
+    {
+        logger.log("Too many settings observers");
+        return false;
+    }
+    observers[observerCount].fields   = fields;
+    observers[observerCount].callback = callback;
+    observerCount++;
+    return true;
 }
 
-bool SettingsManager::getHasConnected()
+uint32_t SettingsManager::getGeneration()
 {
-    return getSettings().has_connected;
+    return generation;
 }
 
-void SettingsManager::setSSID(const String &ssid)
+void SettingsManager::beginUpdate()
 {
-    if (!isLoaded)
-        load();
-    if (settings.ssid != ssid)
-    {
-        settings.ssid = ssid;
-        wifiChanged   = true;
-    }
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
 }
 
-void SettingsManager::setPassword(const String &password)
+void SettingsManager::endUpdate()
 {
-    if (!isLoaded)
-        load();
-    if (settings.passwd != password)
-    {
-        settings.passwd = password;
-        wifiChanged     = true;
-    }
+    requestSave();
+    xSemaphoreGiveRecursive(mutex);
 }
 
-void SettingsManager::setAPMode(bool apMode)
+const user_settings &SettingsManager::getSettings()
 {
+    SettingsLock lock(mutex);
     if (!isLoaded)
-        load();
-    if (settings.ap_mode != apMode)
     {
-        settings.ap_mode = apMode;
-        wifiChanged      = true;
+        load();
     }
+    return settings;
 }
 
-void SettingsManager::setElegooIP(const String &ip)
+bool SettingsManager::getBool(settings_field_index_t index)
 {
-    if (!isLoaded)
-        load();
-    settings.elegooip = ip;
+    return *static_cast<const bool *>(fieldPtr(getSettings(), fields[index]));
 }
 
-void SettingsManager::setTimeout(int timeout)
+int SettingsManager::getInt(settings_field_index_t index)
 {
-    if (!isLoaded)
-        load();
-    settings.timeout = timeout;
+    return *static_cast<const int32_t *>(fieldPtr(getSettings(), fields[index]));
 }
 
-void SettingsManager::setFirstLayerTimeout(int timeout)
+String SettingsManager::getString(settings_field_index_t index)
 {
-    if (!isLoaded)
-        load();
-    settings.first_layer_timeout = timeout;
+    SettingsLock lock(mutex);
+    return String(static_cast<const char *>(fieldPtr(getSettings(), fields[index])));
 }
 
-void SettingsManager::setPauseOnRunout(bool pauseOnRunout)
+void SettingsManager::setBool(settings_field_index_t index, bool value)
 {
-    if (!isLoaded)
-        load();
-    settings.pause_on_runout = pauseOnRunout;
+    SettingsLock  lock(mutex);
+    user_settings updated = getSettings();
+    *static_cast<bool *>(fieldPtr(updated, fields[index])) = value;
+    commit(updated);
 }
 
-void SettingsManager::setStartPrintTimeout(int timeoutMs)
+void SettingsManager::setInt(settings_field_index_t index, int value)
 {
-    if (!isLoaded)
-        load();
-    settings.start_print_timeout = timeoutMs;
+    SettingsLock  lock(mutex);
+    user_settings updated = getSettings();
+    *static_cast<int32_t *>(fieldPtr(updated, fields[index])) = clampInt(fields[index], value);
+    commit(updated);
 }
 
-void SettingsManager::setEnabled(bool enabled)
+void SettingsManager::setString(settings_field_index_t index, const String &value)
 {
-    if (!isLoaded)
-        load();
-    settings.enabled = enabled;
+    const setting_descriptor_t &field = fields[index];
+    if (value.length() >= field.size)
+    {
+        logger.logf("Setting %s is too long, truncating", field.key);
+    }
+
+    SettingsLock  lock(mutex);
+    user_settings updated = getSettings();
+    copyString(static_cast<char *>(fieldPtr(updated, field)), field.size, value.c_str());
+    commit(updated);
 }
 
-void SettingsManager::setHasConnected(bool hasConnected)
+bool SettingsManager::updateFromJson(JsonObject json, String &error)
 {
-    if (!isLoaded)
-        load();
-    settings.has_connected = hasConnected;
+    SettingsLock  lock(mutex);
+    user_settings updated = getSettings();
+
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
+    {
+        const setting_descriptor_t &field = fields[i];
+        JsonVariant                 value = json[field.key];
+        if ((field.flags & SETTING_FLAG_INTERNAL) || value.isNull())
+        {
+            // Missing keys keep their current value
+            continue;
+        }
+
+        void *ptr = fieldPtr(updated, field);
+        switch (field.type)
+        {
+            case SETTING_TYPE_BOOL:
+                if (!value.is<bool>())
+                {
+                    error = String(field.key) + " must be a boolean";
+                    return false;
+                }
+                *static_cast<bool *>(ptr) = value.as<bool>();
+                break;
+            case SETTING_TYPE_INT:
+                if (!value.is<long>())
+                {
+                    error = String(field.key) + " must be an integer";
+                    return false;
+                }
+                *static_cast<int32_t *>(ptr) = clampInt(field, value.as<long>());
+                break;
+            case SETTING_TYPE_STRING:
+            {
+                if (!value.is<const char *>())
+                {
+                    error = String(field.key) + " must be a string";
+                    return false;
+                }
+                const char *str = value.as<const char *>();
+                if ((field.flags & SETTING_FLAG_SECRET) && str[0] == '\0')
+                {
+                    // The web UI never sees secrets, so an empty one means "unchanged"
+                    break;
+                }
+                if (strlen(str) >= field.size)
+                {
+                    error = String(field.key) + " is too long";
+                    return false;
+                }
+                copyString(static_cast<char *>(ptr), field.size, str);
+                break;
+            }
+        }
+    }
+
+    commit(updated);
+    requestSave();
+    return true;
 }
 
 String SettingsManager::toJson(bool includePassword)
 {
+    SettingsLock             lock(mutex);
     String                   output;
     StaticJsonDocument<1024> doc;
 
-    doc["ap_mode"]             = settings.ap_mode;
-    doc["ssid"]                = settings.ssid;
-    doc["elegooip"]            = settings.elegooip;
-    doc["timeout"]             = settings.timeout;
-    doc["first_layer_timeout"] = settings.first_layer_timeout;
-    doc["pause_on_runout"]     = settings.pause_on_runout;
-    doc["start_print_timeout"] = settings.start_print_timeout;
-    doc["enabled"]             = settings.enabled;
-    doc["has_connected"]       = settings.has_connected;
-
-    if (includePassword)
+    for (int i = 0; i < SETTINGS_FIELD_COUNT; i++)
     {
-        doc["passwd"] = settings.passwd;
+        const setting_descriptor_t &field = fields[i];
+        const void                 *ptr   = fieldPtr(settings, field);
+        if ((field.flags & SETTING_FLAG_SECRET) && !includePassword)
+        {
+            continue;
+        }
+
+        switch (field.type)
+        {
+            case SETTING_TYPE_BOOL:
+                doc[field.key] = *static_cast<const bool *>(ptr);
+                break;
+            case SETTING_TYPE_INT:
+                doc[field.key] = *static_cast<const int32_t *>(ptr);
+                break;
+            case SETTING_TYPE_STRING:
+                // Stored by pointer, fine since we serialize before releasing the lock
+                doc[field.key] = static_cast<const char *>(ptr);
+                break;
+        }
     }
 
     serializeJson(doc, output);
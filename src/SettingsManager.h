@@ -1,23 +1,144 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <functional>
 
 #ifndef SETTINGS_DATA_H
 #define SETTINGS_DATA_H
 
+// Quiet period after the last change before settings are written to flash, so bursts of
+// updates from the web UI coalesce into a single write
+#define SETTINGS_SAVE_DELAY_MS 2000
+
+// Maximum number of subsystems that can subscribe to settings changes
+#define MAX_SETTINGS_OBSERVERS 8
+
+// Field flags
+#define SETTING_FLAG_WIFI 0x01      // Changing it requires a WiFi reconnect
+#define SETTING_FLAG_SECRET 0x02    // Never sent to the web UI, an empty update keeps the old value
+#define SETTING_FLAG_INTERNAL 0x04  // Maintained by the firmware, not writable over HTTP
+
+// The settings schema. Everything else (the struct, defaults, accessors, NVS record, JSON and the
+// HTTP update handler) is generated from this list, so adding a setting is one line here.
+// Only ever append to the list, the NVS record relies on existing fields keeping their position.
+//
+//   BOOL(id, member, accessor, default, flags)
+//   INT(id, member, accessor, default, min, max, flags)
+//   STRING(id, member, accessor, capacity incl. terminator, default, flags)
+#define SETTINGS_FIELDS(BOOL, INT, STRING)                                                     \
+    STRING(SETTING_SSID, ssid, SSID, 33, "", SETTING_FLAG_WIFI)                                \
+    STRING(SETTING_PASSWD, passwd, Password, 65, "", SETTING_FLAG_WIFI | SETTING_FLAG_SECRET)  \
+    BOOL(SETTING_AP_MODE, ap_mode, APMode, false, SETTING_FLAG_WIFI)                           \
+    STRING(SETTING_ELEGOOIP, elegooip, ElegooIP, 64, "", 0)                                    \
+    INT(SETTING_TIMEOUT, timeout, Timeout, 4000, 100, 60000, 0)                                \
+    INT(SETTING_FIRST_LAYER_TIMEOUT, first_layer_timeout, FirstLayerTimeout, 8000, 100, 60000, \
+        0)                                                                                     \
+    BOOL(SETTING_PAUSE_ON_RUNOUT, pause_on_runout, PauseOnRunout, true, 0)                     \
+    INT(SETTING_START_PRINT_TIMEOUT, start_print_timeout, StartPrintTimeout, 10000, 0, 600000, \
+        0)                                                                                     \
+    BOOL(SETTING_ENABLED, enabled, Enabled, true, 0)                                           \
+    BOOL(SETTING_HAS_CONNECTED, has_connected, HasConnected, false, SETTING_FLAG_INTERNAL)     \
+    STRING(SETTING_STATIC_IP, static_ip, StaticIP, 16, "", SETTING_FLAG_WIFI)                  \
+    STRING(SETTING_GATEWAY, gateway, Gateway, 16, "", SETTING_FLAG_WIFI)                       \
+    STRING(SETTING_SUBNET, subnet, Subnet, 16, "", SETTING_FLAG_WIFI)                          \
+    STRING(SETTING_DNS, dns, DNS, 16, "", SETTING_FLAG_WIFI)                                   \
+    INT(SETTING_LOOP_ALARM, loop_alarm_ms, LoopAlarm, 250, 0, 60000, 0)                        \
+    BOOL(SETTING_STOP_FEEDING_FALLBACK, stop_feeding_fallback, StopFeedingFallback, false, 0)  \
+    BOOL(SETTING_PROXY_ENABLED, proxy_enabled, ProxyEnabled, false, 0)                         \
+    STRING(SETTING_API_PASSWORD, api_password, APIPassword, 65, "", SETTING_FLAG_SECRET)
+
+#define SETTING_INDEX_BOOL(id, ...) id##_INDEX,
+#define SETTING_INDEX_INT(id, ...) id##_INDEX,
+#define SETTING_INDEX_STRING(id, ...) id##_INDEX,
+
+// Position of each setting in the schema
+typedef enum
+{
+    SETTINGS_FIELDS(SETTING_INDEX_BOOL, SETTING_INDEX_INT, SETTING_INDEX_STRING)
+        SETTINGS_FIELD_COUNT
+} settings_field_index_t;
+
+#define SETTING_BIT_BOOL(id, ...) id = 1 << id##_INDEX,
+#define SETTING_BIT_INT(id, ...) id = 1 << id##_INDEX,
+#define SETTING_BIT_STRING(id, ...) id = 1 << id##_INDEX,
+
+// Bits identifying individual settings in change notifications
+typedef enum
+{
+    SETTINGS_FIELDS(SETTING_BIT_BOOL, SETTING_BIT_INT, SETTING_BIT_STRING)
+} settings_field_t;
+
+#define SETTING_MEMBER_BOOL(id, member, ...) bool member;
+#define SETTING_MEMBER_INT(id, member, ...) int32_t member;
+#define SETTING_MEMBER_STRING(id, member, accessor, capacity, ...) char member[capacity];
+
 struct user_settings
 {
-    String ssid;
-    String passwd;
-    bool   ap_mode;
-    String elegooip;
-    int    timeout;
-    int    first_layer_timeout;
-    bool   pause_on_runout;
-    int    start_print_timeout;
-    bool   enabled;
-    bool   has_connected;
+    SETTINGS_FIELDS(SETTING_MEMBER_BOOL, SETTING_MEMBER_INT, SETTING_MEMBER_STRING)
 };
 
+typedef enum
+{
+    SETTING_TYPE_BOOL,
+    SETTING_TYPE_INT,
+    SETTING_TYPE_STRING,
+} setting_type_t;
+
+// What SettingsManager found in NVS at boot
+typedef enum
+{
+    SETTINGS_RECORD_LOADED,
+    SETTINGS_RECORD_MISSING,  // Never written, older firmware may have left a JSON file
+    SETTINGS_RECORD_CORRUPT,  // Written but unreadable, any JSON file is older than what was lost
+} settings_record_status_t;
+
+// One row of the static schema table, see SETTINGS_FIELDS
+struct setting_descriptor_t
+{
+    const char    *key;     // JSON key
+    setting_type_t type;
+    uint8_t        flags;
+    uint16_t       offset;  // Offset of the member in user_settings
+    uint16_t       size;    // Size of the member, including the terminator for strings
+    int32_t        defaultValue;
+    int32_t        min;
+    int32_t        max;
+    const char    *defaultString;
+};
+
+// Called from the main loop with the bitmask of settings_field_t that changed
+typedef std::function<void(uint32_t changedFields)> SettingsObserver;
+
+#define SETTING_ACCESSORS_BOOL(id, member, accessor, ...) \
+    bool get##accessor()                                  \
+    {                                                     \
+        return getBool(id##_INDEX);                       \
+    }                                                     \
+    void set##accessor(bool value)                        \
+    {                                                     \
+        setBool(id##_INDEX, value);                       \
+    }
+#define SETTING_ACCESSORS_INT(id, member, accessor, ...) \
+    int get##accessor()                                  \
+    {                                                    \
+        return getInt(id##_INDEX);                       \
+    }                                                    \
+    void set##accessor(int value)                        \
+    {                                                    \
+        setInt(id##_INDEX, value);                       \
+    }
+#define SETTING_ACCESSORS_STRING(id, member, accessor, ...) \
+    String get##accessor()                                  \
+    {                                                       \
+        return getString(id##_INDEX);                       \
+    }                                                       \
+    void set##accessor(const String &value)                 \
+    {                                                       \
+        setString(id##_INDEX, value);                       \
+    }
+
 class SettingsManager
 {
    private:
@@ -25,48 +146,87 @@ class SettingsManager
     bool          isLoaded;
     bool          wifiChanged;
 
+    // Deferred persistence state, see requestSave()/loop()
+    SemaphoreHandle_t      mutex;
+    volatile bool          saveRequested;
+    volatile unsigned long lastChangeTime;
+
+    // Change notification state, see addObserver()
+    struct settings_observer_t
+    {
+        uint32_t         fields;
+        SettingsObserver callback;
+    };
+    settings_observer_t observers[MAX_SETTINGS_OBSERVERS];
+    int                 observerCount;
+    volatile uint32_t   pendingChanges;
+    volatile uint32_t   generation;
+
     SettingsManager();
 
+    void setDefaults(user_settings &target);
+    void commit(const user_settings &updated);
+    settings_record_status_t readRecord();
+    bool writeRecord(const uint8_t *record, size_t length);
+    size_t encodeRecord(uint8_t *record);
+    bool readLegacyJson();
+    void notifyObservers();
+
+    bool   getBool(settings_field_index_t index);
+    int    getInt(settings_field_index_t index);
+    String getString(settings_field_index_t index);
+    void   setBool(settings_field_index_t index, bool value);
+    void   setInt(settings_field_index_t index, int value);
+    void   setString(settings_field_index_t index, const String &value);
+
     SettingsManager(const SettingsManager &)            = delete;
     SettingsManager &operator=(const SettingsManager &) = delete;
 
    public:
     static SettingsManager &getInstance();
 
+    // The schema table, one entry per SETTINGS_FIELDS row in the same order
+    static const setting_descriptor_t fields[SETTINGS_FIELD_COUNT];
+
     // Flag to request WiFi reconnection with new credentials
     bool requestWifiReconnect;
 
     bool load();
+    // Renames the JSON file of older firmware out of the way once it's in NVS. LittleFS isn't
+    // mounted at boot when NVS has the settings, so this is called once it is.
+    void retireLegacyJson();
+    // Writes settings to NVS immediately, only use this when the caller can't wait for loop()
     bool save(bool skipWifiCheck = false);
+    // Marks settings dirty, the actual write happens in loop() once changes have settled
+    void requestSave();
+    // Delivers change notifications and flushes pending settings to NVS, call from the main loop
+    void loop();
+
+    // Subscribe to changes of the given settings_field_t bits. Callbacks always run on the main
+    // loop, after a whole update has been applied, so observers can cache plain values instead
+    // of polling the getters.
+    bool addObserver(uint32_t fields, SettingsObserver callback);
+    // Incremented every time a batch of changes is published to observers
+    uint32_t getGeneration();
+
+    // Hold the settings lock across several setters so other tasks never observe a
+    // half-applied update. endUpdate() schedules a deferred save.
+    void beginUpdate();
+    void endUpdate();
 
     //  (loads if not already loaded)
     const user_settings &getSettings();
 
-    String getSSID();
-    String getPassword();
-    bool   isAPMode();
-    String getElegooIP();
-    int    getTimeout();
-    int    getFirstLayerTimeout();
-    bool   getPauseOnRunout();
-    int    getStartPrintTimeout();
-    bool   getEnabled();
-    bool   getHasConnected();
-
-    void setSSID(const String &ssid);
-    void setPassword(const String &password);
-    void setAPMode(bool apMode);
-    void setElegooIP(const String &ip);
-    void setTimeout(int timeout);
-    void setFirstLayerTimeout(int timeout);
-    void setPauseOnRunout(bool pauseOnRunout);
-    void setStartPrintTimeout(int timeoutMs);
-    void setEnabled(bool enabled);
-    void setHasConnected(bool hasConnected);
+    // getSSID()/setSSID(), getTimeout()/setTimeout() etc, one pair per schema field
+    SETTINGS_FIELDS(SETTING_ACCESSORS_BOOL, SETTING_ACCESSORS_INT, SETTING_ACCESSORS_STRING)
+
+    // Applies the keys present in json, validating every field first so a bad request changes
+    // nothing. Integers are clamped to their range. On failure error names the offending key.
+    bool updateFromJson(JsonObject json, String &error);
 
     String toJson(bool includePassword = true);
 };
 
 #define settingsManager SettingsManager::getInstance()
 
-#endif
\ No newline at end of file
+#endif
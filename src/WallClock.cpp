@@ -0,0 +1,120 @@
+#include "WallClock.h"
+
+#include <esp_timer.h>
+#include <stdlib.h>
+
+#include "Logger.h"
+
+WallClock &WallClock::getInstance()
+{
+    static WallClock instance;
+    return instance;
+}
+
+WallClock::WallClock()
+{
+    lock                  = portMUX_INITIALIZER_UNLOCKED;
+    source                = CLOCK_SOURCE_NONE;
+    anchorEpochMicros     = 0;
+    anchorMonotonicMicros = 0;
+    driftPpb              = 0;
+}
+
+// Caller holds the lock
+int64_t WallClock::epochMicrosAt(int64_t monotonicMicros)
+{
+    int64_t elapsed = monotonicMicros - anchorMonotonicMicros;
+    return anchorEpochMicros + elapsed + elapsed * driftPpb / 1000000000LL;
+}
+
+// Caller holds the lock
+void WallClock::anchor(clock_source_t newSource, int64_t epochMicros, int64_t monotonicMicros)
+{
+    source                = newSource;
+    anchorEpochMicros     = epochMicros;
+    anchorMonotonicMicros = monotonicMicros;
+}
+
+unsigned long WallClock::now()
+{
+    return nowMicros() / 1000000;
+}
+
+int64_t WallClock::nowMicros()
+{
+    int64_t monotonic = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    int64_t epoch = epochMicrosAt(monotonic);
+    portEXIT_CRITICAL(&lock);
+    return epoch;
+}
+
+void WallClock::setFromNtp(const struct timeval &tv)
+{
+    int64_t monotonic = esp_timer_get_time();
+    int64_t sample    = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+    portENTER_CRITICAL(&lock);
+    int64_t error    = sample - epochMicrosAt(monotonic);
+    int64_t interval = monotonic - anchorMonotonicMicros;
+    bool    step     = llabs(error) > CLOCK_NTP_STEP_S * 1000000LL;
+    // Whatever error built up since the last NTP sync is drift we didn't correct for yet. Only
+    // take half of it, a single late NTP reply shouldn't throw the estimate off. Small errors
+    // only, that also keeps error * 1e9 well inside int64.
+    if (source == CLOCK_SOURCE_NTP && !step && interval >= CLOCK_DRIFT_MIN_INTERVAL_S * 1000000LL)
+    {
+        int64_t drift = driftPpb + error * 1000000000LL / interval / 2;
+        driftPpb      = constrain(drift, -CLOCK_MAX_DRIFT_PPB, CLOCK_MAX_DRIFT_PPB);
+    }
+    bool stepped = step && source == CLOCK_SOURCE_NTP;
+    anchor(CLOCK_SOURCE_NTP, sample, monotonic);
+    portEXIT_CRITICAL(&lock);
+
+    if (stepped)
+    {
+        logger.logf("Clock stepped by %lld ms, drift estimate kept", (long long) (error / 1000));
+    }
+}
+
+void WallClock::setFromPrinter(unsigned long timestamp)
+{
+    if (timestamp == 0 || source == CLOCK_SOURCE_NTP)
+    {
+        return;
+    }
+
+    int64_t monotonic = esp_timer_get_time();
+    int64_t sample    = (int64_t) timestamp * 1000000;
+    bool    first     = source == CLOCK_SOURCE_NONE;
+
+    portENTER_CRITICAL(&lock);
+    // Source is checked again, NTP may have come in since the check above
+    int64_t error = sample - epochMicrosAt(monotonic);
+    bool    apply = source == CLOCK_SOURCE_NONE || (source == CLOCK_SOURCE_PRINTER &&
+                                                  llabs(error) >= CLOCK_PRINTER_STEP_S * 1000000LL);
+    if (apply)
+    {
+        anchor(CLOCK_SOURCE_PRINTER, sample, monotonic);
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (first && apply)
+    {
+        logger.log("Clock set from printer time");
+    }
+}
+
+bool WallClock::isSynced()
+{
+    return source != CLOCK_SOURCE_NONE;
+}
+
+clock_source_t WallClock::getSource()
+{
+    return source;
+}
+
+int32_t WallClock::getDriftPpb()
+{
+    return driftPpb;
+}
@@ -0,0 +1,64 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+// Printer timestamps only have whole seconds, smaller differences are rounding noise
+#define CLOCK_PRINTER_STEP_S 2
+// Minimum time between two NTP samples for them to be used for drift estimation
+#define CLOCK_DRIFT_MIN_INTERVAL_S 600
+// Limit for the drift correction, far beyond anything a working crystal does
+#define CLOCK_MAX_DRIFT_PPB 500000
+// An NTP sample further off than this is a step of the time itself (first sync, server change),
+// not drift. The clock is set to it, the drift estimate stays.
+#define CLOCK_NTP_STEP_S 5
+
+// Where the current anchor came from, better sources replace worse ones
+typedef enum
+{
+    CLOCK_SOURCE_NONE,
+    CLOCK_SOURCE_PRINTER,  // TimeStamp of an SDCP status frame
+    CLOCK_SOURCE_NTP,
+} clock_source_t;
+
+// Wall-clock time derived from the monotonic microsecond timer. Epoch time is anchored once,
+// from NTP or from the printer, and corrected for drift whenever NTP re-syncs, so reading the
+// time is just a timer read and a multiply.
+class WallClock
+{
+   private:
+    portMUX_TYPE   lock;
+    clock_source_t source;
+    int64_t        anchorEpochMicros;
+    int64_t        anchorMonotonicMicros;
+    int32_t        driftPpb;  // How much faster than our timer real time runs
+
+    WallClock();
+
+    WallClock(const WallClock &)            = delete;
+    WallClock &operator=(const WallClock &) = delete;
+
+    int64_t epochMicrosAt(int64_t monotonicMicros);
+    void    anchor(clock_source_t newSource, int64_t epochMicros, int64_t monotonicMicros);
+
+   public:
+    static WallClock &getInstance();
+
+    // Seconds since the epoch, or since boot while no source has been seen yet
+    unsigned long now();
+    int64_t       nowMicros();
+
+    // Called from the SNTP task with the freshly synchronized time
+    void setFromNtp(const struct timeval &tv);
+    // Called with the TimeStamp of every status frame, only used until NTP works
+    void setFromPrinter(unsigned long timestamp);
+
+    bool           isSynced();
+    clock_source_t getSource();
+    int32_t        getDriftPpb();
+};
+
+#define wallClock WallClock::getInstance()
+
+#endif  // WALL_CLOCK_H
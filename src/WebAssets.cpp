@@ -0,0 +1,79 @@
+#include "WebAssets.h"
+
+#include <string.h>
+
+// Generated into the build directory by pack_webui.py
+#include "web_assets_data.h"
+
+#define WEB_ASSET_INDEX "/index.htm"
+
+static const char *assetPath(AsyncWebServerRequest *request)
+{
+    const char *path = request->url().c_str();
+    return strcmp(path, "/") == 0 ? WEB_ASSET_INDEX : path;
+}
+
+const web_asset_t *WebAssetHandler::find(const char *path)
+{
+    size_t low  = 0;
+    size_t high = WEB_ASSET_COUNT;
+    while (low < high)
+    {
+        size_t mid   = low + (high - low) / 2;
+        int    order = strcmp(path, webAssets[mid].path);
+        if (order == 0)
+        {
+            return &webAssets[mid];
+        }
+        if (order < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+size_t WebAssetHandler::count()
+{
+    return WEB_ASSET_COUNT;
+}
+
+bool WebAssetHandler::canHandle(AsyncWebServerRequest *request) const
+{
+    return request->method() == HTTP_GET && find(assetPath(request)) != NULL;
+}
+
+void WebAssetHandler::handleRequest(AsyncWebServerRequest *request)
+{
+    const web_asset_t *asset = find(assetPath(request));
+    if (asset == NULL)
+    {
+        request->send(404);
+        return;
+    }
+
+    const char *cacheControl =
+        asset->immutable ? WEB_ASSET_IMMUTABLE_CACHE : WEB_ASSET_REVALIDATE_CACHE;
+
+    if (request->hasHeader("If-None-Match") &&
+        request->header("If-None-Match") == asset->etag)
+    {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", asset->etag);
+        response->addHeader("Cache-Control", cacheControl);
+        request->send(response);
+        return;
+    }
+
+    // Sent from flash as the connection takes it, nothing is copied to RAM up front
+    AsyncWebServerResponse *response =
+        request->beginResponse(200, asset->contentType, asset->data, asset->length);
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("ETag", asset->etag);
+    response->addHeader("Cache-Control", cacheControl);
+    request->send(response);
+}
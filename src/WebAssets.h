@@ -0,0 +1,34 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Vite names everything under /assets/ after its content, so those can be cached for good
+#define WEB_ASSET_IMMUTABLE_CACHE "public, max-age=31536000, immutable"
+// index.htm keeps its name across releases, the browser revalidates it with the ETag
+#define WEB_ASSET_REVALIDATE_CACHE "no-cache"
+
+struct web_asset_t
+{
+    const char    *path;  // URL path, the table is sorted by it
+    const char    *contentType;
+    const char    *etag;  // Quoted content hash
+    const uint8_t *data;  // Gzipped, read straight from the memory mapped flash
+    uint32_t       length;
+    bool           immutable;
+};
+
+// Serves the web UI that pack_webui.py embedded in the firmware, without touching the
+// filesystem. Paths that aren't in there fall through to the next handler, the LittleFS files.
+class WebAssetHandler : public AsyncWebHandler
+{
+   public:
+    bool canHandle(AsyncWebServerRequest *request) const override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+
+    static const web_asset_t *find(const char *path);
+    static size_t             count();
+};
+
+#endif  // WEB_ASSETS_H
@@ -2,8 +2,16 @@
 
 #include <AsyncJson.h>
 
+#include "BootTiming.h"
 #include "ElegooCC.h"
 #include "Logger.h"
+#include "LoopProfiler.h"
+#include "MemoryPolicy.h"
+#include "OtaManager.h"
+#include "PowerManager.h"
+#include "Scheduler.h"
+#include "SdcpProxy.h"
+#include "SessionCheckpoint.h"
 
 #define SPIFFS LittleFS
 
@@ -11,12 +19,32 @@
 extern const char *firmwareVersion;
 extern const char *chipFamily;
 
-WebServer::WebServer(int port) : server(port) {}
+// Updates are open unless a printer control password is set
+static bool isUpdateAllowed(AsyncWebServerRequest *request)
+{
+    String password = settingsManager.getAPIPassword();
+    return password.isEmpty() || request->authenticate(CONTROL_USERNAME, password.c_str());
+}
+
+WebServer::WebServer(int port) : server(port)
+{
+    controlMutex      = xSemaphoreCreateMutex();
+    filesystemJob     = -1;
+    filesystemMounted = false;
+    for (int i = 0; i < MAX_PENDING_CONTROL_REQUESTS; i++)
+    {
+        pendingControl[i].used = false;
+    }
+}
 
 void WebServer::begin()
 {
     server.begin();
 
+    filesystemJob = scheduler.addJob("fs_mount", JOB_PRIORITY_LOW, [this](unsigned long now)
+                                     { this->mountFilesystem(now); });
+    scheduler.schedule(filesystemJob, FILESYSTEM_MOUNT_CHECK_MS);
+
     // Get settings endpoint
     server.on("/get_settings", HTTP_GET,
               [](AsyncWebServerRequest *request)
@@ -29,27 +57,89 @@ void WebServer::begin()
         "/update_settings",
         [this](AsyncWebServerRequest *request, JsonVariant &json)
         {
+            // The same gate as firmware updates, otherwise anyone on the network could replace
+            // the control password through here
+            if (!isUpdateAllowed(request))
+            {
+                request->requestAuthentication();
+                return;
+            }
             JsonObject jsonObj = json.as<JsonObject>();
-            settingsManager.setElegooIP(jsonObj["elegooip"].as<String>());
-            settingsManager.setSSID(jsonObj["ssid"].as<String>());
-            settingsManager.setElegooIP(jsonObj["elegooip"].as<String>());
-            settingsManager.setSSID(jsonObj["ssid"].as<String>());
-            if (jsonObj.containsKey("passwd") && jsonObj["passwd"].as<String>().length() > 0)
+            String     error;
+            // Validated and applied under one lock, the flash write happens later on the main loop
+            if (!settingsManager.updateFromJson(jsonObj, error))
             {
-                settingsManager.setPassword(jsonObj["passwd"].as<String>());
+                request->send(400, "text/plain", error);
+                return;
             }
-            settingsManager.setAPMode(jsonObj["ap_mode"].as<bool>());
-            settingsManager.setTimeout(jsonObj["timeout"].as<int>());
-            settingsManager.setPauseOnRunout(jsonObj["pause_on_runout"].as<bool>());
-            settingsManager.setEnabled(jsonObj["enabled"].as<bool>());
-            settingsManager.setStartPrintTimeout(jsonObj["start_print_timeout"].as<int>());
-            settingsManager.save();
             jsonObj.clear();
+            // Let the main loop deliver the change notifications right away
+            powerManager.notify();
             request->send(200, "text/plain", "ok");
         }));
 
-    // Setup ElegantOTA
-    ElegantOTA.begin(&server);
+    // Firmware updates, add ?target=delta for a patch made with make_delta.py, and &md5= to have
+    // the resulting image checked. ?target=filesystem writes a LittleFS image, which only builds
+    // without a packed UI serve from. The response only says whether it was staged, the reboot
+    // happens once the printer is idle.
+    otaManager.setup();
+    server.on(
+        "/ota/upload", HTTP_POST,
+        [](AsyncWebServerRequest *request)
+        {
+            if (!isUpdateAllowed(request))
+            {
+                request->requestAuthentication();
+                return;
+            }
+            ota_state_t state = otaManager.getState();
+            if (state == OTA_STATE_STAGED)
+            {
+                request->send(200, "text/plain", "ok");
+            }
+            else if (state == OTA_STATE_RECEIVING)
+            {
+                request->send(409, "text/plain", "Another update is in progress");
+            }
+            else
+            {
+                request->send(500, "text/plain", otaManager.getError());
+            }
+        },
+        [](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data,
+           size_t len, bool final)
+        {
+            if (index == 0)
+            {
+                if (!isUpdateAllowed(request))
+                {
+                    return;
+                }
+                String name = request->hasParam("target") ? request->getParam("target")->value()
+                                                          : "firmware";
+                ota_target_t target = name == "filesystem" ? OTA_TARGET_FILESYSTEM
+                                      : name == "delta"    ? OTA_TARGET_DELTA
+                                                           : OTA_TARGET_FIRMWARE;
+                String md5 = request->hasParam("md5") ? request->getParam("md5")->value() : "";
+                if (!otaManager.begin(request, request->contentLength(), target, md5.c_str()))
+                {
+                    return;
+                }
+                request->onDisconnect([request]() { otaManager.abortIfIncomplete(request); });
+            }
+
+            if (otaManager.write(request, data, len) && final)
+            {
+                otaManager.end(request);
+            }
+        });
+
+    server.on("/ota/status", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = otaManager.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
 
     // Sensor status endpoint
     server.on("/sensor_status", HTTP_GET,
@@ -58,13 +148,15 @@ void WebServer::begin()
                   // Add elegoo status information using singleton
                   printer_info_t elegooStatus = elegooCC.getCurrentInformation();
 
-                  DynamicJsonDocument jsonDoc(512);
+                  BulkJsonDocument jsonDoc(1024);
                   jsonDoc["stopped"]        = elegooStatus.filamentStopped;
                   jsonDoc["filamentRunout"] = elegooStatus.filamentRunout;
 
-                  jsonDoc["elegoo"]["mainboardID"]          = elegooStatus.mainboardID;
+                  jsonDoc["elegoo"]["mainboardID"]          = elegooStatus.mainboardID.c_str();
                   jsonDoc["elegoo"]["printStatus"]          = (int) elegooStatus.printStatus;
                   jsonDoc["elegoo"]["isPrinting"]           = elegooStatus.isPrinting;
+                  jsonDoc["elegoo"]["sessionState"] =
+                      PrintSession::stateName(elegooStatus.sessionState);
                   jsonDoc["elegoo"]["currentLayer"]         = elegooStatus.currentLayer;
                   jsonDoc["elegoo"]["totalLayer"]           = elegooStatus.totalLayer;
                   jsonDoc["elegoo"]["progress"]             = elegooStatus.progress;
@@ -74,6 +166,26 @@ void WebServer::begin()
                   jsonDoc["elegoo"]["isWebsocketConnected"] = elegooStatus.isWebsocketConnected;
                   jsonDoc["elegoo"]["currentZ"]             = elegooStatus.currentZ;
 
+                  JsonObject connection            = jsonDoc.createNestedObject("connection");
+                  connection["rttMs"]              = elegooStatus.rttSmoothedMs;
+                  connection["rttVarianceMs"]      = elegooStatus.rttVarianceMs;
+                  connection["rttMinMs"]           = elegooStatus.rttMinMs;
+                  connection["rttMaxMs"]           = elegooStatus.rttMaxMs;
+                  connection["rttSamples"]         = elegooStatus.rttSamples;
+                  connection["ackTimeoutMs"]       = elegooStatus.ackTimeoutMs;
+                  connection["ackTimeouts"]        = elegooStatus.ackTimeouts;
+                  connection["messageIntervalMs"]  = elegooStatus.messageIntervalMs;
+                  connection["livenessReconnects"] = elegooStatus.livenessReconnects;
+
+                  JsonObject pause    = jsonDoc.createNestedObject("pause");
+                  pause["inProgress"] = elegooStatus.pauseInProgress;
+                  pause["confirmed"]  = elegooStatus.pausesConfirmed;
+                  pause["retried"]    = elegooStatus.pausesRetried;
+                  pause["fallback"]   = elegooStatus.pausesFallback;
+                  pause["failed"]     = elegooStatus.pausesFailed;
+                  pause["lastMs"]     = elegooStatus.lastPauseMs;
+                  pause["maxMs"]      = elegooStatus.maxPauseMs;
+
                   String jsonResponse;
                   serializeJson(jsonDoc, jsonResponse);
                   request->send(200, "application/json", jsonResponse);
@@ -102,12 +214,273 @@ void WebServer::begin()
                   request->send(200, "application/json", jsonResponse);
               });
 
-    // Serve static files from SPIFFS
-    server.serveStatic("/assets/", SPIFFS, "/assets/");
-    server.serveStatic("/", SPIFFS, "/");
+    // Boot phase timing endpoint
+    server.on("/boot_timing", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = bootTiming.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/scheduler", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = scheduler.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/scheduler/reset", HTTP_POST,
+              [](AsyncWebServerRequest *request)
+              {
+                  scheduler.resetStats();
+                  request->send(200, "text/plain", "ok");
+              });
+
+    server.on("/power", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = powerManager.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/power/reset", HTTP_POST,
+              [](AsyncWebServerRequest *request)
+              {
+                  powerManager.resetStats();
+                  request->send(200, "text/plain", "ok");
+              });
+
+    server.on("/loop_profile", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = loopProfiler.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/loop_profile/reset", HTTP_POST,
+              [](AsyncWebServerRequest *request)
+              {
+                  loopProfiler.reset();
+                  request->send(200, "text/plain", "ok");
+              });
+
+    server.on("/print_session", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = elegooCC.sessionToJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/session_checkpoint", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = sessionCheckpoint.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/memory", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = memoryPolicy.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/sdcp_proxy", HTTP_GET,
+              [](AsyncWebServerRequest *request)
+              {
+                  String jsonResponse = sdcpProxy.toJson();
+                  request->send(200, "application/json", jsonResponse);
+              });
+
+    server.on("/sdcp_proxy/reset", HTTP_POST,
+              [](AsyncWebServerRequest *request)
+              {
+                  sdcpProxy.resetStats();
+                  request->send(200, "text/plain", "ok");
+              });
+
+    // Printer control over our existing connection, answered once the printer acknowledged
+    server.on("/printer/pause", HTTP_POST,
+              [this](AsyncWebServerRequest *request)
+              { this->handleControlRequest(request, SDCP_COMMAND_PAUSE_PRINT, "pause"); });
+
+    server.on("/printer/resume", HTTP_POST,
+              [this](AsyncWebServerRequest *request)
+              { this->handleControlRequest(request, SDCP_COMMAND_CONTINUE_PRINT, "resume"); });
+
+    server.on("/printer/status-refresh", HTTP_POST,
+              [this](AsyncWebServerRequest *request)
+              { this->handleControlRequest(request, SDCP_COMMAND_STATUS, "status-refresh"); });
+
+    elegooCC.onCommandAck = [this](const char *requestId, int command, int ack)
+    { this->onCommandAck(requestId, command, ack); };
+
+    // The web UI built into the firmware is the one that's served, a new UI comes with a firmware
+    // update. The files on SPIFFS are only the fallback for builds without a packed UI, and
+    // aren't there until mountFilesystem() ran, or while a filesystem update has it unmounted.
+    server.addHandler(&assetHandler);
+    ArRequestFilterFunction filesystemReady = [this](AsyncWebServerRequest *request)
+    { return this->filesystemMounted && otaManager.isFilesystemAvailable(); };
+    server.serveStatic("/assets/", SPIFFS, "/assets/").setFilter(filesystemReady);
+    server.serveStatic("/", SPIFFS, "/").setFilter(filesystemReady);
+}
+
+void WebServer::mountFilesystem(unsigned long now)
+{
+    // Monitoring comes first, wait for the first status from the printer
+    if (bootTiming.getReachedAt(BOOT_PHASE_FIRST_STATUS) == 0 &&
+        now < FILESYSTEM_MOUNT_MAX_WAIT_MS)
+    {
+        scheduler.schedule(filesystemJob, FILESYSTEM_MOUNT_CHECK_MS);
+        return;
+    }
+    if (!otaManager.isFilesystemAvailable())
+    {
+        scheduler.schedule(filesystemJob, FILESYSTEM_MOUNT_RETRY_MS);
+        return;
+    }
+
+    if (!LittleFS.begin())
+    {
+        logger.log("Filesystem couldn't be mounted, the web UI comes from the firmware only");
+        return;
+    }
+    filesystemMounted = true;
+    bootTiming.mark(BOOT_PHASE_FS_MOUNTED);
+    logger.log("Filesystem mounted");
+    settingsManager.retireLegacyJson();
 }
 
 void WebServer::loop()
 {
-    ElegantOTA.loop();
+    otaManager.loop();
+    processControlRequests();
+}
+
+void WebServer::handleControlRequest(AsyncWebServerRequest *request, int command,
+                                     const char *name)
+{
+    String password = settingsManager.getAPIPassword();
+    if (password.isEmpty())
+    {
+        request->send(403, "text/plain", "Printer control is disabled, set a password first");
+        return;
+    }
+    if (!request->authenticate(CONTROL_USERNAME, password.c_str()))
+    {
+        request->requestAuthentication();
+        return;
+    }
+
+    xSemaphoreTake(controlMutex, portMAX_DELAY);
+    pending_control_t *pending = NULL;
+    for (int i = 0; i < MAX_PENDING_CONTROL_REQUESTS; i++)
+    {
+        if (!pendingControl[i].used)
+        {
+            pending = &pendingControl[i];
+            break;
+        }
+    }
+    if (pending == NULL)
+    {
+        xSemaphoreGive(controlMutex);
+        request->send(503, "text/plain", "Too many control requests in flight");
+        return;
+    }
+
+    // The websocket belongs to the main loop, the command goes out from there
+    request->pause();
+    pending->request      = request->getRequestPtr();
+    pending->command      = command;
+    pending->name         = name;
+    pending->requestId[0] = '\0';
+    pending->receivedAt   = millis();
+    pending->sentAt       = 0;
+    pending->used         = true;
+    xSemaphoreGive(controlMutex);
+
+    powerManager.notify();
+}
+
+void WebServer::processControlRequests()
+{
+    unsigned long now = millis();
+
+    xSemaphoreTake(controlMutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_PENDING_CONTROL_REQUESTS; i++)
+    {
+        pending_control_t &pending = pendingControl[i];
+        if (!pending.used)
+        {
+            continue;
+        }
+
+        auto request = pending.request.lock();
+        if (!request)
+        {
+            // Client went away, a command that's already out still reaches the printer
+            releaseControl(pending);
+            continue;
+        }
+
+        if (pending.requestId[0] == '\0')
+        {
+            sdcp_request_id_t requestId =
+                elegooCC.sendControlCommand((sdcp_command_t) pending.command);
+            if (requestId.isEmpty())
+            {
+                request->send(503, "text/plain", "Printer not connected");
+                releaseControl(pending);
+                continue;
+            }
+            strncpy(pending.requestId, requestId.c_str(), sizeof(pending.requestId) - 1);
+            pending.requestId[sizeof(pending.requestId) - 1] = '\0';
+            pending.sentAt                                   = now;
+        }
+        else if (now - pending.sentAt >= CONTROL_ACK_TIMEOUT_MS)
+        {
+            request->send(504, "text/plain", "Printer did not acknowledge the command");
+            releaseControl(pending);
+        }
+    }
+    xSemaphoreGive(controlMutex);
+}
+
+void WebServer::onCommandAck(const char *requestId, int command, int ack)
+{
+    unsigned long now = millis();
+
+    xSemaphoreTake(controlMutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_PENDING_CONTROL_REQUESTS; i++)
+    {
+        pending_control_t &pending = pendingControl[i];
+        if (!pending.used || strcmp(pending.requestId, requestId) != 0)
+        {
+            continue;
+        }
+
+        auto request = pending.request.lock();
+        if (request)
+        {
+            DynamicJsonDocument jsonDoc(256);
+            jsonDoc["command"]   = pending.name;
+            jsonDoc["ack"]       = ack;
+            jsonDoc["rtt_ms"]    = now - pending.sentAt;
+            jsonDoc["queued_ms"] = pending.sentAt - pending.receivedAt;
+
+            String jsonResponse;
+            serializeJson(jsonDoc, jsonResponse);
+            request->send(200, "application/json", jsonResponse);
+        }
+        releaseControl(pending);
+        break;
+    }
+    xSemaphoreGive(controlMutex);
+}
+
+void WebServer::releaseControl(pending_control_t &pending)
+{
+    pending.request.reset();
+    pending.used = false;
 }
\ No newline at end of file
@@ -5,18 +5,60 @@
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
-#include <ElegantOTA.h>
 #include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include "SettingsManager.h"
+#include "WebAssets.h"
 
 // Define SPIFFS as LittleFS
 #define SPIFFS LittleFS
 
+// Printer control requests (see /printer/*) waiting for the printer's acknowledgment
+#define MAX_PENDING_CONTROL_REQUESTS 4
+// Answer with 504 when the printer hasn't acknowledged a control command after this long
+#define CONTROL_ACK_TIMEOUT_MS 5000
+// User name for the printer control endpoints, the password is a setting
+#define CONTROL_USERNAME "admin"
+
+// LittleFS only has the fallback for web UI files the firmware doesn't carry, so it's mounted once
+// the printer is monitored instead of on the boot path. A printer that doesn't answer doesn't keep
+// it unmounted for longer than FILESYSTEM_MOUNT_MAX_WAIT_MS after boot.
+#define FILESYSTEM_MOUNT_CHECK_MS 1000
+#define FILESYSTEM_MOUNT_MAX_WAIT_MS 30000
+// While a filesystem update has the partition
+#define FILESYSTEM_MOUNT_RETRY_MS 10000
+
 class WebServer
 {
    private:
-    AsyncWebServer server;
+    AsyncWebServer  server;
+    WebAssetHandler assetHandler;
+
+    // Control requests are parked here by the HTTP handler and answered from the main loop once
+    // the printer acknowledged the command
+    struct pending_control_t
+    {
+        AsyncWebServerRequestPtr request;
+        int                      command;
+        const char              *name;
+        char                     requestId[33];  // Empty until the command went out
+        unsigned long            receivedAt;
+        unsigned long            sentAt;
+        bool                     used;
+    };
+    pending_control_t pendingControl[MAX_PENDING_CONTROL_REQUESTS];
+    SemaphoreHandle_t controlMutex;
+
+    int           filesystemJob;
+    volatile bool filesystemMounted;
+
+    void handleControlRequest(AsyncWebServerRequest *request, int command, const char *name);
+    void processControlRequests();
+    void onCommandAck(const char *requestId, int command, int ack);
+    void releaseControl(pending_control_t &pending);
+    void mountFilesystem(unsigned long now);
 
    public:
     WebServer(int port = 80);
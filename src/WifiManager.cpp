@@ -0,0 +1,356 @@
+#include "WifiManager.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <WiFi.h>
+#endif  // ARDUINO
+
+static const char *stateName(wifi_state_t state)
+{
+    switch (state)
+    {
+        case WIFI_STATE_IDLE:
+            return "idle";
+        case WIFI_STATE_AP:
+            return "access point";
+        case WIFI_STATE_CONNECTING:
+            return "connecting";
+        case WIFI_STATE_CONNECTED:
+            return "connected";
+        case WIFI_STATE_WAITING_RETRY:
+            return "waiting to retry";
+    }
+    return "unknown";
+}
+
+WifiManager::WifiManager(WifiDriver &driver) : driver(driver)
+{
+    state          = WIFI_STATE_IDLE;
+    deadline       = 0;
+    hasConnected   = false;
+    isFastAttempt  = false;
+    attemptTimeout = 0;
+    ssid[0]        = '\0';
+    password[0]    = '\0';
+    eventPending   = false;
+}
+
+void WifiManager::log(const char *format, ...)
+{
+    if (!onLog)
+    {
+        return;
+    }
+    char    message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    onLog(message);
+}
+
+void WifiManager::setState(wifi_state_t newState)
+{
+    log("WiFi state: %s -> %s", stateName(state), stateName(newState));
+    state = newState;
+    if (onStateChange)
+    {
+        onStateChange(state);
+    }
+}
+
+void WifiManager::begin(bool apMode, const char *newSsid, const char *newPassword,
+                        bool connectedBefore, unsigned long now)
+{
+    strncpy(ssid, newSsid, sizeof(ssid) - 1);
+    ssid[sizeof(ssid) - 1] = '\0';
+    strncpy(password, newPassword, sizeof(password) - 1);
+    password[sizeof(password) - 1] = '\0';
+    hasConnected                   = connectedBefore;
+
+    if (state == WIFI_STATE_IDLE)
+    {
+        driver.begin(this);
+    }
+    else
+    {
+        driver.stop();
+    }
+
+    if (apMode)
+    {
+        log("Starting AP mode");
+        driver.startAccessPoint();
+        setState(WIFI_STATE_AP);
+        return;
+    }
+
+    log("Connecting to WiFi: %s", ssid);
+    startConnecting(now, WIFI_CONNECT_TIMEOUT);
+}
+
+void WifiManager::startConnecting(unsigned long now, unsigned long timeout)
+{
+    // Try the remembered access point first, it skips the scan. If that doesn't work out within
+    // WIFI_FAST_CONNECT_TIMEOUT we fall back to a normal connect with the rest of the timeout.
+    isFastAttempt  = driver.canFastConnect(ssid) && timeout > WIFI_FAST_CONNECT_TIMEOUT;
+    attemptTimeout = timeout;
+    driver.connectStation(ssid, password, isFastAttempt);
+    deadline = now + (isFastAttempt ? WIFI_FAST_CONNECT_TIMEOUT : timeout);
+    setState(WIFI_STATE_CONNECTING);
+}
+
+void WifiManager::handleConnectFailed(unsigned long now)
+{
+    if (!hasConnected)
+    {
+        log("Failed to connect to WiFi with these credentials");
+        if (onFirstConnectFailed)
+        {
+            onFirstConnectFailed();
+        }
+        driver.stop();
+        log("Starting AP mode");
+        driver.startAccessPoint();
+        setState(WIFI_STATE_AP);
+        return;
+    }
+
+    log("WiFi connection failed, retrying in %d seconds", WIFI_RETRY_INTERVAL / 1000);
+    driver.stop();
+    deadline = now + WIFI_RETRY_INTERVAL;
+    setState(WIFI_STATE_WAITING_RETRY);
+}
+
+void WifiManager::loop(unsigned long now)
+{
+    bool deadlinePassed = (long) (now - deadline) >= 0;
+    if (!eventPending && !deadlinePassed)
+    {
+        return;
+    }
+    eventPending = false;
+
+    switch (state)
+    {
+        case WIFI_STATE_CONNECTING:
+            if (driver.isStationConnected())
+            {
+                log("WiFi Connected");
+                hasConnected = true;
+                driver.rememberAccessPoint(ssid);
+                setState(WIFI_STATE_CONNECTED);
+            }
+            else if (deadlinePassed && isFastAttempt)
+            {
+                log("Fast connect failed, scanning for the access point");
+                isFastAttempt = false;
+                driver.forgetAccessPoint();
+                driver.stop();
+                driver.connectStation(ssid, password, false);
+                deadline = now + attemptTimeout - WIFI_FAST_CONNECT_TIMEOUT;
+            }
+            else if (deadlinePassed)
+            {
+                handleConnectFailed(now);
+            }
+            break;
+
+        case WIFI_STATE_CONNECTED:
+            if (!driver.isStationConnected())
+            {
+                log("WiFi disconnected, attempting to reconnect...");
+                startConnecting(now, WIFI_RECONNECT_TIMEOUT);
+            }
+            break;
+
+        case WIFI_STATE_WAITING_RETRY:
+            if (deadlinePassed)
+            {
+                startConnecting(now, WIFI_RECONNECT_TIMEOUT);
+            }
+            break;
+
+        case WIFI_STATE_IDLE:
+        case WIFI_STATE_AP:
+            break;
+    }
+
+    // Nothing to wait for in the stable states, events drive us from here. Still look again every
+    // now and then in case one was missed.
+    if (state == WIFI_STATE_CONNECTED || state == WIFI_STATE_AP || state == WIFI_STATE_IDLE)
+    {
+        deadline = now + WIFI_RECONNECT_TIMEOUT;
+    }
+}
+
+unsigned long WifiManager::timeUntilDeadline(unsigned long now)
+{
+    long remaining = (long) (deadline - now);
+    return remaining > 0 ? remaining : 0;
+}
+
+void WifiManager::notifyEvent()
+{
+    eventPending = true;
+}
+
+wifi_state_t WifiManager::getState()
+{
+    return state;
+}
+
+bool WifiManager::isConnected()
+{
+    return state == WIFI_STATE_CONNECTED;
+}
+
+#ifdef ARDUINO
+
+#include <Preferences.h>
+
+#define WIFI_NVS_NAMESPACE "cc_sfs"
+#define WIFI_NVS_KEY "wifi_ap"
+
+// Access point we last connected to, lets the next connect skip the scan
+struct wifi_ap_cache_t
+{
+    char    ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+static bool readApCache(wifi_ap_cache_t &cache)
+{
+    Preferences prefs;
+    if (!prefs.begin(WIFI_NVS_NAMESPACE, true))
+    {
+        return false;
+    }
+    size_t length = prefs.getBytes(WIFI_NVS_KEY, &cache, sizeof(cache));
+    prefs.end();
+    cache.ssid[sizeof(cache.ssid) - 1] = '\0';
+    return length == sizeof(cache) && cache.channel != 0;
+}
+
+EspWifiDriver::EspWifiDriver()
+{
+    useStaticIP = false;
+}
+
+void EspWifiDriver::begin(WifiManager *manager)
+{
+    // We own the reconnect policy, don't let the core retry behind our back
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent([manager](arduino_event_id_t event, arduino_event_info_t info)
+                 { manager->notifyEvent(); },
+                 ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent([manager](arduino_event_id_t event, arduino_event_info_t info)
+                 { manager->notifyEvent(); },
+                 ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    WiFi.onEvent([manager](arduino_event_id_t event, arduino_event_info_t info)
+                 { manager->notifyEvent(); },
+                 ARDUINO_EVENT_WIFI_STA_LOST_IP);
+}
+
+void EspWifiDriver::connectStation(const char *ssid, const char *password, bool fast)
+{
+    WiFi.mode(WIFI_STA);
+    if (useStaticIP)
+    {
+        WiFi.config(staticIP, staticGateway, staticSubnet, staticDNS);
+    }
+    else
+    {
+        // All zeroes switches back to DHCP
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    }
+
+    wifi_ap_cache_t cache;
+    if (fast && readApCache(cache) && strcmp(cache.ssid, ssid) == 0)
+    {
+        WiFi.begin(ssid, password, cache.channel, cache.bssid);
+    }
+    else
+    {
+        WiFi.begin(ssid, password);
+    }
+}
+
+void EspWifiDriver::startAccessPoint()
+{
+    WiFi.softAP("ElegooXBTTSFS20", "elegooccsfs20");
+}
+
+void EspWifiDriver::stop()
+{
+    // Neither call waits for the radio, the next begin()/softAP() takes care of sequencing
+    WiFi.softAPdisconnect(true);
+    WiFi.disconnect(false);
+}
+
+bool EspWifiDriver::isStationConnected()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+
+bool EspWifiDriver::canFastConnect(const char *ssid)
+{
+    wifi_ap_cache_t cache;
+    return readApCache(cache) && strcmp(cache.ssid, ssid) == 0;
+}
+
+void EspWifiDriver::rememberAccessPoint(const char *ssid)
+{
+    wifi_ap_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    strncpy(cache.ssid, ssid, sizeof(cache.ssid) - 1);
+    uint8_t *bssid = WiFi.BSSID();
+    if (bssid == NULL)
+    {
+        return;
+    }
+    memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+
+    // Only touch flash when something changed, which is rare after the first boot
+    wifi_ap_cache_t current;
+    if (readApCache(current) && memcmp(&current, &cache, sizeof(cache)) == 0)
+    {
+        return;
+    }
+
+    Preferences prefs;
+    if (prefs.begin(WIFI_NVS_NAMESPACE, false))
+    {
+        prefs.putBytes(WIFI_NVS_KEY, &cache, sizeof(cache));
+        prefs.end();
+    }
+}
+
+void EspWifiDriver::forgetAccessPoint()
+{
+    Preferences prefs;
+    if (prefs.begin(WIFI_NVS_NAMESPACE, false))
+    {
+        prefs.remove(WIFI_NVS_KEY);
+        prefs.end();
+    }
+}
+
+void EspWifiDriver::setStaticIP(const char *ip, const char *gateway, const char *subnet,
+                                const char *dns)
+{
+    // Anything that doesn't parse leaves us on DHCP rather than with a broken address
+    useStaticIP = ip[0] != '\0' && staticIP.fromString(ip) && staticGateway.fromString(gateway) &&
+                  staticSubnet.fromString(subnet);
+    if (useStaticIP && !staticDNS.fromString(dns))
+    {
+        staticDNS = staticGateway;
+    }
+}
+
+#endif  // ARDUINO
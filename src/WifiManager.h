@@ -0,0 +1,126 @@
+#ifndef WIFI_MANAGER_H
+#define WIFI_MANAGER_H
+
+#include <stdint.h>
+
+#include <functional>
+
+#define WIFI_CONNECT_TIMEOUT 30000    // First connection attempt after boot or new credentials
+#define WIFI_RECONNECT_TIMEOUT 10000  // Wait 10 seconds for each reconnection attempt
+#define WIFI_RETRY_INTERVAL 5000      // Pause between reconnection attempts
+#define WIFI_FAST_CONNECT_TIMEOUT 5000  // Give up on the cached access point after this long
+
+typedef enum
+{
+    WIFI_STATE_IDLE,           // Not started yet
+    WIFI_STATE_AP,             // Running our own access point
+    WIFI_STATE_CONNECTING,     // Station connect in progress, waiting for an IP or the deadline
+    WIFI_STATE_CONNECTED,      // Station connected and has an IP
+    WIFI_STATE_WAITING_RETRY,  // Lost the connection or an attempt failed, retrying at deadline
+} wifi_state_t;
+
+class WifiManager;
+
+// Thin layer over the radio so the state machine can run against a fake on the host. All calls
+// must return immediately, completion is reported through WifiManager::notifyEvent().
+class WifiDriver
+{
+   public:
+    virtual ~WifiDriver() {}
+
+    // Hook up event delivery to manager
+    virtual void begin(WifiManager *manager) = 0;
+    // With fast set, join the remembered access point directly instead of scanning for it
+    virtual void connectStation(const char *ssid, const char *password, bool fast) = 0;
+    virtual void startAccessPoint()                                                 = 0;
+    // Tears down both station and access point
+    virtual void stop()               = 0;
+    virtual bool isStationConnected() = 0;
+
+    // Fast connect cache: whether we remember an access point (BSSID and channel) for ssid,
+    // remember the one we're connected to now, and drop it once it stops working
+    virtual bool canFastConnect(const char *ssid)     = 0;
+    virtual void rememberAccessPoint(const char *ssid) = 0;
+    virtual void forgetAccessPoint()                   = 0;
+};
+
+// Event-driven WiFi connection handling. Nothing in here ever blocks, loop() only acts when the
+// driver reported an event or a deadline expired.
+class WifiManager
+{
+   private:
+    WifiDriver   &driver;
+    wifi_state_t  state;
+    unsigned long deadline;
+    bool          hasConnected;
+    bool          isFastAttempt;
+    unsigned long attemptTimeout;
+    char          ssid[33];
+    char          password[65];
+
+    // Set from the WiFi event task, consumed by loop()
+    volatile bool eventPending;
+
+    void log(const char *format, ...);
+    void setState(wifi_state_t newState);
+    void startConnecting(unsigned long now, unsigned long timeout);
+    void handleConnectFailed(unsigned long now);
+
+   public:
+    explicit WifiManager(WifiDriver &driver);
+
+    // Called with the new state after every transition
+    std::function<void(wifi_state_t state)> onStateChange;
+    // Called when credentials that never worked fail to connect, right before we fall back to
+    // our own access point
+    std::function<void()> onFirstConnectFailed;
+    // Receives the log lines, so this file doesn't need the logger (and with it Arduino)
+    std::function<void(const char *message)> onLog;
+
+    // Starts (or restarts) WiFi with the given configuration. hasConnected tells us whether
+    // these credentials have ever worked, a failing first attempt falls back to AP mode.
+    void begin(bool apMode, const char *ssid, const char *password, bool hasConnected,
+               unsigned long now);
+    void loop(unsigned long now);
+    // How long until loop() has to look at a deadline, events still need notifyEvent()
+    unsigned long timeUntilDeadline(unsigned long now);
+
+    // Safe to call from any task, including the WiFi event handler
+    void notifyEvent();
+
+    wifi_state_t getState();
+    bool         isConnected();
+};
+
+#ifdef ARDUINO
+#include <WiFi.h>
+
+// WifiDriver on top of the Arduino WiFi library
+class EspWifiDriver : public WifiDriver
+{
+   public:
+    EspWifiDriver();
+
+    void begin(WifiManager *manager) override;
+    void connectStation(const char *ssid, const char *password, bool fast) override;
+    void startAccessPoint() override;
+    void stop() override;
+    bool isStationConnected() override;
+    bool canFastConnect(const char *ssid) override;
+    void rememberAccessPoint(const char *ssid) override;
+    void forgetAccessPoint() override;
+
+    // Use a fixed address instead of DHCP, saves the DHCP round trips on every connect. Empty
+    // ip goes back to DHCP. Takes effect on the next connectStation().
+    void setStaticIP(const char *ip, const char *gateway, const char *subnet, const char *dns);
+
+   private:
+    bool      useStaticIP;
+    IPAddress staticIP;
+    IPAddress staticGateway;
+    IPAddress staticSubnet;
+    IPAddress staticDNS;
+};
+#endif  // ARDUINO
+
+#endif  // WIFI_MANAGER_H
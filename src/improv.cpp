@@ -1,266 +1,241 @@
 #include "improv.h"
 
-#include <cstring>
-
 namespace improv
 {
 
-ImprovCommand parse_improv_data(const std::vector<uint8_t> &data, bool check_checksum)
+static const uint8_t MAGIC[]    = {'I', 'M', 'P', 'R', 'O', 'V'};
+static const size_t  MAGIC_SIZE = sizeof(MAGIC);
+
+uint8_t checksum(const uint8_t *data, size_t length)
 {
-    return parse_improv_data(data.data(), data.size(), check_checksum);
+    uint8_t sum = 0x00;
+    for (size_t i = 0; i < length; i++)
+    {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Copies a string into a fixed buffer, fails if it doesn't fit
+static bool copy_string(const uint8_t *data, size_t length, char *out, size_t out_size)
+{
+    if (length >= out_size)
+    {
+        return false;
+    }
+    memcpy(out, data, length);
+    out[length] = '\0';
+    return true;
 }
 
 ImprovCommand parse_improv_data(const uint8_t *data, size_t length, bool check_checksum)
 {
-    ImprovCommand improv_command;
-    Command       command     = (Command) data[0];
-    uint8_t       data_length = data[1];
+    ImprovCommand improv_command = {};
+    improv_command.command       = UNKNOWN;
 
-    if (data_length != length - 2 - check_checksum)
+    if (length < 2u + check_checksum || data[1] != length - 2 - check_checksum)
     {
-        improv_command.command = UNKNOWN;
         return improv_command;
     }
 
-    if (check_checksum)
+    if (check_checksum && checksum(data, length - 1) != data[length - 1])
     {
-        uint8_t checksum = data[length - 1];
+        improv_command.command = BAD_CHECKSUM;
+        return improv_command;
+    }
 
-        uint32_t calculated_checksum = 0;
-        for (uint8_t i = 0; i < length - 1; i++)
-        {
-            calculated_checksum += data[i];
-        }
+    Command command  = (Command) data[0];
+    size_t  data_end = length - check_checksum;
 
-        if ((uint8_t) calculated_checksum != checksum)
+    if (command == WIFI_SETTINGS)
+    {
+        if (data_end < 3)
         {
-            improv_command.command = BAD_CHECKSUM;
             return improv_command;
         }
-    }
-
-    if (command == WIFI_SETTINGS)
-    {
-        uint8_t ssid_length = data[2];
-        uint8_t ssid_start  = 3;
-        size_t  ssid_end    = ssid_start + ssid_length;
-        if (ssid_end > length)
+        size_t ssid_start = 3;
+        size_t ssid_end   = ssid_start + data[2];
+        if (ssid_end >= data_end)
         {
-            improv_command.command = UNKNOWN;
             return improv_command;
         }
-
-        uint8_t pass_length = data[ssid_end];
-        size_t  pass_start  = ssid_end + 1;
-        size_t  pass_end    = pass_start + pass_length;
-        if (pass_end > length)
+        size_t pass_start = ssid_end + 1;
+        size_t pass_end   = pass_start + data[ssid_end];
+        if (pass_end > data_end)
         {
-            improv_command.command = UNKNOWN;
             return improv_command;
         }
 
-        std::string ssid(data + ssid_start, data + ssid_end);
-        std::string password(data + pass_start, data + pass_end);
-        return {.command = command, .ssid = ssid, .password = password};
+        improv_command.command = command;
+        if (!copy_string(data + ssid_start, ssid_end - ssid_start, improv_command.ssid,
+                         sizeof(improv_command.ssid)) ||
+            !copy_string(data + pass_start, pass_end - pass_start, improv_command.password,
+                         sizeof(improv_command.password)))
+        {
+            improv_command.ssid[0]     = '\0';
+            improv_command.password[0] = '\0';
+        }
+        return improv_command;
     }
 
     improv_command.command = command;
     return improv_command;
 }
 
-bool parse_improv_serial_byte(size_t position, uint8_t byte, const uint8_t *buffer,
-                              std::function<bool(ImprovCommand)> &&callback,
-                              std::function<void(Error)>         &&on_error)
+SerialDecoder::SerialDecoder()
 {
-    if (position == 0)
-        return byte == 'I';
-    if (position == 1)
-        return byte == 'M';
-    if (position == 2)
-        return byte == 'P';
-    if (position == 3)
-        return byte == 'R';
-    if (position == 4)
-        return byte == 'O';
-    if (position == 5)
-        return byte == 'V';
-
-    if (position == 6)
-        return byte == IMPROV_SERIAL_VERSION;
-
-    if (position <= 8)
-        return true;
-
-    uint8_t type     = buffer[7];
-    uint8_t data_len = buffer[8];
-
-    if (position <= 8 + data_len)
-        return true;
-
-    if (position == 8 + data_len + 1)
-    {
-        uint8_t checksum = 0x00;
-        for (size_t i = 0; i < position; i++)
-            checksum += buffer[i];
-
-        if (checksum != byte)
-        {
-            on_error(ERROR_INVALID_RPC);
-            return false;
-        }
-
-        if (type == TYPE_RPC)
-        {
-            auto command = parse_improv_data(&buffer[9], data_len, false);
-            return callback(command);
-        }
-    }
-
-    return false;
+    reset();
 }
 
-std::vector<uint8_t> build_rpc_response(Command command, const std::vector<std::string> &datum,
-                                        bool add_checksum)
+void SerialDecoder::reset()
 {
-    // Calculate the byte count to reserve memory to avoid reallocations
-    // Frame length fixed: 3 = Command: 1 + frame length: 1 + checksum: 1
-    size_t frame_length = 3;
-    // Frame length variable: string lengths: n + length of data in datum
-    frame_length += datum.size();
-    for (int i = 0; i < datum.size(); i++)
-    {
-        frame_length += datum[i].length();
-    }
-    // Reserve frame_length bytes in vector
-    std::vector<uint8_t> out(frame_length, 0);
-
-    out[0] = command;
+    stage                = STAGE_MAGIC;
+    magic_position       = 0;
+    type                 = 0;
+    length               = 0;
+    received             = 0;
+    sum                  = 0;
+    last_command         = ImprovCommand();
+    last_command.command = UNKNOWN;
+}
 
-    // Copy data from datum input to out vector with lengths
-    const size_t data_offset = 2;
-    size_t       pos         = data_offset;
-    for (const auto &str : datum)
+void SerialDecoder::restart(uint8_t byte)
+{
+    // The byte that broke the frame may already start the next one. 'I' only occurs at the
+    // start of the magic, so that is the only case to look at.
+    stage          = STAGE_MAGIC;
+    magic_position = 0;
+    sum            = 0;
+    if (byte == MAGIC[0])
     {
-        out[pos] = static_cast<uint8_t>(str.length());
-        pos++;
-        std::memcpy(out.data() + pos, str.c_str(), str.length());
-        pos += str.length();
+        magic_position = 1;
+        sum            = byte;
     }
+}
 
-    out[1] = static_cast<uint8_t>(pos - data_offset);
-
-    if (add_checksum)
+DecodeResult SerialDecoder::feed(uint8_t byte)
+{
+    switch (stage)
     {
-        uint32_t calculated_checksum = 0;
-
-        for (uint8_t byte : out)
+        case STAGE_MAGIC:
+            if (byte != MAGIC[magic_position])
+            {
+                restart(byte);
+                return DECODE_PENDING;
+            }
+            sum += byte;
+            if (++magic_position == MAGIC_SIZE)
+            {
+                stage = STAGE_VERSION;
+            }
+            return DECODE_PENDING;
+
+        case STAGE_VERSION:
+            if (byte != IMPROV_SERIAL_VERSION)
+            {
+                restart(byte);
+                return DECODE_PENDING;
+            }
+            sum += byte;
+            stage = STAGE_TYPE;
+            return DECODE_PENDING;
+
+        case STAGE_TYPE:
+            type = byte;
+            sum += byte;
+            stage = STAGE_LENGTH;
+            return DECODE_PENDING;
+
+        case STAGE_LENGTH:
+            length   = byte;
+            received = 0;
+            sum += byte;
+            stage = length > 0 ? STAGE_DATA : STAGE_CHECKSUM;
+            return DECODE_PENDING;
+
+        case STAGE_DATA:
+            data[received++] = byte;
+            sum += byte;
+            if (received == length)
+            {
+                stage = STAGE_CHECKSUM;
+            }
+            return DECODE_PENDING;
+
+        case STAGE_CHECKSUM:
         {
-            calculated_checksum += byte;
+            bool valid = sum == byte;
+            restart(0);
+            if (!valid)
+            {
+                return DECODE_BAD_CHECKSUM;
+            }
+            if (type != TYPE_RPC)
+            {
+                return DECODE_PENDING;
+            }
+            last_command = parse_improv_data(data, length, false);
+            return DECODE_COMMAND;
         }
-        // Clear all bits, but the least significant byte
-        calculated_checksum &= 0xFF;
-        out[frame_length - 1] = static_cast<uint8_t>(calculated_checksum);
     }
-    return out;
+    return DECODE_PENDING;
 }
 
-#ifdef ARDUINO
-std::vector<uint8_t> build_rpc_response(Command command, const std::vector<String> &datum,
-                                        bool add_checksum)
+const ImprovCommand &SerialDecoder::command() const
 {
-    // Calculate the byte count to reserve memory to avoid reallocations
-    // Frame length fixed: 3 = Command: 1 + frame length: 1 + checksum: 1
-    size_t frame_length = 3;
-    // Frame length variable: string lengths: n + length of data in datum
-    frame_length += datum.size();
-    for (int i = 0; i < datum.size(); i++)
+    return last_command;
+}
+
+size_t build_serial_frame(ImprovSerialType type, const uint8_t *data, size_t length, uint8_t *out,
+                          size_t out_size)
+{
+    if (length > MAX_DATA_SIZE || SERIAL_HEADER_SIZE + length + 1 > out_size)
     {
-        frame_length += datum[i].length();
+        return 0;
     }
-    // Reserve frame_length bytes in vector
-    std::vector<uint8_t> out(frame_length, 0);
-
-    out[0] = command;
 
-    // Copy data from datum input to out vector with lengths
-    const size_t data_offset = 2;
-    size_t       pos         = data_offset;
-    for (const auto &str : datum)
+    memcpy(out, MAGIC, MAGIC_SIZE);
+    out[6] = IMPROV_SERIAL_VERSION;
+    out[7] = type;
+    out[8] = static_cast<uint8_t>(length);
+    if (length > 0)
     {
-        out[pos] = static_cast<uint8_t>(str.length());
-        pos++;
-        std::memcpy(out.data() + pos, str.c_str(), str.length());
-        pos += str.length();
+        memcpy(out + SERIAL_HEADER_SIZE, data, length);
     }
+    size_t end = SERIAL_HEADER_SIZE + length;
+    out[end]   = checksum(out, end);
+    return end + 1;
+}
 
-    out[1] = static_cast<uint8_t>(pos - data_offset);
+#ifdef ARDUINO
 
-    if (add_checksum)
+static void write_frame(ImprovSerialType type, const uint8_t *data, size_t length)
+{
+    uint8_t frame[MAX_SERIAL_FRAME_SIZE];
+    size_t  frame_length = build_serial_frame(type, data, length, frame, sizeof(frame));
+    if (frame_length > 0)
     {
-        uint32_t calculated_checksum = 0;
-
-        for (uint8_t byte : out)
-        {
-            calculated_checksum += byte;
-        }
-        // Clear all bits, but the least significant byte
-        calculated_checksum &= 0xFF;
-        out[frame_length - 1] = static_cast<uint8_t>(calculated_checksum);
+        Serial.write(frame, frame_length);
     }
-    return out;
 }
 
-#endif  // ARDUINO
-
 void set_state(State state)
 {
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(11);
-    data[6] = IMPROV_SERIAL_VERSION;
-    data[7] = TYPE_CURRENT_STATE;
-    data[8] = 1;
-    data[9] = state;
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data[10] = checksum;
-
-    Serial.write(data.data(), data.size());
+    uint8_t data = state;
+    write_frame(TYPE_CURRENT_STATE, &data, 1);
 }
 
-void send_response(std::vector<uint8_t> &response)
+void send_response(const uint8_t *response, size_t length)
 {
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(9);
-    data[6] = IMPROV_SERIAL_VERSION;
-    data[7] = TYPE_RPC_RESPONSE;
-    data[8] = response.size();
-    data.insert(data.end(), response.begin(), response.end());
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data.push_back(checksum);
-
-    Serial.write(data.data(), data.size());
+    write_frame(TYPE_RPC_RESPONSE, response, length);
 }
 
 void set_error(Error error)
 {
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(11);
-    data[6] = IMPROV_SERIAL_VERSION;
-    data[7] = TYPE_ERROR_STATE;
-    data[8] = 1;
-    data[9] = error;
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data[10] = checksum;
-
-    Serial.write(data.data(), data.size());
+    uint8_t data = error;
+    write_frame(TYPE_ERROR_STATE, &data, 1);
 }
 
-}  // namespace improv
\ No newline at end of file
+#endif  // ARDUINO
+
+}  // namespace improv
@@ -4,10 +4,10 @@
 #include <Arduino.h>
 #endif  // ARDUINO
 
+#include <cstddef>
 #include <cstdint>
-#include <functional>
-#include <string>
-#include <vector>
+#include <cstring>
+#include <initializer_list>
 
 namespace improv
 {
@@ -60,29 +60,146 @@ enum ImprovSerialType : uint8_t
     TYPE_RPC_RESPONSE  = 0x04
 };
 
+// Serial frame: "IMPROV", version, type, data length, data, checksum
+static const size_t SERIAL_HEADER_SIZE    = 9;
+static const size_t MAX_DATA_SIZE         = 255;
+static const size_t MAX_SERIAL_FRAME_SIZE = SERIAL_HEADER_SIZE + MAX_DATA_SIZE + 1;
+
+// Credentials are kept inline, sized for the longest SSID (32) and WPA2 passphrase (64)
 struct ImprovCommand
 {
-    Command     command;
-    std::string ssid;
-    std::string password;
+    Command command;
+    char    ssid[33];
+    char    password[65];
 };
 
-ImprovCommand parse_improv_data(const std::vector<uint8_t> &data, bool check_checksum = true);
+// Parses an RPC command. A WIFI_SETTINGS command with credentials that don't fit comes back with
+// an empty ssid, so callers treat it as invalid.
 ImprovCommand parse_improv_data(const uint8_t *data, size_t length, bool check_checksum = true);
 
-bool parse_improv_serial_byte(size_t position, uint8_t byte, const uint8_t *buffer,
-                              std::function<bool(ImprovCommand)> &&callback,
-                              std::function<void(Error)>         &&on_error);
+// Sum of all bytes, truncated to 8 bits, as used for every improv checksum
+uint8_t checksum(const uint8_t *data, size_t length);
 
-std::vector<uint8_t> build_rpc_response(Command command, const std::vector<std::string> &datum,
-                                        bool add_checksum = true);
-#ifdef ARDUINO
-std::vector<uint8_t> build_rpc_response(Command command, const std::vector<String> &datum,
-                                        bool add_checksum = true);
-#endif  // ARDUINO
+enum DecodeResult : uint8_t
+{
+    DECODE_PENDING,       // Nothing complete yet, keep feeding bytes
+    DECODE_COMMAND,       // An RPC frame arrived, see SerialDecoder::command()
+    DECODE_BAD_CHECKSUM,  // A whole frame arrived but its checksum didn't match, it was dropped
+};
+
+// Incremental serial frame decoder. Takes one byte at a time, never allocates and resynchronizes
+// on the next "IMPROV" after garbage or a broken frame.
+class SerialDecoder
+{
+   public:
+    SerialDecoder();
+
+    DecodeResult feed(uint8_t byte);
+    void         reset();
+
+    // The last command received, valid after feed() returned DECODE_COMMAND
+    const ImprovCommand &command() const;
+
+   private:
+    enum Stage : uint8_t
+    {
+        STAGE_MAGIC,
+        STAGE_VERSION,
+        STAGE_TYPE,
+        STAGE_LENGTH,
+        STAGE_DATA,
+        STAGE_CHECKSUM,
+    };
+
+    Stage         stage;
+    uint8_t       magic_position;
+    uint8_t       type;
+    uint8_t       length;
+    uint8_t       received;
+    uint8_t       sum;
+    uint8_t       data[MAX_DATA_SIZE];
+    ImprovCommand last_command;
+
+    void restart(uint8_t byte);
+};
+
+// The encoders accept anything with c_str() and length() (std::string, Arduino String) as well as
+// plain C strings
+template <typename T>
+inline const char *string_data(const T &str)
+{
+    return str.c_str();
+}
+template <typename T>
+inline size_t string_length(const T &str)
+{
+    return str.length();
+}
+inline const char *string_data(const char *str)
+{
+    return str;
+}
+inline size_t string_length(const char *str)
+{
+    return strlen(str);
+}
+
+// Encodes an RPC response into out. Returns the number of bytes written, or 0 if the strings
+// don't fit into out or into a single frame.
+template <typename T>
+size_t build_rpc_response(Command command, const T *datum, size_t count, uint8_t *out,
+                          size_t out_size, bool add_checksum = true)
+{
+    const size_t data_offset = 2;
+    size_t       end         = MAX_DATA_SIZE;
+    size_t       pos         = data_offset;
+    if (out_size < end)
+    {
+        end = out_size;
+    }
+    if (end < data_offset + add_checksum)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t length = string_length(datum[i]);
+        if (pos + 1 + length + add_checksum > end)
+        {
+            return 0;
+        }
+        out[pos++] = static_cast<uint8_t>(length);
+        memcpy(out + pos, string_data(datum[i]), length);
+        pos += length;
+    }
 
+    out[0] = command;
+    out[1] = static_cast<uint8_t>(pos - data_offset);
+
+    if (add_checksum)
+    {
+        out[pos] = checksum(out, pos);
+        pos++;
+    }
+    return pos;
+}
+
+template <typename T>
+size_t build_rpc_response(Command command, std::initializer_list<T> datum, uint8_t *out,
+                          size_t out_size, bool add_checksum = true)
+{
+    return build_rpc_response(command, datum.begin(), datum.size(), out, out_size, add_checksum);
+}
+
+// Wraps data into a serial frame. Returns the frame length, or 0 if it doesn't fit into out.
+size_t build_serial_frame(ImprovSerialType type, const uint8_t *data, size_t length, uint8_t *out,
+                          size_t out_size);
+
+#ifdef ARDUINO
 void set_state(State state);
 void set_error(Error error);
-void send_response(std::vector<uint8_t> &response);
+void send_response(const uint8_t *response, size_t length);
+#endif  // ARDUINO
 
-}  // namespace improv
\ No newline at end of file
+}  // namespace improv
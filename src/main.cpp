@@ -1,17 +1,24 @@
 #include <Arduino.h>
 #include <ESPmDNS.h>
 #include <WiFi.h>
+#include <esp_sntp.h>
 
+#include "BootTiming.h"
 #include "ElegooCC.h"
-#include "LittleFS.h"
 #include "Logger.h"
+#include "LoopProfiler.h"
+#include "MemoryPolicy.h"
+#include "PowerManager.h"
+#include "Scheduler.h"
+#include "SdcpProxy.h"
+#include "SessionCheckpoint.h"
 #include "SettingsManager.h"
 #include "WebServer.h"
+#include "WallClock.h"
+#include "WifiManager.h"
 #include "improv.h"
 #include "time.h"
 
-#define SPIFFS LittleFS
-
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 
@@ -29,215 +36,112 @@
 const char* firmwareVersion = GET_VERSION_STRING(FIRMWARE_VERSION_RAW, "dev");
 const char* chipFamily      = GET_VERSION_STRING(CHIP_FAMILY_RAW, "Unknown");
 
-#define WIFI_CHECK_INTERVAL 30000     // Check WiFi every 30 seconds
-#define WIFI_RECONNECT_TIMEOUT 10000  // Wait 10 seconds for reconnection
-#define NTP_SYNC_INTERVAL 3600000     // Re-sync with NTP every hour (3600000 ms)
-
 // NTP server to request epoch time
 const char* ntpServer = "pool.ntp.org";
 
 WebServer webServer(80);
 
-// Variables to track WiFi connection monitoring
-unsigned long lastWifiCheck      = 0;
-unsigned long wifiReconnectStart = 0;
-bool          isReconnecting     = false;
+EspWifiDriver wifiDriver;
+WifiManager   wifiManager(wifiDriver);
+
+// Elegoo gets setup in the loop once WiFi is up, so we need to track if it happened
+bool isElegooSetup = false;
 
-// These things get setup in the loop, not setup, so we need to track if they've happened
-bool isWifiSetup      = false;
-bool isElegooSetup    = false;
-bool isWebServerSetup = false;
-bool isNtpSetup       = false;
+// Set while an improv WIFI_SETTINGS request waits for the connection result
+bool isImprovProvisioning = false;
 
+// Max serial bytes consumed per loop, so a flood of input (even garbage from a connected host)
+// can't starve filament monitoring
+#define IMPROV_MAX_BYTES_PER_LOOP 64
 // Used by improv-wifi to parse serial data
-uint8_t x_buffer[16];
-uint8_t x_position = 0;
+improv::SerialDecoder improvDecoder;
 
-// Variables to track NTP synchronization
-unsigned long lastNTPSyncAttempt = 0;
+// Async network scan requested over improv, results are sent one per loop once it finishes
+bool isWifiScanPending   = false;
+int  wifiScanResultIndex = 0;
 
-// If wifi fails, revert to AP mode and restart (only if never connected before);
-void failWifi()
+// Set by the SNTP task when the clock gets synchronized
+volatile bool isTimeSynced = false;
+
+void sendLocalUrl(improv::Command command);
+
+// Credentials that never worked, revert to AP mode (only if never connected before)
+void onWifiFirstConnectFailed()
 {
-    // Only revert to AP mode if WiFi has never successfully connected
-    if (!settingsManager.getHasConnected())
+    settingsManager.setAPMode(true);
+    if (settingsManager.save(true))  // skip wifi check, the wifi manager is switching already
     {
-        settingsManager.setAPMode(true);
-        if (settingsManager.save())
-        {
-            logger.log("Failed to connect to wifi, reverted to AP mode (first connection attempt)");
-        }
-        else
-        {
-            logger.log("Failed to update settings");
-        }
-
-        delay(1000);  // Give time for serial output
-        ESP.restart();
+        logger.log("Failed to connect to wifi, reverted to AP mode (first connection attempt)");
     }
     else
     {
-        logger.log("WiFi connection failed, retrying in 30 seconds");
-        // Don't restart, just continue trying to reconnect in checkWifiConnection()
+        logger.log("Failed to update settings");
     }
 }
 
-void startAPMode()
+void onWifiStateChange(wifi_state_t state)
 {
-    logger.log("Starting AP mode");
-    WiFi.softAP("ElegooXBTTSFS20", "elegooccsfs20");
-    // Stop mDNS as it's not needed in AP mode
-    MDNS.end();
-}
-
-void handleSuccessfulWifiConnection()
-{
-    logger.log("WiFi Connected");
-
-    // Mark that WiFi has successfully connected at least once
-    if (!settingsManager.getHasConnected())
-    {
-        settingsManager.setHasConnected(true);
-        settingsManager.save();
-        logger.log("First successful WiFi connection recorded");
-    }
-
-    // Reset any reconnection state
-    isReconnecting = false;
-
-    // Start/restart mDNS for station mode
-    MDNS.end();
-    if (!MDNS.begin("ccxsfs20"))
+    switch (state)
     {
-        logger.log("Error setting up MDNS responder!");
-    }
-}
+        case WIFI_STATE_CONNECTED:
+            bootTiming.mark(BOOT_PHASE_WIFI_CONNECTED);
 
-bool connectToWifiStation(bool isReconnect = false)
-{
-    const char* action = isReconnect ? "Reconnecting to" : "Connecting to";
-    logger.logf("%s WiFi: %s", action, settingsManager.getSSID().c_str());
+            // Mark that WiFi has successfully connected at least once
+            if (!settingsManager.getHasConnected())
+            {
+                settingsManager.setHasConnected(true);
+                settingsManager.requestSave();
+                logger.log("First successful WiFi connection recorded");
+            }
 
-    WiFi.begin(settingsManager.getSSID().c_str(), settingsManager.getPassword().c_str());
+            // Start/restart mDNS for station mode
+            MDNS.end();
+            if (!MDNS.begin("ccxsfs20"))
+            {
+                logger.log("Error setting up MDNS responder!");
+            }
 
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30)
-    {
-        Serial.print('.');
-        delay(1000);
-        attempts++;
-    }
+            if (isImprovProvisioning)
+            {
+                isImprovProvisioning = false;
+                improv::set_state(improv::STATE_PROVISIONED);
+                sendLocalUrl(improv::WIFI_SETTINGS);
+            }
+            break;
 
-    Serial.println();
+        case WIFI_STATE_AP:
+            // Stop mDNS as it's not needed in AP mode
+            MDNS.end();
+            // fall through
+        case WIFI_STATE_WAITING_RETRY:
+            if (isImprovProvisioning)
+            {
+                isImprovProvisioning = false;
+                improv::set_state(improv::STATE_STOPPED);
+                improv::set_error(improv::Error::ERROR_UNABLE_TO_CONNECT);
+            }
+            break;
 
-    if (WiFi.status() == WL_CONNECTED)
-    {
-        handleSuccessfulWifiConnection();
-        return true;
-    }
-    else
-    {
-        if (isReconnect)
-        {
-            logger.log("Failed to connect with new WiFi credentials");
-        }
-        else
-        {
-            failWifi();
-        }
-        return false;
+        default:
+            break;
     }
 }
 
-void cleanupWifiConnections()
-{
-    // Stop AP mode if it was running
-    WiFi.softAPdisconnect(true);
-    // Disconnect from any existing station connection
-    WiFi.disconnect(true);
-    delay(1000);
-}
-
-bool wifiSetup()
+// (Re)starts WiFi from the current settings, returns immediately
+void startWifi()
 {
-    if (settingsManager.isAPMode())
-    {
-        startAPMode();
-        logger.log("Wifi setup in AP mode");
-        return false;
-    }
-    else
-    {
-        return connectToWifiStation(false);
-    }
+    wifiDriver.setStaticIP(settingsManager.getStaticIP().c_str(),
+                           settingsManager.getGateway().c_str(),
+                           settingsManager.getSubnet().c_str(), settingsManager.getDNS().c_str());
+    wifiManager.begin(settingsManager.getAPMode(), settingsManager.getSSID().c_str(),
+                      settingsManager.getPassword().c_str(), settingsManager.getHasConnected(),
+                      millis());
 }
 
-bool reconnectWifiWithNewCredentials()
+void onTimeSynced(struct timeval* tv)
 {
-    logger.log("Applying new WiFi credentials...");
-
-    // Clean up any existing connections first
-    cleanupWifiConnections();
-
-    // Check if we're switching to AP mode
-    if (settingsManager.isAPMode())
-    {
-        logger.log("Switching to AP mode");
-        startAPMode();
-        return false;
-    }
-
-    // We're switching to or staying in station mode
-    logger.log("Connecting to WiFi station mode with new credentials...");
-    return connectToWifiStation(true);
-}
-
-void checkWifiConnection()
-{
-    logger.log("Checking WiFi connection");
-
-    // Skip check if already in AP mode
-    if (settingsManager.isAPMode())
-    {
-        logger.log("Skipping WiFi check in AP mode");
-        return;
-    }
-
-    // Check if WiFi is connected
-    if (WiFi.status() != WL_CONNECTED)
-    {
-        if (!isReconnecting)
-        {
-            logger.log("WiFi disconnected, attempting to reconnect...");
-            WiFi.begin(settingsManager.getSSID().c_str(), settingsManager.getPassword().c_str());
-            wifiReconnectStart = millis();
-            isReconnecting     = true;
-        }
-        else
-        {
-            // Check if reconnection timeout has elapsed
-            if (millis() - wifiReconnectStart >= WIFI_RECONNECT_TIMEOUT)
-            {
-                failWifi();
-            }
-        }
-    }
-    else
-    {
-        // WiFi is connected, reset reconnection state
-        if (isReconnecting)
-        {
-            logger.log("WiFi reconnected successfully");
-            isReconnecting = false;
-
-            // Mark that WiFi has successfully connected at least once
-            if (!settingsManager.getHasConnected())
-            {
-                settingsManager.setHasConnected(true);
-                settingsManager.save();
-            }
-        }
-    }
+    wallClock.setFromNtp(*tv);
+    isTimeSynced = true;
 }
 
 void setup()
@@ -247,73 +151,109 @@ void setup()
     pinMode(MOVEMENT_SENSOR_PIN, INPUT_PULLUP);
     Serial.begin(115200);
 
+    // Sensor edges, serial input and WiFi events wake the loop, see the end of loop()
+    powerManager.begin();
+#if !ARDUINO_USB_CDC_ON_BOOT
+    // With USB CDC (the XIAO) Serial has no receive callback, the loop then sees input within
+    // IDLE_MAX_WAIT_MS
+    Serial.onReceive([]() { powerManager.notify(); });
+#endif
+    WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info)
+                 { powerManager.notify(); });
+
     // Initialize logging system
     logger.log("ESP SFS System starting up...");
     logger.logf("Firmware version: %s", firmwareVersion);
     logger.logf("Chip family: %s", chipFamily);
 
-    SPIFFS.begin();  // note: this must be done before wifi/server setup
-    logger.log("Filesystem initialized");
+    // Before anything can overwrite the checkpoint of a print we were monitoring
+    sessionCheckpoint.begin();
 
-    // Load settings early
+    // Load settings early. They're in NVS, LittleFS is mounted later by the web server.
     settingsManager.load();
     logger.log("Settings Manager Loaded");
-}
+    bootTiming.mark(BOOT_PHASE_SETTINGS_LOADED);
 
-void syncTimeWithNTP(unsigned long currentTime)
-{
-    struct tm timeinfo;
-    lastNTPSyncAttempt = currentTime;
-    if (getLocalTime(&timeinfo))
-    {
-        logger.log("NTP time synchronization successful");
-    }
-    else
-    {
-        logger.log("NTP time synchronization failed");
-    }
-}
+    loopProfiler.begin();
 
-unsigned long getTime()
-{
-    time_t now;
-    time(&now);
-    return now;
+    // None of these block, so bring everything up at once and let WiFi connect in the background.
+    // The web server and SNTP simply start working once there's a network.
+    wifiManager.onStateChange        = onWifiStateChange;
+    wifiManager.onFirstConnectFailed = onWifiFirstConnectFailed;
+    wifiManager.onLog                = [](const char *message) { logger.log(message); };
+    startWifi();
+    bootTiming.mark(BOOT_PHASE_WIFI_STARTED);
+
+    webServer.begin();
+    logger.log("Webserver setup complete");
+    bootTiming.mark(BOOT_PHASE_WEBSERVER_STARTED);
+
+    // SNTP keeps re-syncing on its own (hourly by default), we only get told when it succeeded
+    sntp_set_time_sync_notification_cb(onTimeSynced);
+    configTime(0, 0, ntpServer);
+
+    // Everything that stays allocated for good is in place now
+    memoryPolicy.begin();
 }
 
+
 void onImprovErrorCallback(improv::Error err)
 {
     logger.logf("Improv error: %d", err);
 }
 
-std::vector<std::string> getLocalUrl()
+void sendLocalUrl(improv::Command command)
 {
-    return {// URL where user can finish onboarding or use device
-            // Recommended to use website hosted by device
-            String("http://" + WiFi.localIP().toString()).c_str()};
+    // URL where user can finish onboarding or use device
+    // Recommended to use website hosted by device
+    String  url = "http://" + WiFi.localIP().toString();
+    uint8_t data[improv::MAX_DATA_SIZE];
+    size_t  length = improv::build_rpc_response<String>(command, {url}, data, sizeof(data), false);
+    improv::send_response(data, length);
 }
 
 void getAvailableWifiNetworks()
 {
-    int networkNum = WiFi.scanNetworks();
+    // Don't block on the scan, sendWifiScanResults() picks up the results from the loop
+    if (!isWifiScanPending && WiFi.scanNetworks(true) != WIFI_SCAN_FAILED)
+    {
+        isWifiScanPending   = true;
+        wifiScanResultIndex = 0;
+    }
+}
+
+void sendWifiScanResults()
+{
+    int networkNum = WiFi.scanComplete();
+    if (networkNum == WIFI_SCAN_RUNNING)
+    {
+        return;
+    }
 
-    for (int id = 0; id < networkNum; ++id)
+    // One network per loop keeps each serial write short
+    if (wifiScanResultIndex < networkNum)
     {
-        std::vector<uint8_t> data =
-            improv::build_rpc_response(improv::GET_WIFI_NETWORKS,
-                                       {WiFi.SSID(id), String(WiFi.RSSI(id)),
-                                        (WiFi.encryptionType(id) == WIFI_AUTH_OPEN ? "NO" : "YES")},
-                                       false);
-        improv::send_response(data);
-        delay(1);
+        int     id = wifiScanResultIndex++;
+        uint8_t data[improv::MAX_DATA_SIZE];
+        size_t  length = improv::build_rpc_response<String>(
+            improv::GET_WIFI_NETWORKS,
+            {WiFi.SSID(id), String(WiFi.RSSI(id)),
+             (WiFi.encryptionType(id) == WIFI_AUTH_OPEN ? "NO" : "YES")},
+            data, sizeof(data), false);
+        improv::send_response(data, length);
+        return;
     }
+
     // final response
-    std::vector<uint8_t> data =
-        improv::build_rpc_response(improv::GET_WIFI_NETWORKS, std::vector<std::string>{}, false);
-    improv::send_response(data);
+    uint8_t data[improv::MAX_DATA_SIZE];
+    size_t  length = improv::build_rpc_response<const char *>(improv::GET_WIFI_NETWORKS, {}, data,
+                                                              sizeof(data), false);
+    improv::send_response(data, length);
+    WiFi.scanDelete();
+    isWifiScanPending = false;
 }
 
-bool onImprovCommandCallback(improv::ImprovCommand cmd)
+bool onImprovCommandCallback(const improv::ImprovCommand &cmd)
 {
     switch (cmd.command)
     {
@@ -322,9 +262,7 @@ bool onImprovCommandCallback(improv::ImprovCommand cmd)
             if ((WiFi.status() == WL_CONNECTED))
             {
                 improv::set_state(improv::State::STATE_PROVISIONED);
-                std::vector<uint8_t> data =
-                    improv::build_rpc_response(improv::GET_CURRENT_STATE, getLocalUrl(), false);
-                improv::send_response(data);
+                sendLocalUrl(improv::GET_CURRENT_STATE);
             }
             else
             {
@@ -336,7 +274,7 @@ bool onImprovCommandCallback(improv::ImprovCommand cmd)
 
         case improv::Command::WIFI_SETTINGS:
         {
-            if (cmd.ssid.length() == 0)
+            if (cmd.ssid[0] == '\0')
             {
                 improv::set_error(improv::Error::ERROR_INVALID_RPC);
                 break;
@@ -344,40 +282,32 @@ bool onImprovCommandCallback(improv::ImprovCommand cmd)
 
             improv::set_state(improv::STATE_PROVISIONING);
 
-            settingsManager.setSSID(cmd.ssid.c_str());
-            settingsManager.setPassword(cmd.password.c_str());
+            settingsManager.setSSID(cmd.ssid);
+            settingsManager.setPassword(cmd.password);
             settingsManager.setAPMode(false);
             settingsManager.save(true);  // skip wifi check, we're about to try connecting
 
-            if (reconnectWifiWithNewCredentials())  // connectWifi(cmd.ssid, cmd.password)
-            {
-                improv::set_state(improv::STATE_PROVISIONED);
-                std::vector<uint8_t> data =
-                    improv::build_rpc_response(improv::WIFI_SETTINGS, getLocalUrl(), false);
-                improv::send_response(data);
-            }
-            else
-            {
-                improv::set_state(improv::STATE_STOPPED);
-                improv::set_error(improv::Error::ERROR_UNABLE_TO_CONNECT);
-            }
-
+            // The result is reported from onWifiStateChange once the connection settles
+            logger.log("Applying new WiFi credentials...");
+            isImprovProvisioning = true;
+            startWifi();
             break;
         }
 
         case improv::Command::GET_DEVICE_INFO:
         {
-            std::vector<std::string> infos = {// Firmware name
-                                              "CC_SFS",
-                                              // Firmware version
-                                              firmwareVersion,
-                                              // Hardware chip/variant
-                                              chipFamily,
-                                              // Device name
-                                              "CC_SFS"};
-            std::vector<uint8_t>     data =
-                improv::build_rpc_response(improv::GET_DEVICE_INFO, infos, false);
-            improv::send_response(data);
+            const char *infos[] = {// Firmware name
+                                   "CC_SFS",
+                                   // Firmware version
+                                   firmwareVersion,
+                                   // Hardware chip/variant
+                                   chipFamily,
+                                   // Device name
+                                   "CC_SFS"};
+            uint8_t     data[improv::MAX_DATA_SIZE];
+            size_t      length = improv::build_rpc_response(improv::GET_DEVICE_INFO, infos, 4, data,
+                                                            sizeof(data), false);
+            improv::send_response(data, length);
             break;
         }
 
@@ -397,86 +327,96 @@ bool onImprovCommandCallback(improv::ImprovCommand cmd)
     return true;
 }
 
-bool handleImprovWifi()
+void handleImprovWifi()
 {
-    if (Serial.available() > 0)
+    for (int i = 0; i < IMPROV_MAX_BYTES_PER_LOOP && Serial.available() > 0; i++)
     {
-        uint8_t b = Serial.read();
-
-        if (parse_improv_serial_byte(x_position, b, x_buffer, onImprovCommandCallback,
-                                     onImprovErrorCallback))
-        {
-            x_buffer[x_position++] = b;
-        }
-        else
+        switch (improvDecoder.feed(Serial.read()))
         {
-            x_position = 0;
+            case improv::DECODE_COMMAND:
+                onImprovCommandCallback(improvDecoder.command());
+                break;
+            case improv::DECODE_BAD_CHECKSUM:
+                onImprovErrorCallback(improv::ERROR_INVALID_RPC);
+                break;
+            default:
+                break;
         }
-        return true;
     }
-    return false;
+
+    if (isWifiScanPending)
+    {
+        sendWifiScanResults();
+    }
 }
 
 void loop()
 {
-    // handling immprovWifi should be the first thing we do
-    if (handleImprovWifi())
-    {
-        // if we handled serial data, don't return so we don't bother with the rest of the setup
-        return;
-    }
-    unsigned long currentTime     = millis();
-    bool          isWifiConnected = !settingsManager.isAPMode() && WiFi.status() == WL_CONNECTED;
+    loopProfiler.beginIteration();
 
-    if (!isWifiSetup)
-    {
-        isWifiSetup = wifiSetup();
-        isWifiSetup = true;
-        logger.log("Wifi setup complete");
-        return;  //
-    }
-    if (!isWebServerSetup)
-    {
-        webServer.begin();
-        isWebServerSetup = true;
-        logger.log("Webserver setup complete");
-        return;  //
-    }
+    // Bounded amount of improv work per iteration, the rest of the loop always runs
+    handleImprovWifi();
 
-    // Check if WiFi reconnection is requested
+    // Flush any settings changes that have settled since the last write
+    loopProfiler.enter(LOOP_SECTION_SETTINGS);
+    settingsManager.loop();
 
+    unsigned long currentTime = millis();
+
+    // Check if WiFi reconnection is requested
+    loopProfiler.enter(LOOP_SECTION_WIFI);
     if (settingsManager.requestWifiReconnect)
     {
         settingsManager.requestWifiReconnect = false;
-        reconnectWifiWithNewCredentials();
+        logger.log("Applying new WiFi credentials...");
+        startWifi();
     }
 
-    if (isWifiConnected)
+    wifiManager.loop(currentTime);
+
+    // Timed work (keepalives, timeouts) registered by the subsystems
+    loopProfiler.enter(LOOP_SECTION_SCHEDULER);
+    scheduler.run(currentTime);
+
+    if (wifiManager.isConnected() && !isElegooSetup)
     {
-        if (!isElegooSetup)
-        {
-            elegooCC.setup();
-            logger.log("Elegoo setup complete");
-            isElegooSetup = true;
-        }
-        elegooCC.loop();
+        elegooCC.setup();
+        sdcpProxy.setup();
+        logger.log("Elegoo setup complete");
+        isElegooSetup = true;
+    }
 
-        if (!isNtpSetup)
-        {
-            configTime(0, 0, ntpServer);
-            syncTimeWithNTP(currentTime);
-            logger.log("NTP setup complete");
-            isNtpSetup = true;
-        }
-        else if (currentTime - lastNTPSyncAttempt >= NTP_SYNC_INTERVAL)
-        {
-            syncTimeWithNTP(currentTime);
-        }
+    if (isTimeSynced)
+    {
+        isTimeSynced = false;
+        logger.log("NTP time synchronization successful");
+        bootTiming.mark(BOOT_PHASE_TIME_SYNCED);
     }
-    else if (currentTime - lastWifiCheck >= WIFI_CHECK_INTERVAL)
+
+    // Keep watching the sensors even while WiFi is down, the websocket reconnects on its own and
+    // a pause can go out as soon as it's back
+    if (isElegooSetup)
     {
-        checkWifiConnection();
+        elegooCC.loop();
+        sdcpProxy.loop();
     }
 
+    loopProfiler.enter(LOOP_SECTION_WEBSERVER);
     webServer.loop();
+    loopProfiler.endIteration();
+
+    // Sleep until the next deadline or event. Only scheduling work that's already due or serial
+    // input we haven't drained keeps the loop spinning.
+    currentTime        = millis();
+    unsigned long wait = scheduler.timeUntilNextJob(currentTime, IDLE_MAX_WAIT_MS);
+    wait               = min(wait, wifiManager.timeUntilDeadline(currentTime));
+    if (isElegooSetup)
+    {
+        wait = min(wait, elegooCC.timeUntilNextCheck(currentTime));
+    }
+    if (isWifiScanPending || Serial.available() > 0)
+    {
+        wait = 0;
+    }
+    powerManager.idle(wait);
 }
@@ -0,0 +1,122 @@
+# Builds the patch test/test_delta_patch applies, with make_delta.py itself, so the host test
+# always runs against what the generator currently produces. Runs before the native build and
+# writes $BUILD_DIR/generated/delta_fixture.h, like pack_webui.py does for the firmware.
+#
+# With DELTA_OLD_FIRMWARE and DELTA_NEW_FIRMWARE pointing at two firmware.bin builds it also makes
+# the patch between those, which the test applies and reports transfer size and apply time for:
+#
+#   DELTA_OLD_FIRMWARE=old/firmware.bin DELTA_NEW_FIRMWARE=new/firmware.bin \
+#       pio test -e native -f test_delta_patch -v
+Import("env")
+import gzip
+import hashlib
+import json
+import os
+import random
+import sys
+
+sys.path.insert(0, env.subst("$PROJECT_DIR"))
+import make_delta  # noqa: E402
+
+OUTPUT_DIR = os.path.join(env.subst("$BUILD_DIR"), "generated")
+OUTPUT = os.path.join(OUTPUT_DIR, "delta_fixture.h")
+FIRMWARE_PATCH = os.path.join(OUTPUT_DIR, "delta_firmware.delta")
+
+OLD_SIZE = 128 * 1024
+OLD_SEED = 0x5F5D2024
+
+
+def old_image():
+    """xorshift32 bytes, the test generates the same ones instead of embedding them"""
+    state = OLD_SEED
+    image = bytearray(OLD_SIZE)
+    for i in range(OLD_SIZE):
+        state ^= (state << 13) & 0xFFFFFFFF
+        state ^= state >> 17
+        state ^= (state << 5) & 0xFFFFFFFF
+        image[i] = state & 0xFF
+    return bytes(image)
+
+
+def new_image(old):
+    rng = random.Random(OLD_SEED)
+    # Every 20th byte changed is too often for a match but mostly zero as a DIFF, like code that
+    # moved. 72KB of it means more than two turns around the 32KB inflate window.
+    moved = bytearray(old[20000:92000])
+    for i in range(0, len(moved), 20):
+        moved[i] = (moved[i] + 1) & 0xFF
+    inserted = bytes(rng.randrange(256) for _ in range(5000))
+    return (old[:20000] + bytes(moved) + old[92000:100000] + inserted + old[100000:120000] +
+            old[30000:40000])
+
+
+def fnv1a(data):
+    value = 0x811C9DC5
+    for byte in data:
+        value = ((value ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return value
+
+
+def firmware_patch():
+    """Defines for the patch between two real builds, none when they weren't given"""
+    old_path = os.environ.get("DELTA_OLD_FIRMWARE")
+    new_path = os.environ.get("DELTA_NEW_FIRMWARE")
+    if not old_path or not new_path:
+        return []
+
+    with open(old_path, "rb") as f:
+        old = f.read()
+    with open(new_path, "rb") as f:
+        new = f.read()
+    patch = make_delta.make_patch(old, new)
+    with open(FIRMWARE_PATCH, "wb") as f:
+        f.write(patch)
+    print(f"Delta test: patch from {old_path} to {new_path} is {len(patch)} bytes")
+
+    # Paths as C strings, the test reads the files when it runs
+    return [
+        f"#define DELTA_FIRMWARE_OLD {json.dumps(os.path.abspath(old_path))}",
+        f"#define DELTA_FIRMWARE_NEW {json.dumps(os.path.abspath(new_path))}",
+        f"#define DELTA_FIRMWARE_PATCH {json.dumps(FIRMWARE_PATCH)}",
+        f'#define DELTA_FIRMWARE_OLD_MD5 "{hashlib.md5(old).hexdigest()}"',
+        f"#define DELTA_FIRMWARE_GZIP_SIZE {len(gzip.compress(new, 9))}",
+        "",
+    ]
+
+
+def render(old, new, patch, ops, firmware):
+    lines = ["// Generated by test/delta_fixture.py, do not edit", ""]
+    lines += firmware
+    lines.append(f"#define DELTA_FIXTURE_OLD_SIZE {len(old)}")
+    lines.append(f"#define DELTA_FIXTURE_OLD_SEED 0x{OLD_SEED:08X}u")
+    lines.append(f'#define DELTA_FIXTURE_OLD_MD5 "{hashlib.md5(old).hexdigest()}"')
+    lines.append(f"#define DELTA_FIXTURE_NEW_SIZE {len(new)}")
+    lines.append(f"#define DELTA_FIXTURE_NEW_FNV 0x{fnv1a(new):08X}u")
+    lines.append(f"#define DELTA_FIXTURE_OPS_SIZE {len(ops)}")
+    lines.append(f"#define DELTA_FIXTURE_PATCH_SIZE {len(patch)}")
+    lines.append("")
+    lines.append("static const uint8_t deltaFixture[] = {")
+    for start in range(0, len(patch), 24):
+        lines.append("    " + ", ".join(str(b) for b in patch[start:start + 24]) + ",")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def generate():
+    old = old_image()
+    new = new_image(old)
+    patch = make_delta.make_patch(old, new)
+    if make_delta.apply_patch(old, patch) != new:
+        sys.exit("make_delta.py doesn't rebuild its own test image")
+    os.makedirs(OUTPUT_DIR, exist_ok=True)
+    content = render(old, new, patch, make_delta.diff_images(old, new), firmware_patch())
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, "r") as f:
+            if f.read() == content:
+                return
+    with open(OUTPUT, "w") as f:
+        f.write(content)
+
+
+generate()
+env.Append(CPPPATH=[OUTPUT_DIR])
@@ -0,0 +1,147 @@
+#ifndef TEST_MINIZ_H
+#define TEST_MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+// Host stand-in for the inflater in ROM (tinfl), built on zlib. Besides inflating it checks the
+// contract the ROM version relies on without checking it itself: output goes into one 32KB
+// window, continues where the previous call stopped, and the caller leaves what's already in
+// the window alone, since that's the history back references read from. Breaking it fails the
+// call like a corrupt stream would.
+
+typedef unsigned char mz_uint8;
+typedef unsigned int  mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum
+{
+    TINFL_FLAG_PARSE_ZLIB_HEADER             = 1,
+    TINFL_FLAG_HAS_MORE_INPUT                = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+};
+
+typedef enum
+{
+    TINFL_STATUS_BAD_PARAM         = -3,
+    TINFL_STATUS_ADLER32_MISMATCH  = -2,
+    TINFL_STATUS_FAILED            = -1,
+    TINFL_STATUS_DONE              = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT  = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT   = 2,
+} tinfl_status;
+
+// zlib's state and window come out of the decompressor itself, so like the ROM version it can be
+// freed at any point without cleaning up
+#define TINFL_ZLIB_ARENA_SIZE (48 * 1024)
+
+typedef struct
+{
+    mz_uint32 m_state;  // 0 before the first call, 1 inflating, 2 at the end, 3 failed
+    z_stream  stream;
+    size_t    position;                    // Where the next call has to continue
+    mz_uint8  history[TINFL_LZ_DICT_SIZE];  // What the window has to still hold
+    size_t    arenaUsed;
+    mz_uint8  arena[TINFL_ZLIB_ARENA_SIZE];
+} tinfl_decompressor;
+
+static inline voidpf tinfl_zlib_alloc(voidpf opaque, uInt items, uInt size)
+{
+    tinfl_decompressor *r      = (tinfl_decompressor *) opaque;
+    size_t              length = ((size_t) items * size + 15) & ~(size_t) 15;
+    if (r->arenaUsed + length > TINFL_ZLIB_ARENA_SIZE)
+    {
+        return Z_NULL;
+    }
+    voidpf block = r->arena + r->arenaUsed;
+    r->arenaUsed += length;
+    return block;
+}
+
+static inline void tinfl_zlib_free(voidpf, voidpf)
+{
+}
+
+#define tinfl_init(r)     \
+    do                    \
+    {                     \
+        (r)->m_state = 0; \
+    } while (0)
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next,
+                                            size_t *pIn_buf_size, mz_uint8 *pOut_buf_start,
+                                            mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                                            const mz_uint32 decomp_flags)
+{
+    size_t offset = pOut_buf_next - pOut_buf_start;
+    if (r->m_state == 0)
+    {
+        memset(&r->stream, 0, sizeof(r->stream));
+        r->stream.zalloc = tinfl_zlib_alloc;
+        r->stream.zfree  = tinfl_zlib_free;
+        r->stream.opaque = r;
+        r->arenaUsed     = 0;
+        if (inflateInit2(&r->stream, -15) != Z_OK)
+        {
+            r->m_state = 3;
+            return TINFL_STATUS_FAILED;
+        }
+        memcpy(r->history, pOut_buf_start, TINFL_LZ_DICT_SIZE);
+        r->position = 0;
+        r->m_state  = 1;
+    }
+
+    size_t inSize  = *pIn_buf_size;
+    size_t outSize = *pOut_buf_size;
+    *pIn_buf_size  = 0;
+    *pOut_buf_size = 0;
+    if (r->m_state == 2)
+    {
+        return TINFL_STATUS_DONE;
+    }
+    if (r->m_state == 3)
+    {
+        return TINFL_STATUS_FAILED;
+    }
+
+    if ((decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) ||
+        offset + outSize != TINFL_LZ_DICT_SIZE || offset != r->position ||
+        memcmp(pOut_buf_start, r->history, TINFL_LZ_DICT_SIZE) != 0)
+    {
+        r->m_state = 3;
+        return TINFL_STATUS_BAD_PARAM;
+    }
+
+    r->stream.next_in   = (Bytef *) pIn_buf_next;
+    r->stream.avail_in  = (uInt) inSize;
+    r->stream.next_out  = pOut_buf_next;
+    r->stream.avail_out = (uInt) outSize;
+    int result          = inflate(&r->stream, Z_NO_FLUSH);
+
+    *pIn_buf_size  = inSize - r->stream.avail_in;
+    *pOut_buf_size = outSize - r->stream.avail_out;
+    memcpy(r->history + offset, pOut_buf_next, *pOut_buf_size);
+    r->position = (offset + *pOut_buf_size) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (result == Z_STREAM_END)
+    {
+        r->m_state = 2;
+        return TINFL_STATUS_DONE;
+    }
+    if (result != Z_OK && result != Z_BUF_ERROR)
+    {
+        r->m_state = 3;
+        return TINFL_STATUS_FAILED;
+    }
+    if (r->stream.avail_out == 0)
+    {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT
+                                                     : TINFL_STATUS_FAILED;
+}
+
+#endif  // TEST_MINIZ_H
@@ -0,0 +1,7 @@
+#ifndef TEST_SDKCONFIG_H
+#define TEST_SDKCONFIG_H
+
+// Host builds have no SDK configuration, nothing is set. The code under test then takes the
+// plain ESP32 paths.
+
+#endif  // TEST_SDKCONFIG_H
@@ -0,0 +1,262 @@
+#include <esp32/rom/miniz.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <vector>
+
+#include "DeltaPatch.h"
+#include "delta_fixture.h"
+
+// Applies the patch test/delta_fixture.py made with make_delta.py to the image it was made
+// against, fed in different chunk sizes so ops, their arguments and DIFF/INSERT data get split
+// across writes and across the inflate window wrapping around. Given two real firmware builds
+// (see test/delta_fixture.py), it also applies the patch between those and reports what an update
+// with it costs.
+
+static std::vector<uint8_t> oldImage;
+static std::vector<uint8_t> newImage;
+
+static void buildOldImage()
+{
+    uint32_t state = DELTA_FIXTURE_OLD_SEED;
+    oldImage.resize(DELTA_FIXTURE_OLD_SIZE);
+    for (size_t i = 0; i < oldImage.size(); i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        oldImage[i] = state & 0xFF;
+    }
+}
+
+static uint32_t fnv1a(const std::vector<uint8_t> &data)
+{
+    uint32_t value = 0x811C9DC5;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        value = (value ^ data[i]) * 0x01000193;
+    }
+    return value;
+}
+
+static bool readOld(uint32_t offset, uint8_t *buffer, size_t length)
+{
+    if (offset + length > oldImage.size())
+    {
+        return false;
+    }
+    memcpy(buffer, oldImage.data() + offset, length);
+    return true;
+}
+
+static bool writeNew(uint8_t *data, size_t length)
+{
+    newImage.insert(newImage.end(), data, data + length);
+    return true;
+}
+
+static bool beginPatch(DeltaPatch &patch, const char *md5)
+{
+    return patch.begin(DELTA_FIXTURE_OLD_SIZE, md5, readOld, writeNew);
+}
+
+static bool writeInChunks(DeltaPatch &patch, const uint8_t *data, size_t length, size_t chunk)
+{
+    for (size_t offset = 0; offset < length; offset += chunk)
+    {
+        size_t take = length - offset < chunk ? length - offset : chunk;
+        if (!patch.write(data + offset, take))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef DELTA_FIRMWARE_PATCH
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t  length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + length);
+    }
+    fclose(file);
+    return true;
+}
+#endif
+
+void setUp(void)
+{
+    newImage.clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_fixture_wraps_the_window(void)
+{
+    // Otherwise the tests below would prove nothing about the wrap
+    TEST_ASSERT_GREATER_THAN(2 * TINFL_LZ_DICT_SIZE, DELTA_FIXTURE_OPS_SIZE);
+}
+
+void test_rebuilds_the_image_in_any_chunk_size(void)
+{
+    static const size_t chunks[] = {1, 3, 7, 48, 49, 512, 1436, DELTA_FIXTURE_PATCH_SIZE};
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        DeltaPatch patch;
+        newImage.clear();
+        TEST_ASSERT_TRUE(beginPatch(patch, DELTA_FIXTURE_OLD_MD5));
+        bool applied = writeInChunks(patch, deltaFixture, sizeof(deltaFixture), chunks[i]);
+        TEST_ASSERT_TRUE_MESSAGE(applied, patch.getError());
+        TEST_ASSERT_TRUE_MESSAGE(patch.finish(), patch.getError());
+        TEST_ASSERT_EQUAL_UINT32(DELTA_FIXTURE_NEW_SIZE, patch.getWritten());
+        TEST_ASSERT_EQUAL_UINT32(DELTA_FIXTURE_NEW_SIZE, newImage.size());
+        TEST_ASSERT_EQUAL_HEX32(DELTA_FIXTURE_NEW_FNV, fnv1a(newImage));
+        patch.end();
+    }
+}
+
+void test_header_is_available_after_48_bytes(void)
+{
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(beginPatch(patch, DELTA_FIXTURE_OLD_MD5));
+    TEST_ASSERT_TRUE(patch.write(deltaFixture, DELTA_HEADER_SIZE - 1));
+    TEST_ASSERT_FALSE(patch.hasHeader());
+    TEST_ASSERT_TRUE(patch.write(deltaFixture + DELTA_HEADER_SIZE - 1, 1));
+    TEST_ASSERT_TRUE(patch.hasHeader());
+    TEST_ASSERT_EQUAL_UINT32(DELTA_FIXTURE_OLD_SIZE, patch.getHeader().oldSize);
+    TEST_ASSERT_EQUAL_UINT32(DELTA_FIXTURE_NEW_SIZE, patch.getHeader().newSize);
+    TEST_ASSERT_EQUAL_STRING(DELTA_FIXTURE_OLD_MD5, patch.getHeader().oldMd5);
+}
+
+void test_refuses_a_patch_for_other_firmware(void)
+{
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(beginPatch(patch, "0123456789abcdef0123456789abcdef"));
+    TEST_ASSERT_FALSE(patch.write(deltaFixture, sizeof(deltaFixture)));
+    TEST_ASSERT_EQUAL_STRING("patch is for a different firmware than the one running",
+                             patch.getError());
+    TEST_ASSERT_EQUAL_UINT32(0, newImage.size());
+}
+
+void test_refuses_what_isnt_a_patch(void)
+{
+    uint8_t notAPatch[DELTA_HEADER_SIZE];
+    memcpy(notAPatch, deltaFixture, sizeof(notAPatch));
+    notAPatch[0] = 'X';
+
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(beginPatch(patch, DELTA_FIXTURE_OLD_MD5));
+    TEST_ASSERT_FALSE(patch.write(notAPatch, sizeof(notAPatch)));
+    TEST_ASSERT_EQUAL_STRING("not a delta patch", patch.getError());
+}
+
+void test_truncated_patch_is_incomplete(void)
+{
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(beginPatch(patch, DELTA_FIXTURE_OLD_MD5));
+    TEST_ASSERT_TRUE(patch.write(deltaFixture, sizeof(deltaFixture) / 2));
+    TEST_ASSERT_FALSE(patch.finish());
+    TEST_ASSERT_EQUAL_STRING("patch is incomplete", patch.getError());
+}
+
+void test_data_after_the_end_fails(void)
+{
+    std::vector<uint8_t> longer(deltaFixture, deltaFixture + sizeof(deltaFixture));
+    longer.push_back(0);
+
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(beginPatch(patch, DELTA_FIXTURE_OLD_MD5));
+    TEST_ASSERT_FALSE(patch.write(longer.data(), longer.size()));
+    TEST_ASSERT_EQUAL_STRING("data after the end of the patch", patch.getError());
+}
+
+void test_writer_failure_stops_the_patch(void)
+{
+    DeltaPatch patch;
+    TEST_ASSERT_TRUE(patch.begin(DELTA_FIXTURE_OLD_SIZE, DELTA_FIXTURE_OLD_MD5, readOld,
+                                 [](uint8_t *, size_t) { return false; }));
+    TEST_ASSERT_FALSE(patch.write(deltaFixture, sizeof(deltaFixture)));
+    TEST_ASSERT_EQUAL_STRING("writing the new image failed", patch.getError());
+    TEST_ASSERT_FALSE(patch.write(deltaFixture, 1));
+    TEST_ASSERT_FALSE(patch.finish());
+}
+
+void test_real_firmware_update(void)
+{
+#ifndef DELTA_FIRMWARE_PATCH
+    TEST_IGNORE_MESSAGE("Set DELTA_OLD_FIRMWARE and DELTA_NEW_FIRMWARE to two firmware.bin builds");
+#else
+    std::vector<uint8_t> firmwareOld;
+    std::vector<uint8_t> firmwareNew;
+    std::vector<uint8_t> delta;
+    TEST_ASSERT_TRUE_MESSAGE(readFile(DELTA_FIRMWARE_OLD, firmwareOld), DELTA_FIRMWARE_OLD);
+    TEST_ASSERT_TRUE_MESSAGE(readFile(DELTA_FIRMWARE_NEW, firmwareNew), DELTA_FIRMWARE_NEW);
+    TEST_ASSERT_TRUE_MESSAGE(readFile(DELTA_FIRMWARE_PATCH, delta), DELTA_FIRMWARE_PATCH);
+
+    DeltaPatch::OldReader readFirmware = [&firmwareOld](uint32_t offset, uint8_t *buffer,
+                                                         size_t length)
+    {
+        if (offset + length > firmwareOld.size())
+        {
+            return false;
+        }
+        memcpy(buffer, firmwareOld.data() + offset, length);
+        return true;
+    };
+    newImage.reserve(firmwareNew.size());
+
+    // Fed like the upload handler gets it, one TCP segment at a time
+    DeltaPatch patch;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TEST_ASSERT_TRUE(
+        patch.begin(firmwareOld.size(), DELTA_FIRMWARE_OLD_MD5, readFirmware, writeNew));
+    bool applied = writeInChunks(patch, delta.data(), delta.size(), 1436);
+    TEST_ASSERT_TRUE_MESSAGE(applied, patch.getError());
+    TEST_ASSERT_TRUE_MESSAGE(patch.finish(), patch.getError());
+    patch.end();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    TEST_ASSERT_EQUAL_UINT32(firmwareNew.size(), newImage.size());
+    TEST_ASSERT_TRUE(newImage == firmwareNew);
+
+    double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    char   message[256];
+    snprintf(message, sizeof(message),
+             "Real firmware, %u to %u bytes: patch %u bytes, %.1f%% of the image and %.1f%% of "
+             "it gzipped (%u bytes), applied in %.1f ms on this host",
+             (unsigned) firmwareOld.size(), (unsigned) firmwareNew.size(), (unsigned) delta.size(),
+             100.0 * delta.size() / firmwareNew.size(),
+             100.0 * delta.size() / DELTA_FIRMWARE_GZIP_SIZE, (unsigned) DELTA_FIRMWARE_GZIP_SIZE,
+             milliseconds);
+    TEST_MESSAGE(message);
+#endif
+}
+
+int main()
+{
+    buildOldImage();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fixture_wraps_the_window);
+    RUN_TEST(test_rebuilds_the_image_in_any_chunk_size);
+    RUN_TEST(test_header_is_available_after_48_bytes);
+    RUN_TEST(test_refuses_a_patch_for_other_firmware);
+    RUN_TEST(test_refuses_what_isnt_a_patch);
+    RUN_TEST(test_truncated_patch_is_incomplete);
+    RUN_TEST(test_data_after_the_end_fails);
+    RUN_TEST(test_writer_failure_stops_the_patch);
+    RUN_TEST(test_real_firmware_update);
+    return UNITY_END();
+}
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <new>
+
+#include "improv.h"
+
+// Improv serial codec: round trips, a fuzz run over random and mutated frames, and a decoder
+// throughput benchmark. Every input is copied into a heap block of exactly its size, so a read
+// past the end shows up under the native-sanitize env. Counting operator new proves the codec
+// itself doesn't allocate.
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *pointer = malloc(size > 0 ? size : 1);
+    if (pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+// Deterministic, so a failing fuzz case can be replayed
+static uint32_t randomState;
+
+static uint32_t nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static size_t wifiSettingsFrame(const char *ssid, const char *password, uint8_t *out,
+                                size_t outSize)
+{
+    uint8_t rpc[improv::MAX_DATA_SIZE];
+    size_t  rpcLength = improv::build_rpc_response<const char *>(
+        improv::WIFI_SETTINGS, {ssid, password}, rpc, sizeof(rpc), false);
+    return improv::build_serial_frame(improv::TYPE_RPC, rpc, rpcLength, out, outSize);
+}
+
+static improv::DecodeResult feedAll(improv::SerialDecoder &decoder, const uint8_t *data,
+                                    size_t length, int *commands)
+{
+    improv::DecodeResult last = improv::DECODE_PENDING;
+    for (size_t i = 0; i < length; i++)
+    {
+        improv::DecodeResult result = decoder.feed(data[i]);
+        if (result != improv::DECODE_PENDING)
+        {
+            last = result;
+        }
+        if (result == improv::DECODE_COMMAND && commands != NULL)
+        {
+            (*commands)++;
+        }
+    }
+    return last;
+}
+
+// parse_improv_data on an exact size heap copy
+static improv::ImprovCommand parseCopy(const uint8_t *data, size_t length, bool withChecksum)
+{
+    uint8_t *copy = (uint8_t *) malloc(length > 0 ? length : 1);
+    memcpy(copy, data, length);
+    improv::ImprovCommand command = improv::parse_improv_data(copy, length, withChecksum);
+    free(copy);
+    return command;
+}
+
+static void checkCommand(const improv::ImprovCommand &command)
+{
+    TEST_ASSERT_LESS_THAN(sizeof(command.ssid), strnlen(command.ssid, sizeof(command.ssid)));
+    TEST_ASSERT_LESS_THAN(sizeof(command.password),
+                          strnlen(command.password, sizeof(command.password)));
+}
+
+void setUp(void)
+{
+    randomState = 0x1A2B3C4D;
+}
+
+void tearDown(void)
+{
+}
+
+void test_decodes_wifi_settings(void)
+{
+    uint8_t frame[improv::MAX_SERIAL_FRAME_SIZE];
+    size_t  length = wifiSettingsFrame("home", "secret", frame, sizeof(frame));
+    TEST_ASSERT_GREATER_THAN(0, length);
+
+    improv::SerialDecoder decoder;
+    TEST_ASSERT_EQUAL(improv::DECODE_COMMAND, feedAll(decoder, frame, length, NULL));
+    TEST_ASSERT_EQUAL(improv::WIFI_SETTINGS, decoder.command().command);
+    TEST_ASSERT_EQUAL_STRING("home", decoder.command().ssid);
+    TEST_ASSERT_EQUAL_STRING("secret", decoder.command().password);
+}
+
+void test_resynchronizes_after_garbage(void)
+{
+    uint8_t stream[2 * improv::MAX_SERIAL_FRAME_SIZE];
+    size_t  length = 0;
+    // Log output, a broken start and a frame cut short before the real one
+    const char *noise = "boot: ok\r\nIMPRIMPROV";
+    memcpy(stream, noise, strlen(noise));
+    length += strlen(noise);
+    length += wifiSettingsFrame("home", "secret", stream + length, sizeof(stream) - length);
+
+    improv::SerialDecoder decoder;
+    int                   commands = 0;
+    feedAll(decoder, stream, length, &commands);
+    TEST_ASSERT_EQUAL(1, commands);
+    TEST_ASSERT_EQUAL_STRING("home", decoder.command().ssid);
+}
+
+void test_bad_checksum_is_reported_and_dropped(void)
+{
+    uint8_t frame[improv::MAX_SERIAL_FRAME_SIZE];
+    size_t  length = wifiSettingsFrame("home", "secret", frame, sizeof(frame));
+    frame[length - 1]++;
+
+    improv::SerialDecoder decoder;
+    int                   commands = 0;
+    TEST_ASSERT_EQUAL(improv::DECODE_BAD_CHECKSUM, feedAll(decoder, frame, length, &commands));
+    TEST_ASSERT_EQUAL(0, commands);
+}
+
+void test_credentials_that_dont_fit_are_rejected(void)
+{
+    char ssid[34];
+    memset(ssid, 'a', sizeof(ssid) - 1);
+    ssid[sizeof(ssid) - 1] = '\0';
+
+    uint8_t frame[improv::MAX_SERIAL_FRAME_SIZE];
+    size_t  length = wifiSettingsFrame(ssid, "secret", frame, sizeof(frame));
+
+    improv::SerialDecoder decoder;
+    TEST_ASSERT_EQUAL(improv::DECODE_COMMAND, feedAll(decoder, frame, length, NULL));
+    TEST_ASSERT_EQUAL(improv::WIFI_SETTINGS, decoder.command().command);
+    TEST_ASSERT_EQUAL_STRING("", decoder.command().ssid);
+}
+
+void test_every_truncation_is_parsed_in_bounds(void)
+{
+    uint8_t rpc[improv::MAX_DATA_SIZE];
+    size_t  length = improv::build_rpc_response<const char *>(
+        improv::WIFI_SETTINGS, {"home", "secret"}, rpc, sizeof(rpc), true);
+
+    for (size_t cut = 0; cut <= length; cut++)
+    {
+        improv::ImprovCommand command = parseCopy(rpc, cut, true);
+        checkCommand(command);
+        if (cut < length)
+        {
+            TEST_ASSERT_NOT_EQUAL(improv::WIFI_SETTINGS, command.command);
+        }
+    }
+    improv::ImprovCommand whole = parseCopy(rpc, length, true);
+    TEST_ASSERT_EQUAL_STRING("secret", whole.password);
+}
+
+void test_every_small_frame_is_parsed_in_bounds(void)
+{
+    // All combinations of payload size and the two length bytes, including the ones that point
+    // exactly at or past the end of the data
+    for (size_t payload = 0; payload <= 12; payload++)
+    {
+        for (uint8_t ssidLength = 0; ssidLength <= 14; ssidLength++)
+        {
+            for (uint8_t passLength = 0; passLength <= 14; passLength++)
+            {
+                uint8_t frame[2 + 12 + 1];
+                memset(frame, 'x', sizeof(frame));
+                frame[0] = improv::WIFI_SETTINGS;
+                frame[1] = payload;
+                if (payload >= 1)
+                {
+                    frame[2] = ssidLength;
+                }
+                if (3u + ssidLength < 2 + payload)
+                {
+                    frame[3 + ssidLength] = passLength;
+                }
+                checkCommand(parseCopy(frame, 2 + payload, false));
+                frame[2 + payload] = improv::checksum(frame, 2 + payload);
+                checkCommand(parseCopy(frame, 2 + payload + 1, true));
+            }
+        }
+    }
+}
+
+void test_responses_never_overrun_the_buffer(void)
+{
+    const char *datum[] = {"http://192.168.1.20", "a much longer second string"};
+    uint8_t     out[64 + 8];
+    for (size_t size = 0; size <= 64; size++)
+    {
+        memset(out, 0xEE, sizeof(out));
+        size_t length =
+            improv::build_rpc_response<const char *>(improv::GET_DEVICE_INFO, datum, 2, out, size);
+        TEST_ASSERT_LESS_OR_EQUAL(size, length);
+        for (size_t i = size; i < sizeof(out); i++)
+        {
+            TEST_ASSERT_EQUAL_UINT8(0xEE, out[i]);
+        }
+    }
+
+    uint8_t frame[improv::MAX_SERIAL_FRAME_SIZE];
+    uint8_t data[improv::MAX_DATA_SIZE + 1] = {};
+    TEST_ASSERT_EQUAL(0, improv::build_serial_frame(improv::TYPE_RPC_RESPONSE, data,
+                                                    sizeof(data), frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(0, improv::build_serial_frame(improv::TYPE_RPC_RESPONSE, data, 10, frame,
+                                                    improv::SERIAL_HEADER_SIZE + 10));
+}
+
+void test_fuzz(void)
+{
+    uint8_t valid[improv::MAX_SERIAL_FRAME_SIZE];
+    size_t  validLength = wifiSettingsFrame("home", "secret", valid, sizeof(valid));
+
+    improv::SerialDecoder decoder;
+    size_t                before = allocations;
+    for (int round = 0; round < 200000; round++)
+    {
+        uint8_t input[improv::MAX_SERIAL_FRAME_SIZE + 16];
+        size_t  length;
+        if (round % 2 == 0)
+        {
+            // Random bytes, the magic mostly never shows up so start half of them with it
+            length = nextRandom() % sizeof(input);
+            for (size_t i = 0; i < length; i++)
+            {
+                input[i] = nextRandom();
+            }
+            if (round % 4 == 0 && length >= 8)
+            {
+                memcpy(input, valid, 8);
+            }
+        }
+        else
+        {
+            // A valid frame with a few bytes changed and maybe cut short
+            memcpy(input, valid, validLength);
+            length = validLength;
+            for (int flips = 1 + nextRandom() % 4; flips > 0; flips--)
+            {
+                input[nextRandom() % length] = nextRandom();
+            }
+            if (nextRandom() % 4 == 0)
+            {
+                length = nextRandom() % length;
+            }
+        }
+
+        uint8_t *copy = (uint8_t *) malloc(length > 0 ? length : 1);
+        memcpy(copy, input, length);
+        for (size_t i = 0; i < length; i++)
+        {
+            if (decoder.feed(copy[i]) == improv::DECODE_COMMAND)
+            {
+                checkCommand(decoder.command());
+            }
+        }
+        checkCommand(improv::parse_improv_data(copy, length, true));
+        checkCommand(improv::parse_improv_data(copy, length, false));
+        free(copy);
+    }
+    TEST_ASSERT_EQUAL(0, allocations - before);
+}
+
+void test_decoder_throughput(void)
+{
+    // A stream of back to back frames, as the decoder sees it from the serial port
+    static uint8_t stream[1000 * improv::MAX_SERIAL_FRAME_SIZE];
+    size_t         length = 0;
+    int            frames = 0;
+    while (length + improv::MAX_SERIAL_FRAME_SIZE <= sizeof(stream))
+    {
+        length += wifiSettingsFrame("a network name", "and its passphrase", stream + length,
+                                    sizeof(stream) - length);
+        frames++;
+    }
+
+    improv::SerialDecoder decoder;
+    size_t                before   = allocations;
+    int                   commands = 0;
+    const int             rounds   = 20;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        feedAll(decoder, stream, length, &commands);
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_EQUAL(frames * rounds, commands);
+    TEST_ASSERT_EQUAL(0, allocations - before);
+
+    char message[128];
+    snprintf(message, sizeof(message), "%.1f MB/s, %.0f ns per %u byte frame, 0 allocations",
+             length * rounds / seconds / 1e6, seconds * 1e9 / (frames * rounds),
+             (unsigned) (length / frames));
+    TEST_MESSAGE(message);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_decodes_wifi_settings);
+    RUN_TEST(test_resynchronizes_after_garbage);
+    RUN_TEST(test_bad_checksum_is_reported_and_dropped);
+    RUN_TEST(test_credentials_that_dont_fit_are_rejected);
+    RUN_TEST(test_every_truncation_is_parsed_in_bounds);
+    RUN_TEST(test_every_small_frame_is_parsed_in_bounds);
+    RUN_TEST(test_responses_never_overrun_the_buffer);
+    RUN_TEST(test_fuzz);
+    RUN_TEST(test_decoder_throughput);
+    return UNITY_END();
+}
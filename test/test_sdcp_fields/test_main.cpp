@@ -0,0 +1,224 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "SdcpFields.h"
+
+// Number and CurrenCoord parsing against strtof, and a benchmark against the path it replaced.
+// The old handleStatus copied the field into a String, split it with indexOf/substring and ran
+// toFloat (strtof underneath) on the Z part. std::string stands in for String here, with
+// coordinates long enough that neither keeps them inline. The ArduinoJson parse in front of both
+// is the same filtered parse, so it's left out.
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *pointer = malloc(size > 0 ? size : 1);
+    if (pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+static float oldPathZ(const char *text)
+{
+    std::string coords(text);
+    size_t      first  = coords.find(',');
+    size_t      second = coords.find(',', first + 1);
+    if (first == std::string::npos || second == std::string::npos)
+    {
+        return NAN;
+    }
+    std::string z = coords.substr(second + 1);
+    return strtof(z.c_str(), NULL);
+}
+
+static void assertParsesLikeStrtof(const char *text)
+{
+    float       value = NAN;
+    const char *end   = sdcpParseNumber(text, value);
+    char       *expectedEnd;
+    float       expected = strtof(text, &expectedEnd);
+
+    char message[96];
+    snprintf(message, sizeof(message), "\"%s\" gave %.9g, strtof %.9g", text, value, expected);
+    TEST_ASSERT_TRUE_MESSAGE(end == expectedEnd, message);
+    TEST_ASSERT_TRUE_MESSAGE(fabsf(value - expected) <= fabsf(expected) * 2e-7f, message);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_numbers_match_strtof(void)
+{
+    static const char *const numbers[] = {
+        "0",
+        "-0",
+        "3",
+        "-12.5",
+        "0.25",
+        "256",
+        " 1.5",
+        "+7.75",
+        "249.950000",
+        "115.123456",
+        "0.2",
+        "0.000001",
+        "1234567.125",
+        "5.",
+        "12,5",
+        "0.0000000012",
+        "-0.000000000000000000000123",
+        "0.00000000001234567891",
+        "12345678901234",
+        "99999999999999999999.5",
+    };
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++)
+    {
+        assertParsesLikeStrtof(numbers[i]);
+    }
+}
+
+void test_leading_fractional_zeros_keep_the_scale(void)
+{
+    float value = 0;
+    TEST_ASSERT_NOT_NULL(sdcpParseNumber("0.0000000012", value));
+    TEST_ASSERT_FLOAT_WITHIN(1e-16f, 1.2e-9f, value);
+
+    // More zeros than any float can show, still a number and still zero
+    TEST_ASSERT_NOT_NULL(sdcpParseNumber(
+        "0.000000000000000000000000000000000000000000000000000000000001", value));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, value);
+}
+
+void test_random_numbers_match_strtof(void)
+{
+    srand(1234);
+    for (int i = 0; i < 100000; i++)
+    {
+        char   text[48];
+        double magnitude = pow(10.0, rand() % 16 - 10);
+        snprintf(text, sizeof(text), "%.*f", rand() % 12, (rand() - RAND_MAX / 2) * magnitude);
+        assertParsesLikeStrtof(text);
+    }
+}
+
+void test_rejects_what_isnt_a_number(void)
+{
+    static const char *const notNumbers[] = {"", "-", ".", "abc", " ,1", "+"};
+    for (size_t i = 0; i < sizeof(notNumbers) / sizeof(notNumbers[0]); i++)
+    {
+        float value = 42;
+        TEST_ASSERT_NULL(sdcpParseNumber(notNumbers[i], value));
+        TEST_ASSERT_EQUAL_FLOAT(42, value);
+    }
+    float value = 42;
+    TEST_ASSERT_NULL(sdcpParseNumber(NULL, value));
+}
+
+void test_parses_coordinates(void)
+{
+    sdcp_coord_t coord;
+    TEST_ASSERT_TRUE(sdcpParseCoord("123.45,-67.8,0.2", coord));
+    TEST_ASSERT_EQUAL_FLOAT(123.45f, coord.x);
+    TEST_ASSERT_EQUAL_FLOAT(-67.8f, coord.y);
+    TEST_ASSERT_EQUAL_FLOAT(0.2f, coord.z);
+
+    TEST_ASSERT_TRUE(sdcpParseCoord(" 1.5 , 2.5, 3.25", coord));
+    TEST_ASSERT_EQUAL_FLOAT(3.25f, coord.z);
+}
+
+void test_incomplete_coordinates_change_nothing(void)
+{
+    static const char *const broken[] = {"12.5,8", "1,2,", ",2,3", "1;2;3", ""};
+    for (size_t i = 0; i < sizeof(broken) / sizeof(broken[0]); i++)
+    {
+        sdcp_coord_t coord = {1, 2, 3};
+        TEST_ASSERT_FALSE(sdcpParseCoord(broken[i], coord));
+        TEST_ASSERT_EQUAL_FLOAT(1, coord.x);
+        TEST_ASSERT_EQUAL_FLOAT(2, coord.y);
+        TEST_ASSERT_EQUAL_FLOAT(3, coord.z);
+    }
+    sdcp_coord_t coord = {1, 2, 3};
+    TEST_ASSERT_FALSE(sdcpParseCoord(NULL, coord));
+}
+
+void test_benchmark_against_the_string_path(void)
+{
+    // What the printer sends, six decimals
+    static const char *const frames[] = {
+        "115.123456,120.654321,12.400000",
+        "0.000000,255.999999,0.200000",
+        "-3.500000,17.250000,249.950000",
+    };
+    const int      rounds = 1000000;
+    volatile float sink   = 0;
+
+    size_t                                before = allocations;
+    std::chrono::steady_clock::time_point start  = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        sink = sink + oldPathZ(frames[i % 3]);
+    }
+    std::chrono::steady_clock::time_point middle    = std::chrono::steady_clock::now();
+    size_t                                oldAllocs = allocations - before;
+
+    before = allocations;
+    for (int i = 0; i < rounds; i++)
+    {
+        sdcp_coord_t coord;
+        sdcpParseCoord(frames[i % 3], coord);
+        sink = sink + coord.z;
+    }
+    std::chrono::steady_clock::time_point end       = std::chrono::steady_clock::now();
+    size_t                                newAllocs = allocations - before;
+
+    for (int i = 0; i < 3; i++)
+    {
+        sdcp_coord_t coord;
+        TEST_ASSERT_TRUE(sdcpParseCoord(frames[i], coord));
+        TEST_ASSERT_EQUAL_FLOAT(oldPathZ(frames[i]), coord.z);
+    }
+    TEST_ASSERT_EQUAL(0, newAllocs);
+
+    double oldNs = std::chrono::duration<double, std::nano>(middle - start).count() / rounds;
+    double newNs = std::chrono::duration<double, std::nano>(end - middle).count() / rounds;
+    char   message[160];
+    snprintf(message, sizeof(message),
+             "String/strtof path (Z only): %.1f ns, %.2f allocations per frame; "
+             "sdcpParseCoord (x, y, z): %.1f ns, %.2f allocations per frame",
+             oldNs, (double) oldAllocs / rounds, newNs, (double) newAllocs / rounds);
+    TEST_MESSAGE(message);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_numbers_match_strtof);
+    RUN_TEST(test_leading_fractional_zeros_keep_the_scale);
+    RUN_TEST(test_random_numbers_match_strtof);
+    RUN_TEST(test_rejects_what_isnt_a_number);
+    RUN_TEST(test_parses_coordinates);
+    RUN_TEST(test_incomplete_coordinates_change_nothing);
+    RUN_TEST(test_benchmark_against_the_string_path);
+    return UNITY_END();
+}
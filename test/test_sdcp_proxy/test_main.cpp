@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "SdcpFields.h"
+#include "SdcpRoutes.h"
+
+// How the SDCP proxy decides where a printer frame goes: the RequestID is found in the raw frame,
+// then the route table says which client asked for it. No RequestID means a broadcast.
+
+static SdcpRouteTable *routes;
+
+static const char statusFrame[] =
+    "{\"Status\":{\"CurrentStatus\":[1],\"CurrenCoord\":\"12.5,8.0,0.2\",\"PrintInfo\":"
+    "{\"Status\":3,\"Filename\":\"RequestID.gcode\"}},\"MainboardID\":\"abc\","
+    "\"TimeStamp\":1700000000,\"Topic\":\"sdcp/status/abc\"}";
+
+static const char responseFrame[] =
+    "{\"Id\":\"f25273b12b094c5a8b4f1c2d3e4f5a6b\",\"Data\":{\"Cmd\":0,\"Data\":{\"Ack\":0},"
+    "\"RequestID\":\"0123456789abcdef0123456789abcdef\",\"MainboardID\":\"abc\","
+    "\"TimeStamp\":1700000000},\"Topic\":\"sdcp/response/abc\"}";
+
+// The client waiting for requestId, or -1 for nobody
+static long take(const char *requestId, unsigned long now)
+{
+    uint32_t client;
+    return routes->take(requestId, now, client) ? (long) client : -1;
+}
+
+// Where a printer frame ends up: a client, or -2 for everyone, or -1 for nobody
+static long route(const char *frame, size_t length, unsigned long now)
+{
+    char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+    if (!sdcpFindRequestId((const uint8_t *) frame, length, requestId, sizeof(requestId)))
+    {
+        return -2;
+    }
+    return take(requestId, now);
+}
+
+static long route(const char *frame, unsigned long now)
+{
+    return route(frame, strlen(frame), now);
+}
+
+void setUp(void)
+{
+    routes = new SdcpRouteTable();
+}
+
+void tearDown(void)
+{
+    delete routes;
+}
+
+void test_finds_the_request_id_in_a_response(void)
+{
+    char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+    TEST_ASSERT_TRUE(sdcpFindRequestId((const uint8_t *) responseFrame, strlen(responseFrame),
+                                       requestId, sizeof(requestId)));
+    TEST_ASSERT_EQUAL_STRING("0123456789abcdef0123456789abcdef", requestId);
+
+    const char *spaced = "{ \"Data\" : { \"RequestID\" :\n \"a-b\" } }";
+    TEST_ASSERT_TRUE(
+        sdcpFindRequestId((const uint8_t *) spaced, strlen(spaced), requestId, sizeof(requestId)));
+    TEST_ASSERT_EQUAL_STRING("a-b", requestId);
+}
+
+void test_status_frames_have_no_request_id(void)
+{
+    // Filename says RequestID, but as a value, not a key
+    char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+    TEST_ASSERT_FALSE(sdcpFindRequestId((const uint8_t *) statusFrame, strlen(statusFrame),
+                                        requestId, sizeof(requestId)));
+    const char *named = "{\"Name\":\"RequestID\",\"Data\":{\"RequestID\":\"77\"}}";
+    TEST_ASSERT_TRUE(
+        sdcpFindRequestId((const uint8_t *) named, strlen(named), requestId, sizeof(requestId)));
+    TEST_ASSERT_EQUAL_STRING("77", requestId);
+}
+
+void test_request_ids_that_cant_be_kept_are_not_found(void)
+{
+    static const char *const frames[] = {
+        "{\"RequestID\":\"0123456789abcdef0123456789abcdef0123456789\"}",  // Too long
+        "{\"RequestID\":\"ab\\\"cd\"}",                                     // Escaped
+        "{\"RequestID\":17}",                                              // Not a string
+        "{\"RequestID\":\"unterminated",
+        "{\"RequestID\"",
+        "",
+    };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+    {
+        char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+        TEST_ASSERT_FALSE_MESSAGE(sdcpFindRequestId((const uint8_t *) frames[i],
+                                                    strlen(frames[i]), requestId,
+                                                    sizeof(requestId)),
+                                  frames[i]);
+    }
+}
+
+void test_every_truncation_of_a_response_stays_in_bounds(void)
+{
+    // The frame isn't terminated on the socket, a cut one must not be read past its length
+    size_t length = strlen(responseFrame);
+    for (size_t cut = 0; cut < length; cut++)
+    {
+        uint8_t *copy = new uint8_t[cut > 0 ? cut : 1];
+        memcpy(copy, responseFrame, cut);
+        char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+        bool found = sdcpFindRequestId(copy, cut, requestId, sizeof(requestId));
+        delete[] copy;
+        // Found once the cut keeps the quote that closes the RequestID
+        size_t closingQuote = strstr(responseFrame, "\",\"Main") - responseFrame;
+        TEST_ASSERT_EQUAL(cut > closingQuote, found);
+    }
+}
+
+void test_responses_go_to_the_client_that_asked(void)
+{
+    TEST_ASSERT_TRUE(routes->add(3, "0123456789abcdef0123456789abcdef", 1000));
+    TEST_ASSERT_TRUE(routes->add(5, "other", 1000));
+    TEST_ASSERT_EQUAL(2, routes->getPendingCount());
+
+    TEST_ASSERT_EQUAL(-2, route(statusFrame, 1100));
+    TEST_ASSERT_EQUAL(3, route(responseFrame, 1200));
+    // Only once, a repeat has nobody waiting for it
+    TEST_ASSERT_EQUAL(-1, route(responseFrame, 1300));
+    TEST_ASSERT_EQUAL(1, routes->getPendingCount());
+    TEST_ASSERT_EQUAL(0, routes->getExpired());
+}
+
+void test_responses_to_our_own_commands_go_nowhere(void)
+{
+    routes->add(3, "someone-else", 1000);
+    TEST_ASSERT_EQUAL(-1, route(responseFrame, 1100));
+    TEST_ASSERT_EQUAL(1, routes->getPendingCount());
+}
+
+void test_late_responses_are_expired(void)
+{
+    routes->add(3, "0123456789abcdef0123456789abcdef", 1000);
+    TEST_ASSERT_EQUAL(-1, route(responseFrame, 1000 + SDCP_PROXY_PENDING_TIMEOUT_MS + 1));
+    TEST_ASSERT_EQUAL(1, routes->getExpired());
+    TEST_ASSERT_EQUAL(0, routes->getPendingCount());
+
+    routes->add(3, "0123456789abcdef0123456789abcdef", 20000);
+    TEST_ASSERT_EQUAL(3, route(responseFrame, 20000 + SDCP_PROXY_PENDING_TIMEOUT_MS));
+}
+
+void test_full_table_gives_up_on_the_oldest(void)
+{
+    char requestId[SDCP_PROXY_REQUEST_ID_SIZE];
+    for (int i = 0; i < SDCP_PROXY_MAX_PENDING; i++)
+    {
+        snprintf(requestId, sizeof(requestId), "request-%d", i);
+        TEST_ASSERT_TRUE(routes->add(i % 4, requestId, 1000 + i));
+    }
+    TEST_ASSERT_TRUE(routes->add(7, "newest", 2000));
+    TEST_ASSERT_EQUAL(SDCP_PROXY_MAX_PENDING, routes->getPendingCount());
+    TEST_ASSERT_EQUAL(1, routes->getExpired());
+
+    TEST_ASSERT_EQUAL(-1, take("request-0", 2100));
+    TEST_ASSERT_EQUAL(1, take("request-1", 2100));
+    TEST_ASSERT_EQUAL(7, take("newest", 2100));
+}
+
+void test_disconnected_clients_lose_their_requests(void)
+{
+    routes->add(3, "0123456789abcdef0123456789abcdef", 1000);
+    routes->add(4, "kept", 1000);
+    routes->dropClient(3);
+    TEST_ASSERT_EQUAL(-1, route(responseFrame, 1100));
+    TEST_ASSERT_EQUAL(4, take("kept", 1100));
+}
+
+void test_request_ids_too_long_to_route_are_refused(void)
+{
+    char requestId[SDCP_PROXY_REQUEST_ID_SIZE + 1];
+    memset(requestId, 'a', SDCP_PROXY_REQUEST_ID_SIZE);
+    requestId[SDCP_PROXY_REQUEST_ID_SIZE] = '\0';
+    TEST_ASSERT_FALSE(routes->add(3, requestId, 1000));
+    TEST_ASSERT_EQUAL(0, routes->getPendingCount());
+
+    requestId[SDCP_PROXY_REQUEST_ID_SIZE - 1] = '\0';
+    TEST_ASSERT_TRUE(routes->add(3, requestId, 1000));
+}
+
+void test_large_frames_are_routed_too(void)
+{
+    // Bigger than the document our own parse keeps, the proxy doesn't care
+    static char frame[16384];
+    size_t      length = 0;
+    length +=
+        snprintf(frame, sizeof(frame), "{\"Id\":\"x\",\"Data\":{\"Cmd\":1,\"Data\":{\"Files\":[");
+    while (length < sizeof(frame) - 200)
+    {
+        length += snprintf(frame + length, sizeof(frame) - length, "\"file-%zu.gcode\",", length);
+    }
+    length += snprintf(frame + length, sizeof(frame) - length,
+                       "\"last\"]},\"RequestID\":\"big-one\"}}");
+
+    routes->add(2, "big-one", 1000);
+    TEST_ASSERT_EQUAL(2, route(frame, length, 1100));
+}
+
+void test_client_ids_past_255_are_kept(void)
+{
+    // The websocket server numbers every connection, long-running proxies get there
+    routes->add(70000, "0123456789abcdef0123456789abcdef", 1000);
+    routes->add(70000 + 256, "other", 1000);
+    TEST_ASSERT_EQUAL(70000, route(responseFrame, 1100));
+    routes->dropClient(70000);
+    TEST_ASSERT_EQUAL(70256, take("other", 1100));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_finds_the_request_id_in_a_response);
+    RUN_TEST(test_status_frames_have_no_request_id);
+    RUN_TEST(test_request_ids_that_cant_be_kept_are_not_found);
+    RUN_TEST(test_every_truncation_of_a_response_stays_in_bounds);
+    RUN_TEST(test_responses_go_to_the_client_that_asked);
+    RUN_TEST(test_responses_to_our_own_commands_go_nowhere);
+    RUN_TEST(test_late_responses_are_expired);
+    RUN_TEST(test_full_table_gives_up_on_the_oldest);
+    RUN_TEST(test_disconnected_clients_lose_their_requests);
+    RUN_TEST(test_request_ids_too_long_to_route_are_refused);
+    RUN_TEST(test_large_frames_are_routed_too);
+    RUN_TEST(test_client_ids_past_255_are_kept);
+    return UNITY_END();
+}
@@ -0,0 +1,291 @@
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "WifiManager.h"
+
+// Runs the WiFi state machine against a fake radio. Time is whatever the test passes to loop().
+
+class FakeWifiDriver : public WifiDriver
+{
+   public:
+    WifiManager *manager         = NULL;
+    bool         connected       = false;
+    bool         apRunning       = false;
+    bool         rememberedFast  = false;  // The fast connect cache has an entry for ssid
+    int          stationConnects = 0;
+    int          fastConnects    = 0;
+    int          accessPoints    = 0;
+    int          stops           = 0;
+    int          forgets         = 0;
+    std::string  lastSsid;
+    std::string  lastPassword;
+    std::string  rememberedSsid;
+
+    void begin(WifiManager *owner) override
+    {
+        manager = owner;
+    }
+
+    void connectStation(const char *ssid, const char *password, bool fast) override
+    {
+        stationConnects++;
+        fastConnects += fast ? 1 : 0;
+        lastSsid     = ssid;
+        lastPassword = password;
+    }
+
+    void startAccessPoint() override
+    {
+        accessPoints++;
+        apRunning = true;
+    }
+
+    void stop() override
+    {
+        stops++;
+        connected = false;
+        apRunning = false;
+    }
+
+    bool isStationConnected() override
+    {
+        return connected;
+    }
+
+    bool canFastConnect(const char *ssid) override
+    {
+        return rememberedFast && rememberedSsid == ssid;
+    }
+
+    void rememberAccessPoint(const char *ssid) override
+    {
+        rememberedFast = true;
+        rememberedSsid = ssid;
+    }
+
+    void forgetAccessPoint() override
+    {
+        forgets++;
+        rememberedFast = false;
+    }
+
+    // What the event handler would do when the radio reports something
+    void associate()
+    {
+        connected = true;
+        manager->notifyEvent();
+    }
+
+    void drop()
+    {
+        connected = false;
+        manager->notifyEvent();
+    }
+};
+
+static FakeWifiDriver           *driver;
+static WifiManager              *wifi;
+static std::vector<wifi_state_t> states;
+static std::vector<std::string>  logLines;
+static int                       firstConnectFailures;
+
+// Calls loop() every 100ms up to and including until, like the main loop would
+static void runUntil(unsigned long from, unsigned long until)
+{
+    for (unsigned long now = from; now < until; now += 100)
+    {
+        wifi->loop(now);
+    }
+    wifi->loop(until);
+}
+
+void setUp(void)
+{
+    driver = new FakeWifiDriver();
+    wifi   = new WifiManager(*driver);
+    states.clear();
+    logLines.clear();
+    firstConnectFailures       = 0;
+    wifi->onStateChange        = [](wifi_state_t state) { states.push_back(state); };
+    wifi->onFirstConnectFailed = []() { firstConnectFailures++; };
+    wifi->onLog                = [](const char *message) { logLines.push_back(message); };
+}
+
+void tearDown(void)
+{
+    delete wifi;
+    delete driver;
+}
+
+void test_connects_when_the_radio_reports_an_address(void)
+{
+    wifi->begin(false, "home", "secret", false, 0);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(1, driver->stationConnects);
+    TEST_ASSERT_EQUAL_STRING("home", driver->lastSsid.c_str());
+    TEST_ASSERT_EQUAL_STRING("secret", driver->lastPassword.c_str());
+
+    // Nothing happens without an event or a deadline
+    wifi->loop(1000);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+
+    driver->associate();
+    wifi->loop(2000);
+    TEST_ASSERT_TRUE(wifi->isConnected());
+    TEST_ASSERT_TRUE(driver->rememberedFast);
+    TEST_ASSERT_EQUAL_STRING("home", driver->rememberedSsid.c_str());
+}
+
+void test_connect_timeout_with_new_credentials_falls_back_to_ap(void)
+{
+    wifi->begin(false, "home", "wrong", false, 0);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CONNECT_TIMEOUT, wifi->timeUntilDeadline(0));
+
+    wifi->loop(WIFI_CONNECT_TIMEOUT - 1);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+
+    wifi->loop(WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_EQUAL(WIFI_STATE_AP, wifi->getState());
+    TEST_ASSERT_EQUAL(1, firstConnectFailures);
+    TEST_ASSERT_TRUE(driver->apRunning);
+}
+
+void test_connect_timeout_with_known_credentials_retries(void)
+{
+    wifi->begin(false, "home", "secret", true, 0);
+    wifi->loop(WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_EQUAL(WIFI_STATE_WAITING_RETRY, wifi->getState());
+    TEST_ASSERT_EQUAL(0, firstConnectFailures);
+    TEST_ASSERT_EQUAL(0, driver->accessPoints);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_RETRY_INTERVAL, wifi->timeUntilDeadline(WIFI_CONNECT_TIMEOUT));
+
+    unsigned long retryAt = WIFI_CONNECT_TIMEOUT + WIFI_RETRY_INTERVAL;
+    wifi->loop(retryAt);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(2, driver->stationConnects);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_RECONNECT_TIMEOUT, wifi->timeUntilDeadline(retryAt));
+}
+
+void test_reconnects_after_losing_the_access_point(void)
+{
+    wifi->begin(false, "home", "secret", false, 0);
+    driver->associate();
+    wifi->loop(100);
+    TEST_ASSERT_TRUE(wifi->isConnected());
+
+    // The access point goes away for longer than one reconnect attempt. The attempt tries the
+    // remembered access point first, then scans for the rest of WIFI_RECONNECT_TIMEOUT.
+    driver->drop();
+    wifi->loop(5000);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(1, driver->fastConnects);
+
+    unsigned long now = 5000 + WIFI_RECONNECT_TIMEOUT;
+    runUntil(5000, now - 1);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(1, driver->forgets);
+    wifi->loop(now);
+    TEST_ASSERT_EQUAL(WIFI_STATE_WAITING_RETRY, wifi->getState());
+    TEST_ASSERT_EQUAL(0, firstConnectFailures);
+
+    runUntil(now, now + WIFI_RETRY_INTERVAL);
+    now += WIFI_RETRY_INTERVAL;
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(4, driver->stationConnects);
+
+    // And comes back
+    driver->associate();
+    wifi->loop(now + 100);
+    TEST_ASSERT_TRUE(wifi->isConnected());
+}
+
+void test_fast_connect_falls_back_to_a_scan(void)
+{
+    driver->rememberAccessPoint("home");
+    wifi->begin(false, "home", "secret", true, 0);
+    TEST_ASSERT_EQUAL(1, driver->fastConnects);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_FAST_CONNECT_TIMEOUT, wifi->timeUntilDeadline(0));
+
+    wifi->loop(WIFI_FAST_CONNECT_TIMEOUT);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL(1, driver->forgets);
+    TEST_ASSERT_EQUAL(2, driver->stationConnects);
+    TEST_ASSERT_EQUAL(1, driver->fastConnects);
+    // The scan gets what's left of the attempt
+    TEST_ASSERT_EQUAL_UINT32(WIFI_CONNECT_TIMEOUT - WIFI_FAST_CONNECT_TIMEOUT,
+                             wifi->timeUntilDeadline(WIFI_FAST_CONNECT_TIMEOUT));
+
+    driver->associate();
+    wifi->loop(WIFI_FAST_CONNECT_TIMEOUT + 100);
+    TEST_ASSERT_TRUE(wifi->isConnected());
+}
+
+void test_credential_change_reconnects_with_the_new_ones(void)
+{
+    wifi->begin(false, "home", "secret", false, 0);
+    driver->associate();
+    wifi->loop(100);
+    TEST_ASSERT_TRUE(wifi->isConnected());
+
+    wifi->begin(false, "office", "other", false, 200);
+    TEST_ASSERT_EQUAL(1, driver->stops);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, wifi->getState());
+    TEST_ASSERT_EQUAL_STRING("office", driver->lastSsid.c_str());
+    TEST_ASSERT_EQUAL_STRING("other", driver->lastPassword.c_str());
+    // The cache is for the old network
+    TEST_ASSERT_EQUAL(0, driver->fastConnects);
+
+    // New credentials that never worked still fall back to our access point
+    wifi->loop(200 + WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_EQUAL(WIFI_STATE_AP, wifi->getState());
+    TEST_ASSERT_EQUAL(1, firstConnectFailures);
+}
+
+void test_ap_mode_starts_the_access_point(void)
+{
+    wifi->begin(true, "", "", false, 0);
+    TEST_ASSERT_EQUAL(WIFI_STATE_AP, wifi->getState());
+    TEST_ASSERT_EQUAL(0, driver->stationConnects);
+    TEST_ASSERT_TRUE(driver->apRunning);
+
+    // Stays there, only checking back now and then
+    wifi->loop(WIFI_RECONNECT_TIMEOUT);
+    TEST_ASSERT_EQUAL(WIFI_STATE_AP, wifi->getState());
+    TEST_ASSERT_EQUAL_UINT32(WIFI_RECONNECT_TIMEOUT,
+                             wifi->timeUntilDeadline(WIFI_RECONNECT_TIMEOUT));
+}
+
+void test_transitions_are_reported_and_logged(void)
+{
+    wifi->begin(false, "home", "secret", false, 0);
+    driver->associate();
+    wifi->loop(100);
+
+    TEST_ASSERT_EQUAL(2, states.size());
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTING, states[0]);
+    TEST_ASSERT_EQUAL(WIFI_STATE_CONNECTED, states[1]);
+
+    bool logged = false;
+    for (size_t i = 0; i < logLines.size(); i++)
+    {
+        logged |= logLines[i] == "WiFi state: connecting -> connected";
+    }
+    TEST_ASSERT_TRUE(logged);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_connects_when_the_radio_reports_an_address);
+    RUN_TEST(test_connect_timeout_with_new_credentials_falls_back_to_ap);
+    RUN_TEST(test_connect_timeout_with_known_credentials_retries);
+    RUN_TEST(test_reconnects_after_losing_the_access_point);
+    RUN_TEST(test_fast_connect_falls_back_to_a_scan);
+    RUN_TEST(test_credential_change_reconnects_with_the_new_ones);
+    RUN_TEST(test_ap_mode_starts_the_access_point);
+    RUN_TEST(test_transitions_are_reported_and_logged);
+    return UNITY_END();
+}
@@ -10,7 +10,6 @@ function About() {
       <li><a class="link link-accent" target="_blank" href="https://github.com/me-no-dev/ESPAsyncWebServer">ESPAsyncWebServer</a> - webserver</li>
       <li><a class="link link-accent" target="_blank" href="https://github.com/Links2004/arduinoWebSockets">WebSocket Client</a> - websockets</li>
       <li><a class="link link-accent" target="_blank" href="https://github.com/robtillaart/UUID">UUID</a> - uuids</li>
-      <li><a class="link link-accent" target="_blank" href="https://github.com/ayushsharma82/ElegantOTA">ElegantOTA</a> - firmware updater</li>
       <li><a class="link link-accent" target="_blank" href="https://www.solidjs.com/">Solid-JS</a> - frontend library</li>
       <li><a class="link link-accent" target="_blank" href="https://tailwindcss.com/">TailwindCSS</a> - css framework</li>
       <li><a class="link link-accent" target="_blank" href="https://daisyui.com/">DaisyUI</a> - ui framework</li>
@@ -13,6 +13,14 @@ function Settings() {
   const [apMode, setApMode] = createSignal<boolean | null>(null);
   const [pauseOnRunout, setPauseOnRunout] = createSignal(true);
   const [enabled, setEnabled] = createSignal(true);
+  const [staticIp, setStaticIp] = createSignal('')
+  const [gateway, setGateway] = createSignal('')
+  const [subnet, setSubnet] = createSignal('')
+  const [dns, setDns] = createSignal('')
+  const [loopAlarm, setLoopAlarm] = createSignal(250)
+  const [stopFeedingFallback, setStopFeedingFallback] = createSignal(false)
+  const [proxyEnabled, setProxyEnabled] = createSignal(false)
+  const [apiPassword, setApiPassword] = createSignal('')
   // Load settings from the server and scan for WiFi networks
   onMount(async () => {
     try {
@@ -35,6 +43,13 @@ function Settings() {
       setApMode(settings.ap_mode || null)
       setPauseOnRunout(settings.pause_on_runout !== undefined ? settings.pause_on_runout : true)
       setEnabled(settings.enabled !== undefined ? settings.enabled : true)
+      setStaticIp(settings.static_ip || '')
+      setGateway(settings.gateway || '')
+      setSubnet(settings.subnet || '')
+      setDns(settings.dns || '')
+      setLoopAlarm(settings.loop_alarm_ms !== undefined ? settings.loop_alarm_ms : 250)
+      setStopFeedingFallback(settings.stop_feeding_fallback || false)
+      setProxyEnabled(settings.proxy_enabled || false)
 
       setError('')
     } catch (err: any) {
@@ -61,6 +76,14 @@ function Settings() {
         pause_on_runout: pauseOnRunout(),
         start_print_timeout: startPrintTimeout(),
         enabled: enabled(),
+        static_ip: staticIp(),
+        gateway: gateway(),
+        subnet: subnet(),
+        dns: dns(),
+        loop_alarm_ms: loopAlarm(),
+        stop_feeding_fallback: stopFeedingFallback(),
+        proxy_enabled: proxyEnabled(),
+        api_password: apiPassword(),
       }
 
       const response = await fetch('/update_settings', {
@@ -145,6 +168,57 @@ function Settings() {
             )
           }
 
+          <h2 class="text-lg font-bold mb-4 mt-10">Static IP</h2>
+          <p class="label mb-2">Optional, leave the IP address empty to use DHCP. A static address makes reconnecting after a power cycle faster.</p>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">IP Address</legend>
+            <input
+              type="text"
+              id="staticIp"
+              value={staticIp()}
+              onInput={(e) => setStaticIp(e.target.value)}
+              placeholder="xxx.xxx.xxx.xxx"
+              class="input"
+            />
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Gateway</legend>
+            <input
+              type="text"
+              id="gateway"
+              value={gateway()}
+              onInput={(e) => setGateway(e.target.value)}
+              placeholder="xxx.xxx.xxx.xxx"
+              class="input"
+            />
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Subnet Mask</legend>
+            <input
+              type="text"
+              id="subnet"
+              value={subnet()}
+              onInput={(e) => setSubnet(e.target.value)}
+              placeholder="255.255.255.0"
+              class="input"
+            />
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">DNS Server</legend>
+            <input
+              type="text"
+              id="dns"
+              value={dns()}
+              onInput={(e) => setDns(e.target.value)}
+              placeholder="Defaults to the gateway"
+              class="input"
+            />
+          </fieldset>
+
           <h2 class="text-lg font-bold mb-4 mt-10">Device Settings</h2>
 
 
@@ -236,6 +310,64 @@ function Settings() {
             </label>
           </fieldset>
 
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Stop Feeding Fallback</legend>
+            <label class="label cursor-pointer">
+              <input
+                type="checkbox"
+                id="stopFeedingFallback"
+                checked={stopFeedingFallback()}
+                onChange={(e) => setStopFeedingFallback(e.target.checked)}
+                class="checkbox checkbox-accent"
+              />
+              <span class="label-text">If the printer doesn't confirm a pause after several attempts, tell it to stop feeding filament instead</span>
+
+            </label>
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Printer Connection Sharing</legend>
+            <label class="label cursor-pointer">
+              <input
+                type="checkbox"
+                id="proxyEnabled"
+                checked={proxyEnabled()}
+                onChange={(e) => setProxyEnabled(e.target.checked)}
+                class="checkbox checkbox-accent"
+              />
+              <span class="label-text">Let other tools (slicer, remote access) connect to this device on port 3030 instead of the printer, sharing its single connection</span>
+
+            </label>
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Printer Control Password</legend>
+            <input
+              type="password"
+              id="apiPassword"
+              value={apiPassword()}
+              onInput={(e) => setApiPassword(e.target.value)}
+              placeholder="Leave empty to keep the current password"
+              class="input"
+            />
+            <p class="label">Enables /printer/pause, /printer/resume and /printer/status-refresh for user "admin". Once set, saving settings and firmware updates ask for it too</p>
+          </fieldset>
+
+          <fieldset class="fieldset">
+            <legend class="fieldset-legend">Loop Stall Alarm</legend>
+            <input
+              type="number"
+              id="loopAlarm"
+              value={loopAlarm()}
+              onInput={(e) => setLoopAlarm(parseInt(e.target.value) || 0)}
+              min="0"
+              max="60000"
+              step="50"
+              class="input"
+            />
+            <p class="label">Log a warning when one pass of the main loop takes longer than this many milliseconds, 0 disables it</p>
+          </fieldset>
+
           <button
             class="btn btn-accent btn-soft mt-10"
             onClick={handleSave}
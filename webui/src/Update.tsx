@@ -1,5 +1,132 @@
+import { createSignal, onMount, onCleanup } from 'solid-js'
+
+interface OtaStatus {
+  state: string
+  target: string
+  received: number
+  written: number
+  expected: number
+  progress: number
+  elapsed_ms: number
+  error?: string
+  reboot_pending: boolean
+  flash_writes: {
+    sectors: number
+    average_us: number
+    max_us: number
+    total_ms: number
+    gap_ms: number
+  }
+}
+
 function Update() {
-  return <iframe class="w-full h-160" src="/update"></iframe>
+  const [target, setTarget] = createSignal('firmware')
+  const [file, setFile] = createSignal<File | null>(null)
+  const [uploadProgress, setUploadProgress] = createSignal(0)
+  const [uploading, setUploading] = createSignal(false)
+  const [status, setStatus] = createSignal<OtaStatus | null>(null)
+  const [error, setError] = createSignal('')
+
+  const refreshStatus = async () => {
+    try {
+      const response = await fetch('/ota/status')
+      setStatus(await response.json())
+    } catch (err) {
+      // The device is probably rebooting into the update
+    }
+  }
+
+  onMount(async () => {
+    await refreshStatus()
+    const intervalId = setInterval(refreshStatus, 1000)
+
+    onCleanup(() => {
+      clearInterval(intervalId)
+    })
+  })
+
+  const handleUpload = () => {
+    const selected = file()
+    if (!selected) {
+      return
+    }
+    setError('')
+    setUploading(true)
+    setUploadProgress(0)
+
+    // fetch() can't report upload progress
+    const form = new FormData()
+    form.append('file', selected, selected.name)
+    const request = new XMLHttpRequest()
+    request.open('POST', `/ota/upload?target=${target()}`)
+    request.upload.onprogress = (e) => {
+      if (e.lengthComputable) {
+        setUploadProgress(Math.round((e.loaded / e.total) * 100))
+      }
+    }
+    request.onload = () => {
+      setUploading(false)
+      if (request.status !== 200) {
+        setError(`Update failed: ${request.responseText || request.status}`)
+      }
+      refreshStatus()
+    }
+    request.onerror = () => {
+      setUploading(false)
+      setError('Upload failed, check the connection to the device')
+    }
+    request.send(form)
+  }
+
+  return (
+    <div class="card w-full bg-base-200 card-sm shadow-sm">
+      <div class="card-body">
+        <h2 class="card-title">Update</h2>
+        <p>Monitoring keeps running during the upload. A verified update is installed once the printer is idle, so it's safe to upload in the middle of a print.</p>
+
+        <fieldset class="fieldset">
+          <legend class="fieldset-legend">Target</legend>
+          <select class="select" value={target()} onChange={(e) => setTarget(e.target.value)}>
+            <option value="firmware">Firmware (firmware.bin)</option>
+            <option value="delta">Firmware patch (.delta, made with make_delta.py)</option>
+          </select>
+        </fieldset>
+
+        <fieldset class="fieldset">
+          <legend class="fieldset-legend">File</legend>
+          <input
+            type="file"
+            accept=".bin,.delta"
+            class="file-input"
+            onChange={(e) => setFile(e.target.files?.[0] || null)}
+          />
+        </fieldset>
+
+        <button class="btn btn-accent btn-soft mt-4" disabled={!file() || uploading()} onClick={handleUpload}>
+          Upload
+        </button>
+
+        {uploading() && <progress class="progress progress-accent w-full mt-4" value={uploadProgress()} max="100"></progress>}
+
+        {error() && (
+          <div role="alert" class="mt-4 alert alert-error alert-soft">
+            <span>{error()}</span>
+          </div>
+        )}
+
+        {status() && status()!.state !== 'idle' && (
+          <div class="mt-4">
+            <p>Update state: <span class="font-bold">{status()!.state}</span> ({status()!.target})</p>
+            {status()!.reboot_pending && <p>Waiting for the printer to be idle before rebooting into the update</p>}
+            {status()!.error && <p class="text-error">{status()!.error}</p>}
+            <p>Received {status()!.received} bytes in {status()!.elapsed_ms} ms</p>
+            {status()!.target === 'delta' && <p>Rebuilt {status()!.written} bytes of firmware from the patch</p>}
+            <p>Flash writes: {status()!.flash_writes.sectors} sectors, average {status()!.flash_writes.average_us} us, max {status()!.flash_writes.max_us} us</p>
+          </div>
+        )}
+      </div>
+    </div>
+  )
 }
 
-export default Update
\ No newline at end of file
+export default Update